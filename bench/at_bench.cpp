@@ -0,0 +1,167 @@
+/**
+ * Host throughput benchmark of the AT command path.
+ *
+ * Pushes recorded AT scripts through the Serial shim and the full
+ * process_at_commands -> at_parse_line -> handler dispatch path, and reports
+ * commands/sec, bytes/sec and the worst-case latency of a single command.
+ *
+ * Build & run: pio run -e native -t exec
+ */
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+#include "at_parser.h"
+#include "at_command_process.h"
+#include "basic_commands.h"
+#include "wifi_commands.h"
+#include "tcp_ip_commands.h"
+#include "mqtt_commands.h"
+#include "response.h"
+
+#ifndef BENCH_ITERATIONS
+#define BENCH_ITERATIONS 20000
+#endif
+
+typedef struct _bench_script
+{
+    const char *name;
+    const char *const *lines;
+    size_t count;
+} BENCH_SCRIPT;
+
+/* Host polling its status, as done every second in production. */
+static const char *const polling_script[] = {
+    "AT+CIPRECVLEN?\r\n",
+    "AT+CWSTATE?\r\n",
+    "AT+CIPSTATE?\r\n",
+};
+
+/* Configuration round-trip of a freshly booted module. */
+static const char *const setup_script[] = {
+    "AT\r\n",
+    "AT+GMR\r\n",
+    "AT+CWMODE=1\r\n",
+    "AT+CWMODE?\r\n",
+    "AT+CWDHCP=1,0\r\n",
+    "AT+CWDHCP?\r\n",
+    "AT+CWHOSTNAME=bench-node\r\n",
+    "AT+CWHOSTNAME?\r\n",
+    "AT+CIPSTA?\r\n",
+};
+
+/* No-op command: measures the UART -> parser -> callback path alone. */
+static const char *const dispatch_script[] = {
+    "AT+BENCH\r\n",
+    "AT+BENCH?\r\n",
+    "AT+BENCH=1,\"value\",3\r\n",
+    "AT+BENCH=?\r\n",
+};
+
+/* Lines the parser must reject. */
+static const char *const error_script[] = {
+    "AT+UNKNOWN?\r\n",
+    "AT+CWMODE=\r\n",
+    "AT+GMR?\r\n",
+    "garbage\r\n",
+};
+
+#define SCRIPT(name, lines) {name, lines, sizeof(lines) / sizeof(lines[0])}
+
+static const BENCH_SCRIPT scripts[] = {
+    SCRIPT("dispatch", dispatch_script),
+    SCRIPT("polling", polling_script),
+    SCRIPT("setup", setup_script),
+    SCRIPT("errors", error_script),
+};
+
+static char bench_command(char *value)
+{
+    return AT_OK;
+}
+
+/**
+ * @brief Runs one script and prints its results.
+ */
+static void run_script(const BENCH_SCRIPT *script, unsigned long iterations)
+{
+    unsigned long commands = 0;
+    unsigned long bytes_in = 0;
+    unsigned long bytes_out = 0;
+    unsigned long worst_us = 0;
+    unsigned long total_us = 0;
+
+    unsigned long allocations = shim_heap_allocations();
+
+    for (unsigned long it = 0; it < iterations; it++)
+    {
+        for (size_t i = 0; i < script->count; i++)
+        {
+            const char *line = script->lines[i];
+            size_t len = strlen(line);
+
+            Serial.shim_feed(line, len);
+
+            unsigned long start = micros();
+            process_at_commands();
+            response_flush();
+            unsigned long elapsed = micros() - start;
+
+            total_us += elapsed;
+
+            if (elapsed > worst_us)
+            {
+                worst_us = elapsed;
+            }
+
+            commands++;
+            bytes_in += len;
+            bytes_out += Serial.shim_output().size();
+            Serial.shim_output().clear();
+        }
+    }
+
+    allocations = shim_heap_allocations() - allocations;
+
+    double seconds = total_us / 1e6;
+
+    printf("%-10s %10lu %12.0f %12.0f %12.0f %10lu %10.2f\n",
+           script->name,
+           commands,
+           commands / seconds,
+           bytes_in / seconds,
+           bytes_out / seconds,
+           worst_us,
+           (double)allocations / commands);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : BENCH_ITERATIONS;
+
+    Serial.begin(115200);
+
+    bool registered = register_basic_commands();
+    registered &= register_wifi_commands();
+    registered &= register_tcp_ip_commands();
+    registered &= register_mqtt_commands();
+    registered &= at_register_command("BENCH", (at_callback)bench_command, (at_callback)bench_command, (at_callback)bench_command, (at_callback)bench_command) == AT_OK;
+
+    // The scripts would measure ERROR replies
+    if (!registered)
+    {
+        fprintf(stderr, "Some commands could not be registered (%d registered, AT_COMMANDS_NUM %d).\n",
+                at_registered_commands_count, AT_COMMANDS_NUM);
+        return 1;
+    }
+
+    printf("%-10s %10s %12s %12s %12s %10s %10s\n",
+           "script", "commands", "cmd/s", "in B/s", "out B/s", "worst us", "alloc/cmd");
+
+    for (size_t i = 0; i < sizeof(scripts) / sizeof(scripts[0]); i++)
+    {
+        run_script(&scripts[i], iterations);
+    }
+
+    return 0;
+}
@@ -0,0 +1,441 @@
+#include "at_log.h"
+
+#include <Arduino.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "ring_buffer.h"
+
+/**
+ * Header of a deferred record, followed by the raw arguments.
+ * The format string is identified by its address: format strings are literals.
+ */
+typedef struct _at_log_record
+{
+    uint32_t time_ms;
+    const char *format;
+    uint8_t level;
+    uint8_t size;
+} AT_LOG_RECORD;
+
+// Largest arguments of a record: the remaining conversions are not printed
+#define AT_LOG_MAX_ARGS_SIZE 96
+
+/**
+ * Conversion specification of a format string.
+ */
+typedef struct _at_log_conversion
+{
+    char spec[16];  // %, flags, width, precision, length, conversion
+    char type;      // argument type, see the ARG_* values
+} AT_LOG_CONVERSION;
+
+#define ARG_NONE 0
+#define ARG_INT 'i'
+#define ARG_LONG 'l'
+#define ARG_LONG_LONG 'L'
+#define ARG_SIZE 'z'
+#define ARG_POINTER 'p'
+#define ARG_DOUBLE 'f'
+#define ARG_STRING 's'
+#define ARG_UNSUPPORTED '?'
+
+uint8_t at_log_level = AT_LOG_LEVEL_WARN;
+uint8_t at_log_mode = AT_LOG_MODE_TEXT;
+
+static at_log_writer log_writer = NULL;
+
+static uint8_t log_storage[AT_LOG_BUFFER_SIZE];
+static RING_BUFFER log_buffer = {log_storage, AT_LOG_BUFFER_SIZE, 0, 0};
+static uint16_t log_records = 0;
+static unsigned long log_dropped = 0;
+
+void at_log_set_writer(at_log_writer writer)
+{
+    log_writer = writer;
+}
+
+/**
+ * @brief Parses the conversion starting at format (after the '%').
+ *
+ * @return the first character after the conversion.
+ */
+static const char *parse_conversion(const char *format, AT_LOG_CONVERSION *conversion)
+{
+    size_t len = 1;
+    int longs = 0;
+    bool size = false;
+
+    conversion->spec[0] = '%';
+    conversion->type = ARG_UNSUPPORTED;
+
+    while(*format != '\0' && strchr("-+ #0123456789.hlzjt", *format) != NULL)
+    {
+        longs += *format == 'l';
+        size |= *format == 'z' || *format == 'j' || *format == 't';
+
+        if(len < sizeof(conversion->spec) - 2)
+        {
+            conversion->spec[len++] = *format;
+        }
+
+        format++;
+    }
+
+    if(*format == '\0')
+    {
+        conversion->spec[len] = '\0';
+        return format;
+    }
+
+    conversion->spec[len++] = *format;
+    conversion->spec[len] = '\0';
+
+    switch(*format)
+    {
+    case 'd':
+    case 'i':
+    case 'u':
+    case 'x':
+    case 'X':
+    case 'o':
+    case 'c':
+        conversion->type = size ? ARG_SIZE : longs >= 2 ? ARG_LONG_LONG : longs == 1 ? ARG_LONG : ARG_INT;
+        break;
+    case 'p':
+        conversion->type = ARG_POINTER;
+        break;
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+        conversion->type = ARG_DOUBLE;
+        break;
+    case 's':
+        conversion->type = ARG_STRING;
+        break;
+    case '%':
+        conversion->type = ARG_NONE;
+        break;
+    }
+
+    return format + 1;
+}
+
+static size_t argument_size(char type)
+{
+    switch(type)
+    {
+    case ARG_INT:
+        return sizeof(int);
+    case ARG_LONG:
+        return sizeof(long);
+    case ARG_LONG_LONG:
+        return sizeof(long long);
+    case ARG_SIZE:
+        return sizeof(size_t);
+    case ARG_POINTER:
+        return sizeof(void *);
+    case ARG_DOUBLE:
+        return sizeof(double);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Copies the arguments of the format string: scalars as they are, strings truncated to AT_LOG_MAX_STRING.
+ *
+ * @return the number of bytes used in args.
+ */
+static size_t pack_arguments(const char *format, va_list ap, uint8_t *args)
+{
+    size_t used = 0;
+
+    while((format = strchr(format, '%')) != NULL)
+    {
+        AT_LOG_CONVERSION conversion;
+
+        format = parse_conversion(format + 1, &conversion);
+
+        if(conversion.type == ARG_NONE)
+        {
+            continue;
+        }
+
+        if(conversion.type == ARG_UNSUPPORTED)
+        {
+            break;
+        }
+
+        if(conversion.type == ARG_STRING)
+        {
+            const char *text = va_arg(ap, const char *);
+            size_t len = text != NULL ? strlen(text) : 0;
+
+            if(len > AT_LOG_MAX_STRING)
+            {
+                len = AT_LOG_MAX_STRING;
+            }
+
+            if(used + 1 + len > AT_LOG_MAX_ARGS_SIZE)
+            {
+                break;
+            }
+
+            args[used++] = len;
+            memcpy(args + used, text, len);
+            used += len;
+            continue;
+        }
+
+        size_t size = argument_size(conversion.type);
+
+        if(used + size > AT_LOG_MAX_ARGS_SIZE)
+        {
+            break;
+        }
+
+        switch(conversion.type)
+        {
+        case ARG_INT:
+        {
+            int value = va_arg(ap, int);
+            memcpy(args + used, &value, size);
+            break;
+        }
+        case ARG_LONG:
+        {
+            long value = va_arg(ap, long);
+            memcpy(args + used, &value, size);
+            break;
+        }
+        case ARG_LONG_LONG:
+        {
+            long long value = va_arg(ap, long long);
+            memcpy(args + used, &value, size);
+            break;
+        }
+        case ARG_SIZE:
+        {
+            size_t value = va_arg(ap, size_t);
+            memcpy(args + used, &value, size);
+            break;
+        }
+        case ARG_POINTER:
+        {
+            void *value = va_arg(ap, void *);
+            memcpy(args + used, &value, size);
+            break;
+        }
+        case ARG_DOUBLE:
+        {
+            double value = va_arg(ap, double);
+            memcpy(args + used, &value, size);
+            break;
+        }
+        }
+
+        used += size;
+    }
+
+    return used;
+}
+
+/**
+ * @brief Formats a deferred record: the format string is walked again, each conversion
+ *  taking its argument from args. Conversions without argument are printed as they are.
+ */
+static void format_record(const char *format, const uint8_t *args, size_t size, char *message, size_t room)
+{
+    size_t len = 0;
+    size_t used = 0;
+
+    message[0] = '\0';
+
+    while(*format != '\0' && len + 1 < room)
+    {
+        if(*format != '%')
+        {
+            message[len++] = *format++;
+            message[len] = '\0';
+            continue;
+        }
+
+        AT_LOG_CONVERSION conversion;
+        const char *start = format;
+        int n = 0;
+
+        format = parse_conversion(format + 1, &conversion);
+
+        size_t arg_size = conversion.type == ARG_STRING ? (used < size ? 1 + (size_t)args[used] : 1) : argument_size(conversion.type);
+
+        if(conversion.type == ARG_NONE)
+        {
+            n = snprintf(message + len, room - len, "%%");
+        }
+        else if(conversion.type == ARG_UNSUPPORTED || used + arg_size > size)
+        {
+            // Missing argument: the rest of the format string is printed as it is
+            n = snprintf(message + len, room - len, "%s", start);
+            format = start + strlen(start);
+        }
+        else
+        {
+            const uint8_t *arg = args + used;
+
+            switch(conversion.type)
+            {
+            case ARG_INT:
+            {
+                int value;
+                memcpy(&value, arg, sizeof(value));
+                n = snprintf(message + len, room - len, conversion.spec, value);
+                break;
+            }
+            case ARG_LONG:
+            {
+                long value;
+                memcpy(&value, arg, sizeof(value));
+                n = snprintf(message + len, room - len, conversion.spec, value);
+                break;
+            }
+            case ARG_LONG_LONG:
+            {
+                long long value;
+                memcpy(&value, arg, sizeof(value));
+                n = snprintf(message + len, room - len, conversion.spec, value);
+                break;
+            }
+            case ARG_SIZE:
+            {
+                size_t value;
+                memcpy(&value, arg, sizeof(value));
+                n = snprintf(message + len, room - len, conversion.spec, value);
+                break;
+            }
+            case ARG_POINTER:
+            {
+                void *value;
+                memcpy(&value, arg, sizeof(value));
+                n = snprintf(message + len, room - len, conversion.spec, value);
+                break;
+            }
+            case ARG_DOUBLE:
+            {
+                double value;
+                memcpy(&value, arg, sizeof(value));
+                n = snprintf(message + len, room - len, conversion.spec, value);
+                break;
+            }
+            case ARG_STRING:
+            {
+                char text[AT_LOG_MAX_STRING + 1];
+                memcpy(text, arg + 1, arg[0]);
+                text[arg[0]] = '\0';
+                n = snprintf(message + len, room - len, conversion.spec, text);
+                break;
+            }
+            }
+
+            used += arg_size;
+        }
+
+        if(n > 0)
+        {
+            len += (size_t)n < room - len ? (size_t)n : room - len - 1;
+        }
+    }
+}
+
+/**
+ * @brief Drops the oldest record.
+ */
+static void drop_record()
+{
+    AT_LOG_RECORD record;
+
+    rb_read(&log_buffer, (uint8_t *)&record, sizeof(record));
+    rb_consume(&log_buffer, record.size);
+
+    log_records--;
+    log_dropped++;
+}
+
+static void defer(uint8_t level, const char *format, va_list ap)
+{
+    uint8_t args[AT_LOG_MAX_ARGS_SIZE];
+    AT_LOG_RECORD record = {(uint32_t)millis(), format, level, 0};
+
+    record.size = pack_arguments(format, ap, args);
+
+    while(rb_free(&log_buffer) < sizeof(record) + record.size)
+    {
+        drop_record();
+    }
+
+    rb_write(&log_buffer, (const uint8_t *)&record, sizeof(record));
+    rb_write(&log_buffer, args, record.size);
+    log_records++;
+}
+
+void at_log(uint8_t level, const char *format, ...)
+{
+    va_list ap;
+
+    va_start(ap, format);
+
+    if(at_log_mode == AT_LOG_MODE_DEFERRED)
+    {
+        defer(level, format, ap);
+    }
+    else if(at_log_mode == AT_LOG_MODE_TEXT && log_writer != NULL)
+    {
+        char message[AT_LOG_LINE_SIZE];
+
+        vsnprintf(message, sizeof(message), format, ap);
+        log_writer(level, message);
+    }
+
+    va_end(ap);
+}
+
+bool at_log_next(char *message, size_t size, unsigned long *time_ms, uint8_t *level)
+{
+    AT_LOG_RECORD record;
+    uint8_t args[AT_LOG_MAX_ARGS_SIZE];
+
+    if(log_records == 0)
+    {
+        return false;
+    }
+
+    rb_read(&log_buffer, (uint8_t *)&record, sizeof(record));
+    rb_read(&log_buffer, args, record.size);
+    log_records--;
+
+    format_record(record.format, args, record.size, message, size);
+    *time_ms = record.time_ms;
+    *level = record.level;
+
+    return true;
+}
+
+uint16_t at_log_records()
+{
+    return log_records;
+}
+
+unsigned long at_log_dropped()
+{
+    return log_dropped;
+}
+
+void at_log_clear()
+{
+    rb_clear(&log_buffer);
+    log_records = 0;
+    log_dropped = 0;
+}
@@ -0,0 +1,123 @@
+#ifndef __AT_LOG__
+#define __AT_LOG__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * Diagnostic log of the firmware: LogErr, LogWarn, LogInfo, LogDebug and LogTrace.
+ *
+ * Levels above AT_LOG_LEVEL are removed at compile time: their calls and the
+ * evaluation of their arguments cost nothing. The other levels are checked
+ * against at_log_level at run time, before their arguments are evaluated.
+ *
+ * Two modes are available at run time:
+ *  - text: each message is formatted and handed to the writer (the UART),
+ *  - deferred: the address of the format string and the raw arguments are
+ *    appended to a RAM ring buffer, and only formatted when read with
+ *    at_log_next. The oldest records are dropped when the buffer is full.
+ */
+#define AT_LOG_LEVEL_NONE 0
+#define AT_LOG_LEVEL_ERROR 1
+#define AT_LOG_LEVEL_WARN 2
+#define AT_LOG_LEVEL_INFO 3
+#define AT_LOG_LEVEL_DEBUG 4
+#define AT_LOG_LEVEL_TRACE 5
+
+// Highest level compiled in (build flag -DAT_LOG_LEVEL=<level>)
+#ifndef AT_LOG_LEVEL
+#define AT_LOG_LEVEL AT_LOG_LEVEL_INFO
+#endif
+
+#define AT_LOG_MODE_OFF 0
+#define AT_LOG_MODE_TEXT 1
+#define AT_LOG_MODE_DEFERRED 2
+
+// Storage of the deferred records
+#ifndef AT_LOG_BUFFER_SIZE
+#define AT_LOG_BUFFER_SIZE 2048
+#endif
+
+// Longest formatted message, and longest string argument kept by a deferred record
+#define AT_LOG_LINE_SIZE 128
+#define AT_LOG_MAX_STRING 32
+
+/**
+ * @brief Writes a formatted message (text mode), without line ending.
+ */
+typedef void (*at_log_writer)(uint8_t level, const char *message);
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+extern uint8_t at_log_level;
+extern uint8_t at_log_mode;
+
+void at_log_set_writer(at_log_writer writer);
+
+/**
+ * @brief Logs a message. Use the Log* macros, which filter the level first.
+ */
+void at_log(uint8_t level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Formats the oldest deferred record into message, and removes it.
+ *
+ * @return false if there is no record.
+ */
+bool at_log_next(char *message, size_t size, unsigned long *time_ms, uint8_t *level);
+
+/**
+ * @brief Number of deferred records, and number of records dropped since the last call of at_log_clear.
+ */
+uint16_t at_log_records();
+unsigned long at_log_dropped();
+
+void at_log_clear();
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#define AT_LOG_AT(level, ...)                 \
+    do                                        \
+    {                                         \
+        if(at_log_level >= (level))           \
+        {                                     \
+            at_log((level), __VA_ARGS__);     \
+        }                                     \
+    } while(0)
+
+#if AT_LOG_LEVEL >= AT_LOG_LEVEL_ERROR
+#define LogErr(...) AT_LOG_AT(AT_LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LogErr(...) do {} while(0)
+#endif
+
+#if AT_LOG_LEVEL >= AT_LOG_LEVEL_WARN
+#define LogWarn(...) AT_LOG_AT(AT_LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LogWarn(...) do {} while(0)
+#endif
+
+#if AT_LOG_LEVEL >= AT_LOG_LEVEL_INFO
+#define LogInfo(...) AT_LOG_AT(AT_LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LogInfo(...) do {} while(0)
+#endif
+
+#if AT_LOG_LEVEL >= AT_LOG_LEVEL_DEBUG
+#define LogDebug(...) AT_LOG_AT(AT_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LogDebug(...) do {} while(0)
+#endif
+
+#if AT_LOG_LEVEL >= AT_LOG_LEVEL_TRACE
+#define LogTrace(...) AT_LOG_AT(AT_LOG_LEVEL_TRACE, __VA_ARGS__)
+#else
+#define LogTrace(...) do {} while(0)
+#endif
+
+#endif
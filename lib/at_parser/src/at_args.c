@@ -0,0 +1,144 @@
+#include "at_args.h"
+
+#include <stdbool.h>
+
+/**
+ * @brief Parses a decimal integer, up to the next ',' or the end of the parameters.
+ */
+static uint8_t at_parse_int(const char **read, const AT_ARG_SPEC *spec, long *field)
+{
+    const char *p = *read;
+    bool negative = *p == '-';
+    bool overflow = false;
+    long value = 0;
+
+    if(negative)
+    {
+        p++;
+    }
+
+    if(*p < '0' || *p > '9')
+    {
+        return AT_ARGS_NOT_INTEGER;
+    }
+
+    for(; *p >= '0' && *p <= '9'; p++)
+    {
+        if(value > (LONG_MAX - (*p - '0')) / 10)
+        {
+            overflow = true;
+            continue;
+        }
+
+        value = value * 10 + (*p - '0');
+    }
+
+    if(*p != ',' && *p != 0)
+    {
+        return AT_ARGS_NOT_INTEGER;
+    }
+
+    if(negative)
+    {
+        value = -value;
+    }
+
+    if(overflow || value < spec->min || value > spec->max)
+    {
+        return AT_ARGS_OUT_OF_RANGE;
+    }
+
+    *field = value;
+    *read = p;
+
+    return AT_ARGS_OK;
+}
+
+/**
+ * @brief Parses a quoted string: the \ escapes are resolved, the quotes removed.
+ */
+static uint8_t at_parse_string(const char **read, const AT_ARG_SPEC *spec, char *field)
+{
+    const char *p = *read;
+    size_t len = 0;
+
+    if(*p != '"')
+    {
+        return AT_ARGS_NOT_QUOTED;
+    }
+
+    for(p++; *p != '"'; p++)
+    {
+        if(*p == 0)
+        {
+            return AT_ARGS_UNTERMINATED;
+        }
+
+        if(*p == '\\' && p[1] != 0)
+        {
+            p++;
+        }
+
+        if(len + 1 >= (size_t)spec->max)
+        {
+            return AT_ARGS_TOO_LONG;
+        }
+
+        field[len++] = *p;
+    }
+
+    p++;
+
+    if(*p != ',' && *p != 0)
+    {
+        return AT_ARGS_UNTERMINATED;
+    }
+
+    field[len] = 0;
+    *read = p;
+
+    return AT_ARGS_OK;
+}
+
+uint8_t at_parse_args(const char *value, const AT_ARG_SPEC *schema, uint8_t count, void *args, uint8_t *index)
+{
+    const char *read = value;
+    uint8_t i;
+
+    for(i = 0; i < count; i++)
+    {
+        const AT_ARG_SPEC *spec = &schema[i];
+        void *field = (uint8_t *)args + spec->offset;
+        uint8_t error = AT_ARGS_OK;
+
+        *index = i + 1;
+
+        // Omitted: past the last parameter given, or left empty
+        if(*read == 0 || *read == ',')
+        {
+            error = spec->optional ? AT_ARGS_OK : AT_ARGS_MISSING;
+        }
+        else if(spec->type == AT_ARG_TYPE_INT)
+        {
+            error = at_parse_int(&read, spec, (long *)field);
+        }
+        else
+        {
+            error = at_parse_string(&read, spec, (char *)field);
+        }
+
+        if(error != AT_ARGS_OK)
+        {
+            return error;
+        }
+
+        if(*read == ',' && i < count - 1)
+        {
+            read++;
+        }
+    }
+
+    *index = count + 1;
+
+    return *read == 0 ? AT_ARGS_OK : AT_ARGS_TOO_MANY;
+}
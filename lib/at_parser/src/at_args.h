@@ -0,0 +1,74 @@
+#ifndef AT_ARGS_H
+#define AT_ARGS_H
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Typed parameters of the Set commands.
+ *
+ * A command declares the parameters it takes as a constant schema, each entry
+ * naming a field of the struct handed to its handler:
+ *
+ *   typedef struct { long mode; long port; } SERVER_ARGS;
+ *
+ *   static const AT_ARG_SPEC server_args[] = {
+ *       AT_ARG_INT(SERVER_ARGS, mode, AT_ARG_REQUIRED, 0, 1),
+ *       AT_ARG_INT(SERVER_ARGS, port, AT_ARG_OPTIONAL, 1, 65535),
+ *   };
+ *
+ * at_parse_args checks the parameters in a single pass and fills the struct.
+ * Omitted optional parameters, at the end or left empty (AT+X=1,,3), keep the
+ * value the struct was initialized with.
+ */
+#define AT_ARG_TYPE_INT 1       // decimal integer, stored in a long
+#define AT_ARG_TYPE_STRING 2    // quoted string with \ escapes, stored in a char array
+
+#define AT_ARG_REQUIRED 0
+#define AT_ARG_OPTIONAL 1
+
+typedef struct _at_arg_spec
+{
+    uint8_t type;
+    uint8_t optional;
+    uint16_t offset;    // offset of the field in the struct
+    long min;           // integer range; strings: unused
+    long max;           // integer range; strings: size of the field, terminator included
+} AT_ARG_SPEC;
+
+#define AT_ARG_INT(type, field, optional, min, max) \
+    {AT_ARG_TYPE_INT, optional, offsetof(type, field), min, max}
+
+#define AT_ARG_STRING(type, field, optional) \
+    {AT_ARG_TYPE_STRING, optional, offsetof(type, field), 0, sizeof(((type *)0)->field)}
+
+#define AT_ARG_COUNT(schema) (sizeof(schema) / sizeof((schema)[0]))
+
+/* Errors of at_parse_args */
+#define AT_ARGS_OK 0
+#define AT_ARGS_MISSING 1       // a required parameter is missing or empty
+#define AT_ARGS_TOO_MANY 2      // more parameters than the command takes
+#define AT_ARGS_NOT_INTEGER 3
+#define AT_ARGS_OUT_OF_RANGE 4
+#define AT_ARGS_NOT_QUOTED 5    // a string does not start with a double quote
+#define AT_ARGS_UNTERMINATED 6  // a string does not end with a double quote, or is followed by other characters
+#define AT_ARGS_TOO_LONG 7      // a string does not fit in its field
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/**
+ * Parses the parameters of a Set command into args, as described by the schema.
+ *
+ * @param index receives the position (from 1) of the parameter in error.
+ * @return AT_ARGS_OK, or the error found: args may then be partly filled.
+ */
+uint8_t at_parse_args(const char *value, const AT_ARG_SPEC *schema, uint8_t count, void *args, uint8_t *index);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
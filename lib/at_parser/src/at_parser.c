@@ -1,23 +1,71 @@
 #include "at_parser.h"
 #include <Arduino.h>
-#include "logging.h"
+#include <string.h>
+#include "at_log.h"
 
 AT_COMMAND at_registered_commands[AT_COMMANDS_NUM];
+AT_COMMAND_PROFILE at_command_profiles[AT_COMMANDS_NUM];
+const unsigned long at_profile_bounds_us[AT_PROFILE_BUCKETS - 1] = AT_PROFILE_BOUNDS_US;
 
 unsigned long at_hash(const char *str)
+{
+    return at_hash_n(str, ms_strlen(str));
+}
+
+unsigned long at_hash_n(const char *str, uint16_t len)
 {
     unsigned long hash = 5381;
-    int c;
 
-    while((c = *str++))
-        hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+    while(len--)
+        hash = ((hash << 5) + hash) + *str++; /* hash * 33 + c */
 
     return hash;
 }
 
-void at_register_command(const char *command, at_callback getter, at_callback setter, at_callback test, at_callback execute)
+/*
+ * Commands stay in registration order in at_registered_commands; a separate
+ * index sorted by hash resolves a command name with a binary search. Two
+ * names sharing the same hash are rejected when registered.
+ */
+unsigned char at_registered_commands_count = 0;
+static unsigned char at_sorted_commands[AT_COMMANDS_NUM];
+
+/**
+ * @brief Finds the position of the hash in the sorted index.
+ *
+ * @return the position if found, otherwise -(insertion position) - 1.
+ */
+static int at_find_sorted_position(unsigned long hash)
+{
+    int low = 0;
+    int high = at_registered_commands_count - 1;
+
+    while(low <= high)
+    {
+        int middle = (low + high) / 2;
+        unsigned long current = at_registered_commands[at_sorted_commands[middle]].hash;
+
+        if(current < hash)
+        {
+            low = middle + 1;
+        }
+        else if(current > hash)
+        {
+            high = middle - 1;
+        }
+        else
+        {
+            return middle;
+        }
+    }
+
+    return -low - 1;
+}
+
+char at_register_command(const char *command, at_callback getter, at_callback setter, at_callback test, at_callback execute)
 {
     int i;
+    int position;
     AT_COMMAND new_cmd;
     new_cmd.hash = at_hash(command);
     new_cmd.name = command;
@@ -25,73 +73,116 @@ void at_register_command(const char *command, at_callback getter, at_callback se
     new_cmd.setter = setter;
     new_cmd.execute = execute;
     new_cmd.test = test;
-    
-    for(i = 0; i < AT_COMMANDS_NUM; i++)
+
+    if(at_registered_commands_count >= AT_COMMANDS_NUM)
     {
-        if(at_registered_commands[i].hash == 0)
-        {
-            at_registered_commands[i] = new_cmd;
-            return;
-        }
+        LogErr("Unable to register %s: command table is full", command);
+        return AT_ERROR;
+    }
+
+    position = at_find_sorted_position(new_cmd.hash);
+
+    if(position >= 0)
+    {
+        LogErr("Unable to register %s: hash collides with %s", command, at_registered_commands[at_sorted_commands[position]].name);
+        return AT_ERROR;
     }
+
+    position = -position - 1;
+
+    for(i = at_registered_commands_count; i > position; i--)
+    {
+        at_sorted_commands[i] = at_sorted_commands[i - 1];
+    }
+
+    at_sorted_commands[position] = at_registered_commands_count;
+    at_registered_commands[at_registered_commands_count++] = new_cmd;
+
+    return AT_OK;
 }
 
-char at_execute_command(const char *command, unsigned char *value, unsigned char type)
+static void at_record_profile(int slot, unsigned long duration)
 {
-    int i;
-    
-    char result = AT_ERROR;
-    
-    unsigned long hash = at_hash(command);
+    AT_COMMAND_PROFILE *profile = &at_command_profiles[slot];
+    int bucket = 0;
 
-    for(i = 0; i < AT_COMMANDS_NUM; i++)
+    while(bucket < AT_PROFILE_BUCKETS - 1 && duration >= at_profile_bounds_us[bucket])
     {
-        if(at_registered_commands[i].hash == hash)
-        {            
-            switch(type)
-            {
-                case AT_PARSER_STATE_WRITE:
-                    if(at_registered_commands[i].setter == 0)
-                    {
-                        return AT_ERROR;
-                    }
-
-                    LogInfo("Set %s - %s", at_registered_commands[i].name, value);
-                    result = at_registered_commands[i].setter(value);
-                    break;
-                case AT_PARSER_STATE_READ:
-                    if(at_registered_commands[i].getter == 0)
-                    {
-                        return AT_ERROR;
-                    }
-
-                    LogInfo("Query %s", at_registered_commands[i].name);
-                    result = at_registered_commands[i].getter(value);
-                    break;
-                case AT_PARSER_STATE_TEST:
-                    if(at_registered_commands[i].test == 0)
-                    {
-                        return AT_ERROR;
-                    }
-
-                    LogInfo("Test %s - %s", at_registered_commands[i].name, value);
-                    result = at_registered_commands[i].test(value);
-                    break;
-                case AT_PARSER_STATE_COMMAND:
-                    if(at_registered_commands[i].execute == 0)
-                    {
-                        return AT_ERROR;
-                    }
-
-                    LogInfo("Execute %s", at_registered_commands[i].name);
-                    result = at_registered_commands[i].execute(value);
-                    break;            
-                default:
-                    result = AT_ERROR;
-            }
-        }
+        bucket++;
     }
-    
+
+    profile->histogram[bucket]++;
+    profile->total_us += duration;
+
+    if(profile->calls == 0 || duration < profile->min_us)
+    {
+        profile->min_us = duration;
+    }
+
+    if(duration > profile->max_us)
+    {
+        profile->max_us = duration;
+    }
+
+    profile->calls++;
+}
+
+void at_reset_profiles()
+{
+    memset(at_command_profiles, 0, sizeof(at_command_profiles));
+}
+
+char at_execute_command(const char *command, uint16_t command_len, unsigned char *value, unsigned char type)
+{
+    at_callback callback;
+    unsigned long start;
+    char result;
+    int i = at_find_sorted_position(at_hash_n(command, command_len));
+
+    if(i < 0)
+    {
+        return AT_ERROR;
+    }
+
+    i = at_sorted_commands[i];
+
+    // Another name sharing the hash of a registered command
+    if(strncmp(at_registered_commands[i].name, command, command_len) != 0 || at_registered_commands[i].name[command_len] != 0)
+    {
+        return AT_ERROR;
+    }
+
+    switch(type)
+    {
+        case AT_PARSER_STATE_WRITE:
+            callback = at_registered_commands[i].setter;
+            LogInfo("Set %s - %s", at_registered_commands[i].name, value);
+            break;
+        case AT_PARSER_STATE_READ:
+            callback = at_registered_commands[i].getter;
+            LogInfo("Query %s", at_registered_commands[i].name);
+            break;
+        case AT_PARSER_STATE_TEST:
+            callback = at_registered_commands[i].test;
+            LogInfo("Test %s - %s", at_registered_commands[i].name, value);
+            break;
+        case AT_PARSER_STATE_COMMAND:
+            callback = at_registered_commands[i].execute;
+            LogInfo("Execute %s", at_registered_commands[i].name);
+            break;
+        default:
+            return AT_ERROR;
+    }
+
+    if(callback == 0)
+    {
+        return AT_ERROR;
+    }
+
+    start = micros();
+    result = callback(value);
+    at_record_profile(i, micros() - start);
+
     return result;
 }
 
@@ -104,91 +195,85 @@ char at_execute_command(const char *command, unsigned char *value, unsigned char
  
  */
 
-char at_parse_line(const char *line, unsigned char *ret)
+char at_parse_line(char *line, uint16_t line_len, unsigned char *ret)
+{
+    int16_t start = ms_slice_find(line, line_len, AT_COMMAND_MARKER);
+
+    if(start < 0)
+    {
+        return AT_ERROR;
+    }
+
+    // Skip the marker
+    start += ms_strlen(AT_COMMAND_MARKER);
+
+    return at_parse_command(line + start, line_len - start, ret);
+}
+
+char at_parse_command(char *line, uint16_t line_len, unsigned char *ret)
 {
     uint16_t i;
     
-    char result = AT_ERROR;
-    
     char state = AT_PARSER_STATE_COMMAND;
         
-    int16_t start = ms_str_find(line, AT_COMMAND_MARKER);
-    
-    uint16_t line_len = ms_strlen(line);
+    int16_t start = 0;
     
     int16_t index_write_start = -1;
     
     int16_t index_command_end = line_len - 1;
     
-    const char temp[AT_MAX_TEMP_STRING];
-    
-    if(start >= 0)
+    for(i = start; i < line_len; i++)
     {
-        // Skip the marker
-        start += ms_strlen(AT_COMMAND_MARKER);
-        
-        for(i = start; i < line_len; i++)
+        // Execute 'read' command
+        if(line[i] == '?' && state == AT_PARSER_STATE_COMMAND)
         {
-            // Execute 'read' command
-            if(line[i] == '?' && state == AT_PARSER_STATE_COMMAND)
-            {
-                index_command_end = i - 1;
-                state = AT_PARSER_STATE_READ;
-            }
-            else if(line[i] == '=' && state == AT_PARSER_STATE_COMMAND)
-            {
-                index_command_end = i - 1;
+            index_command_end = i - 1;
+            state = AT_PARSER_STATE_READ;
+        }
+        else if(line[i] == '=' && state == AT_PARSER_STATE_COMMAND)
+        {
+            index_command_end = i - 1;
 
-                if(i < (line_len - 1))
+            if(i < (line_len - 1))
+            {
+                if(line[i + 1] == '?')
                 {
-                    if(line[i + 1] == '?')
-                    {
-                        state = AT_PARSER_STATE_TEST;
-                    }
-                    else
-                    {
-                        index_write_start = i + 1;
-                        state = AT_PARSER_STATE_WRITE;
-                    }
+                    state = AT_PARSER_STATE_TEST;
                 }
                 else
                 {
-                    return AT_ERROR;                
+                    index_write_start = i + 1;
+                    state = AT_PARSER_STATE_WRITE;
                 }
             }
+            else
+            {
+                return AT_ERROR;                
+            }
         }
+    }
+    
+    ret[0] = 0;
+    
+    switch(state)
+    {
+        case AT_PARSER_STATE_COMMAND:
+        case AT_PARSER_STATE_READ:
+        case AT_PARSER_STATE_TEST:
+            return at_execute_command(line + start, index_command_end - start + 1, ret, state);
         
-        ret[0] = 0;
-        
-        switch(state)
+        case AT_PARSER_STATE_WRITE:
         {
-            case AT_PARSER_STATE_COMMAND:
-            case AT_PARSER_STATE_READ:
-            case AT_PARSER_STATE_TEST:
-                ms_array_slice_to_string(line, start, index_command_end, (char *)temp);
-                result = at_execute_command(temp, ret, state);
-                break;
-            
-            case AT_PARSER_STATE_WRITE:
-                ms_array_slice_to_string(line, start, index_command_end, (char *)temp);
-                if(index_write_start <= (line_len - 1))
-                {
-                    ms_array_slice_to_string(line, index_write_start, line_len - 1, (char *)ret);
-                    result = at_execute_command(temp, ret, state);
-                    ret[0] = 0;
-                }
-                else
-                {
-                    result = at_execute_command(temp, ret, state);
-                    ret[0] = 0;
-                }
-                break;
-            
-            default:
-                return AT_ERROR;
+            // The value is handed to the setter in place, terminated in the line buffer
+            char result;
+
+            line[line_len] = 0;
+            result = at_execute_command(line + start, index_command_end - start + 1, (unsigned char *)line + index_write_start, state);
+            ret[0] = 0;
+            return result;
         }
+        
+        default:
+            return AT_ERROR;
     }
-    
-    
-    return result;
-}
\ No newline at end of file
+}
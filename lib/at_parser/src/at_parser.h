@@ -19,9 +19,13 @@ typedef struct _at_command
 
 #define AT_OK 		                0
 #define AT_ERROR 	                1
+/* The handler carries on asynchronously and reports its result later (see complete_at_command) */
+#define AT_PENDING 	                2
 
 #define AT_ERROR_STRING                 "ERROR"
 #define AT_OK_STRING                    "OK"
+/* Answer to a command received while the previous one is still in progress */
+#define AT_BUSY_STRING                  "busy p..."
 
 #define AT_PARSER_STATE_COMMAND 	0
 #define AT_PARSER_STATE_TEST		1
@@ -33,19 +37,57 @@ typedef struct _at_command
 #define AT_COMMAND_MARKER "AT+"
 #endif
 
+/* Size of the command table: 48 commands are registered, with room left for new ones */
 #ifndef AT_COMMANDS_NUM
-#define AT_COMMANDS_NUM 50
+#define AT_COMMANDS_NUM 64
 #endif
 
+/* Latency histogram of the handlers: upper bounds (us, excluded) of the buckets, the last one is unbounded */
+#define AT_PROFILE_BUCKETS 6
+#define AT_PROFILE_BOUNDS_US {100, 500, 1000, 5000, 20000}
+
+/* Execution time of the handlers of a command. Handlers returning AT_PENDING are measured up to their return. */
+typedef struct _at_command_profile
+{
+    unsigned long calls;
+    unsigned long min_us;
+    unsigned long max_us;
+    unsigned long long total_us;
+    unsigned long histogram[AT_PROFILE_BUCKETS];
+} AT_COMMAND_PROFILE;
+
 #ifdef __cplusplus
 extern "C"{
 #endif
 
+/* Registered commands, in registration order. Only the first at_registered_commands_count are used. */
 extern AT_COMMAND at_registered_commands[AT_COMMANDS_NUM];
+extern unsigned char at_registered_commands_count;
+
+/* Profiles of the registered commands, in the same order */
+extern AT_COMMAND_PROFILE at_command_profiles[AT_COMMANDS_NUM];
+extern const unsigned long at_profile_bounds_us[AT_PROFILE_BUCKETS - 1];
+
+void at_reset_profiles();
 
 unsigned long at_hash(const char *str);
-void at_register_command(const char *command, at_callback getter, at_callback setter, at_callback test, at_callback execute);
-char at_parse_line(const char *line, unsigned char *ret);
+unsigned long at_hash_n(const char *str, uint16_t len);
+char at_register_command(const char *command, at_callback getter, at_callback setter, at_callback test, at_callback execute);
+
+/**
+ * Parses and executes the AT command held in line[0..line_len).
+ * The line is parsed in place: the command name is resolved from the slice,
+ * and the value of a Set command is handed to the setter directly from the
+ * line, so line[line_len] must be writable (it receives the terminator).
+ * Query/Test/Execute handlers write their response in ret.
+ */
+char at_parse_line(char *line, uint16_t line_len, unsigned char *ret);
+
+/**
+ * Same as at_parse_line, for a command given without its AT_COMMAND_MARKER
+ * (e.g. "CWMODE?" for AT+CWMODE?).
+ */
+char at_parse_command(char *line, uint16_t line_len, unsigned char *ret);
 
 #ifdef __cplusplus
 } // extern "C"
@@ -57,6 +57,22 @@ int16_t ms_str_find(const char * haystack, const char * needle)
 	return -1;
 }
 
+int16_t ms_slice_find(const char * haystack, uint16_t haystack_len, const char * needle)
+{
+	int i;
+	uint16_t needle_len = ms_strlen(needle);
+	
+	for(i = 0; i + needle_len <= haystack_len; i++)
+	{
+		if(ms_str_equal(haystack + i, needle_len, needle, needle_len))
+		{
+			return i;
+		}
+	}
+	
+	return -1;
+}
+
 void ms_dump_array(char *array, uint16_t max_buffer, uint16_t reverse_pointer)
 {
 	int i;
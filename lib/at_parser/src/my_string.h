@@ -8,6 +8,7 @@ extern "C"{
 #endif
 
 int16_t ms_str_find(const char *haystack, const char * needle);
+int16_t ms_slice_find(const char *haystack, uint16_t haystack_len, const char * needle);
 void ms_array_slice_to_string(const char * array, uint16_t start, uint16_t end, char *ret);
 uint16_t ms_strlen(const char * string);
 
@@ -0,0 +1,300 @@
+#include "config_store.h"
+
+#include <Arduino.h>
+#include <spi_flash.h>
+#include <string.h>
+#include "at_log.h"
+
+#define ALIGN4(len) (((len) + 3) & ~3)
+#define CHUNK_SIZE 32
+#define ERASED_LENGTH 0xFFFF
+
+typedef struct _sector_header
+{
+    uint32_t magic;
+    uint32_t sequence;
+} SECTOR_HEADER;
+
+typedef struct _record_header
+{
+    uint16_t length;
+    uint16_t version;
+    uint32_t crc;       // of the length, the version and the payload
+} RECORD_HEADER;
+
+static uint32_t sector_address(const CONFIG_STORE *store, uint8_t sector)
+{
+    return (store->first_sector + sector) * SPI_FLASH_SEC_SIZE;
+}
+
+static bool flash_read(uint32_t address, void *data, uint32_t size)
+{
+    return spi_flash_read(address, (uint32_t *)data, size) == SPI_FLASH_RESULT_OK;
+}
+
+static bool read_sector_header(const CONFIG_STORE *store, uint8_t sector, uint32_t *sequence)
+{
+    SECTOR_HEADER header;
+
+    if(!flash_read(sector_address(store, sector), &header, sizeof(header)))
+    {
+        return false;
+    }
+
+    *sequence = header.sequence;
+
+    return header.magic == CONFIG_STORE_MAGIC && header.sequence != 0 && header.sequence != 0xFFFFFFFF;
+}
+
+static uint32_t record_crc(const RECORD_HEADER *header, uint32_t address)
+{
+    uint32_t chunk[CHUNK_SIZE / 4];
+    uint32_t crc = crc32_update(0xFFFFFFFF, header, offsetof(RECORD_HEADER, crc));
+
+    for(uint32_t offset = 0; offset < header->length; offset += CHUNK_SIZE)
+    {
+        uint32_t len = header->length - offset < CHUNK_SIZE ? header->length - offset : CHUNK_SIZE;
+
+        if(!flash_read(address + sizeof(RECORD_HEADER) + offset, chunk, ALIGN4(len)))
+        {
+            return ~header->crc;
+        }
+
+        crc = crc32_update(crc, chunk, len);
+    }
+
+    return ~crc;
+}
+
+/**
+ * @brief Walks the records of a sector.
+ *
+ * @return the address of the last valid record, 0 if none. end is set to the offset of the next record,
+ *  or to the sector size if the log is damaged (the sector is not written anymore).
+ */
+static uint32_t scan_sector(const CONFIG_STORE *store, uint8_t sector, uint32_t *end)
+{
+    uint32_t address = sector_address(store, sector);
+    uint32_t offset = sizeof(SECTOR_HEADER);
+    uint32_t last = 0;
+    RECORD_HEADER header;
+
+    while(offset + sizeof(RECORD_HEADER) <= SPI_FLASH_SEC_SIZE)
+    {
+        if(!flash_read(address + offset, &header, sizeof(header)) || header.length == ERASED_LENGTH)
+        {
+            break;
+        }
+
+        if(sizeof(RECORD_HEADER) + ALIGN4(header.length) > SPI_FLASH_SEC_SIZE - offset ||
+           record_crc(&header, address + offset) != header.crc)
+        {
+            offset = SPI_FLASH_SEC_SIZE;
+            break;
+        }
+
+        last = address + offset;
+        offset += sizeof(RECORD_HEADER) + ALIGN4(header.length);
+    }
+
+    *end = offset;
+
+    return last;
+}
+
+void config_store_begin(CONFIG_STORE *store, uint32_t first_sector, uint8_t sectors)
+{
+    uint32_t below = 0xFFFFFFFF;
+
+    store->first_sector = first_sector;
+    store->sectors = sectors;
+    store->active = sectors - 1;
+    store->sequence = 0;
+    store->end = SPI_FLASH_SEC_SIZE;
+    store->record_address = 0;
+
+    // From the newest sector to the oldest, until a valid record is found
+    while(true)
+    {
+        int newest = -1;
+        uint32_t newest_sequence = 0;
+        uint32_t sequence;
+
+        for(uint8_t i = 0; i < sectors; i++)
+        {
+            if(read_sector_header(store, i, &sequence) && sequence < below && sequence > newest_sequence)
+            {
+                newest = i;
+                newest_sequence = sequence;
+            }
+        }
+
+        if(newest < 0)
+        {
+            return;
+        }
+
+        uint32_t end;
+        uint32_t last = scan_sector(store, newest, &end);
+
+        if(store->sequence == 0)
+        {
+            store->active = newest;
+            store->sequence = newest_sequence;
+            store->end = end;
+        }
+
+        if(last != 0)
+        {
+            store->record_address = last;
+            return;
+        }
+
+        below = newest_sequence;
+    }
+}
+
+int config_store_load(CONFIG_STORE *store, void *data, size_t size, uint16_t *version)
+{
+    RECORD_HEADER header;
+    uint32_t chunk[CHUNK_SIZE / 4];
+
+    if(store->record_address == 0 || !flash_read(store->record_address, &header, sizeof(header)))
+    {
+        return -1;
+    }
+
+    uint32_t address = store->record_address + sizeof(RECORD_HEADER);
+    uint32_t len = header.length < size ? header.length : size;
+    uint32_t direct = ((uintptr_t)data & 3) == 0 ? len & ~3 : 0;
+
+    // Aligned part read in place, the rest through a bounce buffer
+    if(direct > 0 && !flash_read(address, data, direct))
+    {
+        return -1;
+    }
+
+    for(uint32_t offset = direct; offset < len; offset += CHUNK_SIZE)
+    {
+        uint32_t n = len - offset < CHUNK_SIZE ? len - offset : CHUNK_SIZE;
+
+        if(!flash_read(address + offset, chunk, ALIGN4(n)))
+        {
+            return -1;
+        }
+
+        memcpy((uint8_t *)data + offset, chunk, n);
+    }
+
+    *version = header.version;
+
+    return header.length;
+}
+
+static bool write_record(uint32_t address, const void *data, uint16_t size, uint16_t version)
+{
+    uint32_t chunk[CHUNK_SIZE / 4];
+    RECORD_HEADER header = {size, version, 0};
+
+    header.crc = ~crc32_update(crc32_update(0xFFFFFFFF, &header, offsetof(RECORD_HEADER, crc)), data, size);
+
+    for(uint32_t offset = 0; offset < size; offset += CHUNK_SIZE)
+    {
+        uint32_t len = size - offset < CHUNK_SIZE ? size - offset : CHUNK_SIZE;
+
+        memset(chunk, 0xFF, sizeof(chunk));
+        memcpy(chunk, (const uint8_t *)data + offset, len);
+
+        if(spi_flash_write(address + sizeof(RECORD_HEADER) + offset, chunk, ALIGN4(len)) != SPI_FLASH_RESULT_OK)
+        {
+            return false;
+        }
+    }
+
+    // The header last: the record only exists once it is complete
+    if(spi_flash_write(address, (uint32_t *)&header, sizeof(header)) != SPI_FLASH_RESULT_OK)
+    {
+        return false;
+    }
+
+    return record_crc(&header, address) == header.crc;
+}
+
+bool config_store_save(CONFIG_STORE *store, const void *data, size_t size, uint16_t version)
+{
+    uint32_t record_size = sizeof(RECORD_HEADER) + ALIGN4(size);
+
+    if(size > CONFIG_STORE_MAX_RECORD || sizeof(SECTOR_HEADER) + record_size > SPI_FLASH_SEC_SIZE)
+    {
+        LogErr("Configuration record too large (%u bytes).", (unsigned)size);
+        return false;
+    }
+
+    // A failed write (power loss or worn out flash) moves the log to the next sector
+    for(uint8_t attempt = 0; attempt < store->sectors; attempt++)
+    {
+        bool new_sector = store->end + record_size > SPI_FLASH_SEC_SIZE;
+
+        if(new_sector)
+        {
+            store->active = (store->active + 1) % store->sectors;
+            store->sequence++;
+            store->end = sizeof(SECTOR_HEADER);
+
+            if(spi_flash_erase_sector(store->first_sector + store->active) != SPI_FLASH_RESULT_OK)
+            {
+                store->end = SPI_FLASH_SEC_SIZE;
+                continue;
+            }
+        }
+
+        uint32_t address = sector_address(store, store->active) + store->end;
+
+        if(!write_record(address, data, size, version))
+        {
+            store->end = SPI_FLASH_SEC_SIZE;
+            continue;
+        }
+
+        if(new_sector)
+        {
+            SECTOR_HEADER header = {CONFIG_STORE_MAGIC, store->sequence};
+
+            if(spi_flash_write(sector_address(store, store->active), (uint32_t *)&header, sizeof(header)) != SPI_FLASH_RESULT_OK)
+            {
+                store->end = SPI_FLASH_SEC_SIZE;
+                continue;
+            }
+        }
+
+        store->record_address = address;
+        store->end += record_size;
+
+        return true;
+    }
+
+    LogErr("Failed to write the configuration.");
+    return false;
+}
+
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+
+    while(len--)
+    {
+        crc ^= *bytes++;
+
+        for(int i = 0; i < 8; i++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+
+    return crc;
+}
+
+uint32_t crc32(const void *data, size_t len)
+{
+    return ~crc32_update(0xFFFFFFFF, data, len);
+}
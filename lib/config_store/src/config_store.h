@@ -0,0 +1,64 @@
+#ifndef __CONFIG_STORE__
+#define __CONFIG_STORE__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * Configuration record log over a set of flash sectors.
+ *
+ * Each save appends a full record (version, length, CRC, payload) after the
+ * previous ones: the last valid record is the configuration. When a sector
+ * is full, the log moves on to the next one (round robin), so every sector
+ * is erased once per lap instead of once per save.
+ *
+ * A record is written before its header, and a sector header after its
+ * first record: a save interrupted by a power loss leaves the previous
+ * record in place.
+ */
+#define CONFIG_STORE_MAGIC 0x43464753
+
+#ifndef CONFIG_STORE_MAX_RECORD
+#define CONFIG_STORE_MAX_RECORD 1024
+#endif
+
+typedef struct _config_store
+{
+    uint32_t first_sector;
+    uint8_t sectors;
+    uint8_t active;          // sector the records are appended to
+    uint32_t sequence;       // sequence of the active sector, 0 if the store is empty
+    uint32_t end;            // offset of the next record in the active sector
+    uint32_t record_address; // address of the last valid record, 0 if none
+} CONFIG_STORE;
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/**
+ * @brief Finds the last record of the store.
+ */
+void config_store_begin(CONFIG_STORE *store, uint32_t first_sector, uint8_t sectors);
+
+/**
+ * @brief Reads the last record: up to size bytes are copied into data.
+ *
+ * @return the length of the record, or -1 if the store is empty.
+ */
+int config_store_load(CONFIG_STORE *store, void *data, size_t size, uint16_t *version);
+
+/**
+ * @brief Appends a record.
+ */
+bool config_store_save(CONFIG_STORE *store, const void *data, size_t size, uint16_t version);
+
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len);
+uint32_t crc32(const void *data, size_t len);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
@@ -0,0 +1,26 @@
+#include "counters.h"
+
+#include <string.h>
+
+uint32_t counters[COUNTER_COUNT];
+LINK_COUNTERS link_counters[COUNTERS_LINKS];
+
+const char *const counter_names[COUNTER_COUNT] = {
+    "at_commands",
+    "at_errors",
+    "at_rx_bytes",
+    "at_lines_dropped",
+    "uart_overruns",
+    "uart_tx_bytes",
+    "uart_tx_stalls",
+    "links_accepted",
+    "links_refused",
+    "rx_dropped_bytes",
+    "rx_buffer_full",
+};
+
+void counters_reset()
+{
+    memset(counters, 0, sizeof(counters));
+    memset(link_counters, 0, sizeof(link_counters));
+}
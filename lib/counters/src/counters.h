@@ -0,0 +1,57 @@
+#ifndef __COUNTERS__
+#define __COUNTERS__
+
+#include <stdint.h>
+
+/**
+ * Runtime counters, incremented from the hot paths (AT+SYSSTAT).
+ * The table has a fixed size and the updates are plain 32-bit stores: they cost
+ * a few cycles and never allocate. Everything runs in the main loop, so no lock
+ * is needed.
+ */
+#define COUNTER_AT_COMMANDS 0
+#define COUNTER_AT_ERRORS 1
+#define COUNTER_AT_RX_BYTES 2           // bytes read from the UART by the AT command processor
+#define COUNTER_AT_LINES_DROPPED 3      // lines longer than the line buffer
+#define COUNTER_UART_OVERRUNS 4
+#define COUNTER_UART_TX_BYTES 5
+#define COUNTER_UART_TX_STALLS 6        // writes that waited for the UART, the response buffer being full
+#define COUNTER_LINKS_ACCEPTED 7
+#define COUNTER_LINKS_REFUSED 8         // connections closed because all the links and the accept queue were used
+#define COUNTER_RX_DROPPED_BYTES 9      // datagrams dropped, the link buffer being full
+#define COUNTER_RX_BUFFER_FULL 10       // times a link buffer was full while data was waiting in the TCP stack
+#define COUNTER_COUNT 11
+
+// Per link counters
+#ifndef COUNTERS_LINKS
+#define COUNTERS_LINKS 16
+#endif
+
+typedef struct _link_counters
+{
+    uint32_t rx_bytes;
+    uint32_t tx_bytes;
+    uint32_t dropped_bytes;
+    uint32_t buffer_full;
+} LINK_COUNTERS;
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+extern uint32_t counters[COUNTER_COUNT];
+extern const char *const counter_names[COUNTER_COUNT];
+extern LINK_COUNTERS link_counters[COUNTERS_LINKS];
+
+static inline void counter_add(uint8_t id, uint32_t n)
+{
+    counters[id] += n;
+}
+
+void counters_reset();
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
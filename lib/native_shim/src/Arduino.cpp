@@ -0,0 +1,475 @@
+#include "Arduino.h"
+#include "spi_flash.h"
+
+#include <chrono>
+#include <thread>
+#include <new>
+#include <ctype.h>
+
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+HardwareSerial Serial;
+EspClass ESP;
+
+static unsigned long shim_allocations = 0;
+static unsigned long shim_time_offset_us = 0;
+
+/* Allocations made by the shim itself (UART capture) are not accounted. */
+static int shim_untracked = 0;
+
+void *operator new(size_t size)
+{
+    if (!shim_untracked)
+    {
+        shim_allocations++;
+    }
+
+    void *ptr = malloc(size ? size : 1);
+
+    if (!ptr)
+    {
+        throw std::bad_alloc();
+    }
+
+    return ptr;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+unsigned long shim_heap_allocations(void)
+{
+    return shim_allocations;
+}
+
+static unsigned long elapsed_us()
+{
+    static const auto start = std::chrono::steady_clock::now();
+
+    return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() + shim_time_offset_us;
+}
+
+unsigned long millis(void)
+{
+    return elapsed_us() / 1000;
+}
+
+unsigned long micros(void)
+{
+    return elapsed_us();
+}
+
+void delay(unsigned long ms)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void yield(void)
+{
+}
+
+void shim_advance_time(unsigned long ms)
+{
+    shim_time_offset_us += ms * 1000;
+}
+
+/*
+ * String
+ */
+
+String::String(const char *str) : _buffer(nullptr), _len(0), _capacity(0)
+{
+    assign(str, strlen(str));
+}
+
+String::String(const String &other) : _buffer(nullptr), _len(0), _capacity(0)
+{
+    assign(other._buffer, other._len);
+}
+
+String::String(char c) : _buffer(nullptr), _len(0), _capacity(0)
+{
+    assign(&c, 1);
+}
+
+String::String(int value, unsigned char base) : String((long)value, base)
+{
+}
+
+String::String(unsigned int value, unsigned char base) : String((unsigned long)value, base)
+{
+}
+
+String::String(long value, unsigned char base) : _buffer(nullptr), _len(0), _capacity(0)
+{
+    char temp[24];
+    snprintf(temp, sizeof(temp), base == HEX ? "%lx" : "%ld", value);
+    assign(temp, strlen(temp));
+}
+
+String::String(unsigned long value, unsigned char base) : _buffer(nullptr), _len(0), _capacity(0)
+{
+    char temp[24];
+    snprintf(temp, sizeof(temp), base == HEX ? "%lx" : "%lu", value);
+    assign(temp, strlen(temp));
+}
+
+String::~String()
+{
+    delete[] _buffer;
+}
+
+void String::reserve(unsigned int capacity)
+{
+    if (_buffer && capacity <= _capacity)
+    {
+        return;
+    }
+
+    char *buffer = new char[capacity + 1];
+
+    if (_buffer)
+    {
+        memcpy(buffer, _buffer, _len + 1);
+        delete[] _buffer;
+    }
+    else
+    {
+        buffer[0] = 0;
+    }
+
+    _buffer = buffer;
+    _capacity = capacity;
+}
+
+void String::assign(const char *str, unsigned int len)
+{
+    reserve(len);
+    memmove(_buffer, str, len);
+    _buffer[len] = 0;
+    _len = len;
+}
+
+String &String::operator=(const String &other)
+{
+    if (this != &other)
+    {
+        assign(other._buffer, other._len);
+    }
+
+    return *this;
+}
+
+String &String::operator=(const char *str)
+{
+    assign(str, strlen(str));
+    return *this;
+}
+
+String &String::operator+=(const String &other)
+{
+    reserve(_len + other._len);
+    memcpy(_buffer + _len, other._buffer, other._len + 1);
+    _len += other._len;
+    return *this;
+}
+
+String &String::operator+=(const char *str)
+{
+    return *this += String(str);
+}
+
+String &String::operator+=(char c)
+{
+    reserve(_len + 1);
+    _buffer[_len++] = c;
+    _buffer[_len] = 0;
+    return *this;
+}
+
+bool String::operator==(const String &other) const
+{
+    return _len == other._len && memcmp(_buffer, other._buffer, _len) == 0;
+}
+
+bool String::operator==(const char *str) const
+{
+    return strcmp(_buffer, str) == 0;
+}
+
+bool String::startsWith(const char *prefix) const
+{
+    return strncmp(_buffer, prefix, strlen(prefix)) == 0;
+}
+
+void String::trim()
+{
+    unsigned int start = 0;
+    unsigned int end = _len;
+
+    while (start < end && isspace((unsigned char)_buffer[start]))
+    {
+        start++;
+    }
+
+    while (end > start && isspace((unsigned char)_buffer[end - 1]))
+    {
+        end--;
+    }
+
+    memmove(_buffer, _buffer + start, end - start);
+    _len = end - start;
+    _buffer[_len] = 0;
+}
+
+String operator+(const String &lhs, const String &rhs)
+{
+    String result(lhs);
+    result += rhs;
+    return result;
+}
+
+String operator+(const String &lhs, const char *rhs)
+{
+    String result(lhs);
+    result += rhs;
+    return result;
+}
+
+String operator+(const char *lhs, const String &rhs)
+{
+    String result(lhs);
+    result += rhs;
+    return result;
+}
+
+/*
+ * Print
+ */
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+    size_t n = 0;
+
+    while (size--)
+    {
+        n += write(*buffer++);
+    }
+
+    return n;
+}
+
+size_t Print::print(int value, int base)
+{
+    return print((long)value, base);
+}
+
+size_t Print::print(unsigned int value, int base)
+{
+    return print((unsigned long)value, base);
+}
+
+size_t Print::print(long value, int base)
+{
+    char temp[24];
+    snprintf(temp, sizeof(temp), base == HEX ? "%lX" : "%ld", value);
+    return write(temp);
+}
+
+size_t Print::print(unsigned long value, int base)
+{
+    char temp[24];
+    snprintf(temp, sizeof(temp), base == HEX ? "%lX" : "%lu", value);
+    return write(temp);
+}
+
+size_t Print::print(double value, int digits)
+{
+    char temp[48];
+    snprintf(temp, sizeof(temp), "%.*f", digits, value);
+    return write(temp);
+}
+
+size_t Print::printf(const char *format, ...)
+{
+    char temp[256];
+    va_list args;
+
+    va_start(args, format);
+    int len = vsnprintf(temp, sizeof(temp), format, args);
+    va_end(args);
+
+    if (len < 0)
+    {
+        return 0;
+    }
+
+    return write(temp, (size_t)len < sizeof(temp) ? (size_t)len : sizeof(temp) - 1);
+}
+
+/*
+ * HardwareSerial
+ */
+
+int HardwareSerial::available()
+{
+    return (int)(_rx_head - _rx_tail);
+}
+
+int HardwareSerial::peek()
+{
+    return available() ? _rx[_rx_tail % sizeof(_rx)] : -1;
+}
+
+int HardwareSerial::read()
+{
+    if (!available())
+    {
+        return -1;
+    }
+
+    return _rx[_rx_tail++ % sizeof(_rx)];
+}
+
+size_t HardwareSerial::read(char *buffer, size_t size)
+{
+    size_t n = 0;
+
+    while (n < size && available())
+    {
+        buffer[n++] = (char)_rx[_rx_tail++ % sizeof(_rx)];
+    }
+
+    return n;
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+    return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+    shim_untracked++;
+    _tx.append((const char *)buffer, size);
+    shim_untracked--;
+
+    return size;
+}
+
+size_t HardwareSerial::shim_feed(const char *data, size_t size)
+{
+    size_t n = 0;
+
+    while (n < size && (_rx_head - _rx_tail) < sizeof(_rx))
+    {
+        _rx[_rx_head++ % sizeof(_rx)] = (uint8_t)data[n++];
+    }
+
+    _overrun |= n < size;
+
+    return n;
+}
+
+bool EspClass::rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size)
+{
+    if (offset * 4 + size > sizeof(_rtcUserMemory))
+    {
+        return false;
+    }
+
+    memcpy(data, _rtcUserMemory + offset, size);
+    return true;
+}
+
+bool EspClass::rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size)
+{
+    if (offset * 4 + size > sizeof(_rtcUserMemory))
+    {
+        return false;
+    }
+
+    memcpy(_rtcUserMemory + offset, data, size);
+    return true;
+}
+
+static uint8_t shim_flash[SHIM_FLASH_SECTORS * SPI_FLASH_SEC_SIZE];
+static bool shim_flash_erased = false;
+
+static void shim_flash_init()
+{
+    if (!shim_flash_erased)
+    {
+        memset(shim_flash, 0xFF, sizeof(shim_flash));
+        shim_flash_erased = true;
+    }
+}
+
+SpiFlashOpResult spi_flash_erase_sector(uint16_t sec)
+{
+    shim_flash_init();
+
+    if (sec >= SHIM_FLASH_SECTORS)
+    {
+        return SPI_FLASH_RESULT_ERR;
+    }
+
+    memset(shim_flash + sec * SPI_FLASH_SEC_SIZE, 0xFF, SPI_FLASH_SEC_SIZE);
+
+    return SPI_FLASH_RESULT_OK;
+}
+
+SpiFlashOpResult spi_flash_write(uint32_t des_addr, uint32_t *src_addr, uint32_t size)
+{
+    shim_flash_init();
+
+    if ((des_addr & 3) || (size & 3) || des_addr + size > sizeof(shim_flash))
+    {
+        return SPI_FLASH_RESULT_ERR;
+    }
+
+    const uint8_t *src = (const uint8_t *)src_addr;
+
+    for (uint32_t i = 0; i < size; i++)
+    {
+        shim_flash[des_addr + i] &= src[i];
+    }
+
+    return SPI_FLASH_RESULT_OK;
+}
+
+SpiFlashOpResult spi_flash_read(uint32_t src_addr, uint32_t *des_addr, uint32_t size)
+{
+    shim_flash_init();
+
+    if ((src_addr & 3) || src_addr + size > sizeof(shim_flash))
+    {
+        return SPI_FLASH_RESULT_ERR;
+    }
+
+    memcpy(des_addr, shim_flash + src_addr, size);
+
+    return SPI_FLASH_RESULT_OK;
+}
@@ -0,0 +1,210 @@
+#ifndef __NATIVE_SHIM_ARDUINO__
+#define __NATIVE_SHIM_ARDUINO__
+
+/**
+ * Host (native) replacement for the subset of the Arduino / ESP8266 core
+ * used by the firmware. It is only compiled in the `native` environment.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <ctype.h>
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void yield(void);
+
+/**
+ * @brief Advances the shim clock without sleeping.
+ *      Used by the host benchmarks to simulate elapsed time.
+ */
+void shim_advance_time(unsigned long ms);
+
+/**
+ * @brief Number of heap allocations done since the start of the program.
+ */
+unsigned long shim_heap_allocations(void);
+
+enum rst_reason
+{
+    REASON_DEFAULT_RST = 0,
+    REASON_WDT_RST = 1,
+    REASON_EXCEPTION_RST = 2,
+    REASON_SOFT_WDT_RST = 3,
+    REASON_SOFT_RESTART = 4,
+    REASON_DEEP_SLEEP_AWAKE = 5,
+    REASON_EXT_SYS_RST = 6
+};
+
+struct rst_info
+{
+    uint32_t reason;
+    uint32_t exccause;
+    uint32_t epc1;
+    uint32_t epc2;
+    uint32_t epc3;
+    uint32_t excvaddr;
+    uint32_t depc;
+};
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#ifdef __cplusplus
+
+#include <string>
+
+#define DEC 10
+#define HEX 16
+
+class String
+{
+public:
+    String(const char *str = "");
+    String(const String &other);
+    explicit String(char c);
+    explicit String(int value, unsigned char base = DEC);
+    explicit String(unsigned int value, unsigned char base = DEC);
+    explicit String(long value, unsigned char base = DEC);
+    explicit String(unsigned long value, unsigned char base = DEC);
+    ~String();
+
+    String &operator=(const String &other);
+    String &operator=(const char *str);
+    String &operator+=(const String &other);
+    String &operator+=(const char *str);
+    String &operator+=(char c);
+
+    bool operator==(const String &other) const;
+    bool operator==(const char *str) const;
+    bool operator!=(const char *str) const { return !(*this == str); }
+    char operator[](unsigned int index) const { return index < _len ? _buffer[index] : 0; }
+
+    const char *c_str() const { return _buffer; }
+    unsigned int length() const { return _len; }
+    bool startsWith(const char *prefix) const;
+    void trim();
+
+    friend String operator+(const String &lhs, const String &rhs);
+    friend String operator+(const String &lhs, const char *rhs);
+    friend String operator+(const char *lhs, const String &rhs);
+
+private:
+    void assign(const char *str, unsigned int len);
+    void reserve(unsigned int capacity);
+
+    char *_buffer;
+    unsigned int _len;
+    unsigned int _capacity;
+};
+
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+    size_t write(const char *str) { return write((const uint8_t *)str, strlen(str)); }
+
+    size_t print(const char *str) { return write(str); }
+    size_t print(const String &str) { return write(str.c_str(), str.length()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int value, int base = DEC);
+    size_t print(unsigned int value, int base = DEC);
+    size_t print(long value, int base = DEC);
+    size_t print(unsigned long value, int base = DEC);
+    size_t print(double value, int digits = 2);
+
+    size_t println() { return write("\r\n"); }
+    template <typename T>
+    size_t println(const T &value) { return print(value) + println(); }
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class HardwareSerial : public Print
+{
+public:
+    void begin(unsigned long baud) { _baud = baud; }
+    void updateBaudRate(unsigned long baud) { _baud = baud; }
+    unsigned long baudRate() const { return _baud; }
+    size_t setRxBufferSize(size_t size) { return size; }
+
+    int available();
+    int read();
+    size_t read(char *buffer, size_t size);
+    int peek();
+    int availableForWrite() { return 128; }
+    void flush() {}
+
+    // Set when received bytes were lost, the RX FIFO being full. Cleared by the call.
+    bool hasOverrun()
+    {
+        bool overrun = _overrun;
+        _overrun = false;
+        return overrun;
+    }
+
+    using Print::write;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+
+    /**
+     * @brief Pushes bytes in the RX FIFO as if they were received on the UART.
+     * @return the number of bytes accepted (the FIFO is bounded).
+     */
+    size_t shim_feed(const char *data, size_t size);
+
+    /**
+     * @brief Returns (and optionally clears) everything written to the UART.
+     */
+    std::string &shim_output() { return _tx; }
+
+private:
+    unsigned long _baud = 0;
+    uint8_t _rx[16384];
+    size_t _rx_head = 0;
+    size_t _rx_tail = 0;
+    bool _overrun = false;
+    std::string _tx;
+};
+
+extern HardwareSerial Serial;
+
+class EspClass
+{
+public:
+    void restart() {}
+    uint32_t getFreeHeap() { return 40000; }
+    uint32_t getMaxFreeBlockSize() { return 32000; }
+    uint8_t getHeapFragmentation() { return 20; }
+
+    void deepSleep(uint64_t time_us) {}
+    uint64_t deepSleepMax() { return 12000000000ULL; }
+    struct rst_info *getResetInfoPtr() { return &_resetInfo; }
+
+    // RTC user memory: 512 bytes, addressed in 4-byte blocks
+    bool rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size);
+    bool rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size);
+
+private:
+    uint32_t _rtcUserMemory[128] = {};
+    struct rst_info _resetInfo = {};
+};
+
+extern EspClass ESP;
+
+#endif // __cplusplus
+
+#endif
@@ -0,0 +1,380 @@
+#include "ESP8266WiFi.h"
+#include "WiFiUdp.h"
+#include "WiFiClientSecureBearSSL.h"
+
+ESP8266WiFiClass WiFi;
+
+static enum dhcp_status station_dhcp = DHCP_STARTED;
+static enum dhcp_status softap_dhcp = DHCP_STARTED;
+
+/*
+ * IPAddress
+ */
+
+bool IPAddress::fromString(const char *address)
+{
+    unsigned int a, b, c, d;
+
+    if (sscanf(address, "%u.%u.%u.%u", &a, &b, &c, &d) != 4 || a > 255 || b > 255 || c > 255 || d > 255)
+    {
+        return false;
+    }
+
+    *this = IPAddress(a, b, c, d);
+    return true;
+}
+
+String IPAddress::toString() const
+{
+    char temp[16];
+    snprintf(temp, sizeof(temp), "%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+    return String(temp);
+}
+
+/*
+ * SDK functions
+ */
+
+struct station_info *wifi_softap_get_station_info(void)
+{
+    return NULL;
+}
+
+enum dhcp_status wifi_station_dhcpc_status(void)
+{
+    return station_dhcp;
+}
+
+enum dhcp_status wifi_softap_dhcps_status(void)
+{
+    return softap_dhcp;
+}
+
+bool wifi_station_dhcpc_start(void)
+{
+    station_dhcp = DHCP_STARTED;
+    return true;
+}
+
+bool wifi_station_dhcpc_stop(void)
+{
+    station_dhcp = DHCP_STOPPED;
+    return true;
+}
+
+bool wifi_softap_dhcps_start(void)
+{
+    softap_dhcp = DHCP_STARTED;
+    return true;
+}
+
+bool wifi_softap_dhcps_stop(void)
+{
+    softap_dhcp = DHCP_STOPPED;
+    return true;
+}
+
+/*
+ * WiFiClient
+ */
+
+int WiFiClient::read()
+{
+    if (!available())
+    {
+        return -1;
+    }
+
+    uint8_t c = _connection->rx.front();
+    _connection->rx.pop_front();
+    return c;
+}
+
+int WiFiClient::read(uint8_t *buffer, size_t size)
+{
+    size_t n = 0;
+
+    while (n < size && available())
+    {
+        buffer[n++] = _connection->rx.front();
+        _connection->rx.pop_front();
+    }
+
+    return (int)n;
+}
+
+size_t WiFiClient::write(const uint8_t *buffer, size_t size)
+{
+    if (!_connection || !_connection->connected)
+    {
+        return 0;
+    }
+
+    _connection->tx.append((const char *)buffer, size);
+    return size;
+}
+
+void WiFiClient::stop()
+{
+    if (_connection)
+    {
+        _connection->connected = false;
+        _connection->rx.clear();
+    }
+}
+
+int WiFiClient::connect(IPAddress ip, uint16_t port)
+{
+    shim_advance_time(SHIM_CONNECT_DURATION_MS);
+
+    // Connections to x.x.x.1 are refused
+    if (ip[3] == 1)
+    {
+        _connection = nullptr;
+        return 0;
+    }
+
+    WiFiClient::connect("", port);
+    _connection->remoteIP = ip;
+
+    return 1;
+}
+
+int WiFiClient::connect(const char *host, uint16_t port)
+{
+    _connection = std::make_shared<ShimConnection>();
+    _connection->remotePort = port;
+    _connection->localPort = 49152;
+
+    return 1;
+}
+
+/*
+ * WiFiServer
+ */
+
+WiFiClient WiFiServer::available()
+{
+    if (_pending.empty())
+    {
+        return WiFiClient();
+    }
+
+    WiFiClient client = _pending.front();
+    _pending.pop_front();
+    return client;
+}
+
+/*
+ * ESP8266WiFiClass
+ */
+
+wl_status_t ESP8266WiFiClass::begin(const char *ssid, const char *passphrase, int32_t channel, const uint8_t *bssid, bool connect)
+{
+    _ssid = ssid;
+    _psk = passphrase ? passphrase : "";
+    _status = WL_DISCONNECTED;
+    _joining = true;
+    _joinStarted = millis();
+
+    // Without channel and BSSID, the join starts with a scan
+    _joinDuration = channel != 0 && bssid != NULL ? SHIM_FAST_JOIN_DURATION_MS : SHIM_JOIN_DURATION_MS;
+    _joinFails = (channel != 0 && channel != _apChannel) || (bssid != NULL && memcmp(bssid, _apBssid, 6) != 0);
+
+    return _status;
+}
+
+wl_status_t ESP8266WiFiClass::begin()
+{
+    _status = _ssid.empty() ? WL_NO_SSID_AVAIL : WL_DISCONNECTED;
+    _joining = !_ssid.empty();
+    _joinStarted = millis();
+    _joinDuration = SHIM_JOIN_DURATION_MS;
+    _joinFails = false;
+    return _status;
+}
+
+bool ESP8266WiFiClass::disconnect(bool wifioff)
+{
+    _joining = false;
+    _status = WL_DISCONNECTED;
+    return true;
+}
+
+wl_status_t ESP8266WiFiClass::status()
+{
+    if (_joining && millis() - _joinStarted >= _joinDuration)
+    {
+        _joining = false;
+        _status = _joinFails ? WL_NO_SSID_AVAIL : WL_CONNECTED;
+    }
+
+    return _status;
+}
+
+int8_t ESP8266WiFiClass::scanNetworks(bool async)
+{
+    _scanning = true;
+    _scanStarted = millis();
+
+    if (!async)
+    {
+        shim_advance_time(SHIM_SCAN_DURATION_MS);
+    }
+
+    return async ? WIFI_SCAN_RUNNING : scanComplete();
+}
+
+int8_t ESP8266WiFiClass::scanComplete()
+{
+    if (!_scanning)
+    {
+        return WIFI_SCAN_FAILED;
+    }
+
+    return millis() - _scanStarted < SHIM_SCAN_DURATION_MS ? WIFI_SCAN_RUNNING : 2;
+}
+
+bool ESP8266WiFiClass::softAP(const char *ssid, const char *passphrase, int channel, int ssid_hidden, int max_connection)
+{
+    _apSsid = ssid;
+    _apPsk = passphrase ? passphrase : "";
+    return true;
+}
+
+int ESP8266WiFiClass::hostByName(const char *hostname, IPAddress &result)
+{
+    size_t len = strlen(hostname);
+
+    if (result.fromString(hostname))
+    {
+        return 1;
+    }
+
+    if (len >= 8 && strcmp(hostname + len - 8, ".invalid") == 0)
+    {
+        return 0;
+    }
+
+    result = IPAddress(93, 184, 216, 34);
+    return 1;
+}
+
+/*
+ * WiFiUDP
+ */
+
+uint8_t WiFiUDP::begin(uint16_t port)
+{
+    static uint16_t ephemeralPort = 49152;
+
+    _socket = std::make_shared<ShimUdpSocket>();
+    _socket->localPort = port != 0 ? port : ephemeralPort++;
+
+    return 1;
+}
+
+int WiFiUDP::beginPacket(IPAddress ip, uint16_t port)
+{
+    _outgoing = ShimDatagram{"", ip, port};
+    return _socket != nullptr;
+}
+
+size_t WiFiUDP::write(const uint8_t *buffer, size_t size)
+{
+    _outgoing.data.append((const char *)buffer, size);
+    return size;
+}
+
+int WiFiUDP::endPacket()
+{
+    if (!_socket)
+    {
+        return 0;
+    }
+
+    _socket->tx.push_back(_outgoing);
+    return 1;
+}
+
+int WiFiUDP::parsePacket()
+{
+    _packet = ShimDatagram{"", IPAddress(), 0};
+    _read = 0;
+
+    if (!_socket || _socket->rx.empty())
+    {
+        return 0;
+    }
+
+    _packet = _socket->rx.front();
+    _socket->rx.pop_front();
+
+    return (int)_packet.data.size();
+}
+
+int WiFiUDP::read(uint8_t *buffer, size_t size)
+{
+    size_t n = available() < (int)size ? available() : size;
+
+    memcpy(buffer, _packet.data.data() + _read, n);
+    _read += n;
+
+    return (int)n;
+}
+
+/*
+ * BearSSL::WiFiClientSecure
+ */
+
+// A full handshake takes seconds on the ESP8266, a resumed one a fraction of it
+#define SHIM_FULL_HANDSHAKE_MS 2000
+#define SHIM_RESUMED_HANDSHAKE_MS 100
+
+int BearSSL::WiFiClientSecure::shim_full_handshakes = 0;
+int BearSSL::WiFiClientSecure::shim_resumed_handshakes = 0;
+int BearSSL::WiFiClientSecure::shim_probes = 0;
+bool BearSSL::WiFiClientSecure::shim_mfln_supported = true;
+bool BearSSL::WiFiClientSecure::shim_fingerprint_mismatch = false;
+
+int BearSSL::WiFiClientSecure::connect(const char *host, uint16_t port)
+{
+    IPAddress ip;
+
+    if (!WiFi.hostByName(host, ip) || !WiFiClient::connect(ip, port))
+    {
+        return 0;
+    }
+
+    if (_fingerprint && shim_fingerprint_mismatch)
+    {
+        WiFiClient::stop();
+        return 0;
+    }
+
+    if (_session != nullptr && _session->shim_valid)
+    {
+        shim_advance_time(SHIM_RESUMED_HANDSHAKE_MS);
+        shim_resumed_handshakes++;
+    }
+    else
+    {
+        shim_advance_time(SHIM_FULL_HANDSHAKE_MS);
+        shim_full_handshakes++;
+    }
+
+    if (_session != nullptr)
+    {
+        _session->shim_valid = true;
+    }
+
+    return 1;
+}
+
+bool BearSSL::WiFiClientSecure::probeMaxFragmentLength(const char *hostname, uint16_t port, uint16_t len)
+{
+    shim_advance_time(SHIM_CONNECT_DURATION_MS);
+    shim_probes++;
+
+    return shim_mfln_supported;
+}
@@ -0,0 +1,215 @@
+#ifndef __NATIVE_SHIM_ESP8266WIFI__
+#define __NATIVE_SHIM_ESP8266WIFI__
+
+#include <Arduino.h>
+#include <memory>
+#include <deque>
+
+#include "ESP8266WiFiType.h"
+
+struct ip_addr
+{
+    uint32_t addr;
+};
+
+class IPAddress
+{
+public:
+    IPAddress() : _address(0) {}
+    IPAddress(uint32_t address) : _address(address) {}
+    IPAddress(const struct ip_addr &address) : _address(address.addr) {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : _address(a | (b << 8) | (c << 16) | ((uint32_t)d << 24)) {}
+
+    operator uint32_t() const { return _address; }
+    uint8_t operator[](int index) const { return (_address >> (index * 8)) & 0xFF; }
+    bool isSet() const { return _address != 0; }
+    bool fromString(const char *address);
+    String toString() const;
+
+private:
+    uint32_t _address;
+};
+
+struct station_info
+{
+    struct station_info *next;
+    uint8_t bssid[6];
+    struct ip_addr ip;
+};
+
+#define STAILQ_NEXT(elm, field) ((elm)->field)
+
+struct station_info *wifi_softap_get_station_info(void);
+
+enum dhcp_status wifi_station_dhcpc_status(void);
+enum dhcp_status wifi_softap_dhcps_status(void);
+bool wifi_station_dhcpc_start(void);
+bool wifi_station_dhcpc_stop(void);
+bool wifi_softap_dhcps_start(void);
+bool wifi_softap_dhcps_stop(void);
+
+/**
+ * State of a fake TCP connection. It is shared between all the copies of
+ * a WiFiClient, the same way the ESP8266 core shares its ClientContext.
+ */
+struct ShimConnection
+{
+    std::deque<uint8_t> rx;
+    std::string tx;
+    bool connected = true;
+    IPAddress remoteIP = IPAddress(192, 168, 4, 2);
+    uint16_t remotePort = 50000;
+    uint16_t localPort = 0;
+};
+
+class WiFiClient
+{
+public:
+    WiFiClient() {}
+    explicit WiFiClient(std::shared_ptr<ShimConnection> connection) : _connection(connection) {}
+    virtual ~WiFiClient() {}
+
+    operator bool() { return _connection != nullptr; }
+    uint8_t status() { return connected() ? ESTABLISHED : CLOSED; }
+
+    // Virtual as in the ESP8266 core, where BearSSL::WiFiClientSecure overrides them
+    virtual uint8_t connected() { return _connection && (_connection->connected || !_connection->rx.empty()); }
+    virtual int available() { return _connection ? (int)_connection->rx.size() : 0; }
+    virtual int read();
+    virtual int read(uint8_t *buffer, size_t size);
+    int read(char *buffer, size_t size) { return read((uint8_t *)buffer, size); }
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+    virtual size_t availableForWrite() { return _connection && _connection->connected ? 2920 : 0; }
+    virtual void stop();
+
+    virtual int connect(const char *host, uint16_t port);
+    virtual int connect(IPAddress ip, uint16_t port);
+    void setNoDelay(bool nodelay) {}
+    void setTimeout(unsigned long timeout) {}
+
+    IPAddress remoteIP() { return _connection ? _connection->remoteIP : IPAddress(); }
+    uint16_t remotePort() { return _connection ? _connection->remotePort : 0; }
+    uint16_t localPort() { return _connection ? _connection->localPort : 0; }
+
+    /**
+     * @brief Gives access to the fake connection (host side of the socket).
+     */
+    std::shared_ptr<ShimConnection> shim_connection() { return _connection; }
+
+private:
+    std::shared_ptr<ShimConnection> _connection;
+};
+
+class WiFiServer
+{
+public:
+    WiFiServer(uint16_t port) : _port(port) {}
+
+    void begin() { _listening = true; }
+    void close() { _listening = false; }
+    uint8_t status() { return _listening ? LISTEN : CLOSED; }
+    uint16_t port() const { return _port; }
+
+    bool hasClient() { return !_pending.empty(); }
+    WiFiClient available();
+
+private:
+    uint16_t _port;
+    bool _listening = false;
+    std::deque<WiFiClient> _pending;
+};
+
+#define WIFI_SCAN_RUNNING (-1)
+#define WIFI_SCAN_FAILED (-2)
+
+// Simulated durations of a connection to an AP, of a scan and of a TCP handshake (connect() blocks)
+#define SHIM_JOIN_DURATION_MS 1500
+#define SHIM_FAST_JOIN_DURATION_MS 300
+#define SHIM_SCAN_DURATION_MS 2000
+#define SHIM_CONNECT_DURATION_MS 50
+
+class ESP8266WiFiClass
+{
+public:
+    WiFiMode_t getMode() { return _mode; }
+    bool mode(WiFiMode_t mode) { _mode = mode; return true; }
+    void persistent(bool persistent) { _persistent = persistent; }
+
+    wl_status_t begin(const char *ssid, const char *passphrase = NULL, int32_t channel = 0, const uint8_t *bssid = NULL, bool connect = true);
+    wl_status_t begin();
+    wl_status_t status();
+    bool disconnect(bool wifioff = false);
+    bool setSleepMode(WiFiSleepType_t type) { _sleepMode = type; return true; }
+    WiFiSleepType_t getSleepMode() { return _sleepMode; }
+    bool setAutoReconnect(bool autoReconnect) { _autoReconnect = autoReconnect; return true; }
+    bool getAutoReconnect() { return _autoReconnect; }
+
+    bool config(IPAddress local_ip, IPAddress gateway, IPAddress subnet, IPAddress dns1 = (uint32_t)0) { _staticIP = local_ip; return true; }
+    IPAddress localIP() { return _status == WL_CONNECTED ? (_staticIP.isSet() ? _staticIP : IPAddress(192, 168, 1, 42)) : IPAddress(); }
+    IPAddress dnsIP(uint8_t i = 0) { return IPAddress(192, 168, 1, 1); }
+    IPAddress gatewayIP() { return IPAddress(192, 168, 1, 1); }
+    IPAddress subnetMask() { return IPAddress(255, 255, 255, 0); }
+
+    String SSID() const { return String(_ssid.c_str()); }
+    String psk() const { return String(_psk.c_str()); }
+    uint8_t *BSSID() { return _apBssid; }
+    String BSSIDstr() { return String("11:22:33:44:55:66"); }
+    int32_t channel() { return _apChannel; }
+    int32_t RSSI() { return -60; }
+
+    int8_t scanNetworks(bool async = false);
+    int8_t scanComplete();
+    void scanDelete() { _scanning = false; }
+    String SSID(uint8_t i) { return String(i == 0 ? "shim-ap" : "shim-ap-2"); }
+    int32_t RSSI(uint8_t i) { return -50 - 10 * i; }
+    String BSSIDstr(uint8_t i) { return String(i == 0 ? "11:22:33:44:55:66" : "11:22:33:44:55:67"); }
+    uint8_t *BSSID(uint8_t i)
+    {
+        static uint8_t bssid[6] = {0x11, 0x22, 0x33, 0x44, 0x55, 0x66};
+        bssid[5] = 0x66 + i;
+        return bssid;
+    }
+    int32_t channel(uint8_t i) { return 1 + 5 * i; }
+    uint8_t encryptionType(uint8_t i) { return i == 0 ? ENC_TYPE_CCMP : ENC_TYPE_NONE; }
+
+    bool softAPConfig(IPAddress local_ip, IPAddress gateway, IPAddress subnet) { return true; }
+    bool softAP(const char *ssid, const char *passphrase = NULL, int channel = 1, int ssid_hidden = 0, int max_connection = 4);
+    String softAPSSID() const { return String(_apSsid.c_str()); }
+    String softAPPSK() const { return String(_apPsk.c_str()); }
+    uint8_t softAPgetStationNum() { return 0; }
+    void enableInsecureWEP(bool enable = true) {}
+
+    bool setHostname(const char *hostname) { _hostname = hostname; return true; }
+
+    /**
+     * @brief Resolves any name but the ones ending with ".invalid", to a fixed address.
+     */
+    int hostByName(const char *hostname, IPAddress &result);
+    const char *getHostname() { return _hostname.c_str(); }
+
+private:
+    WiFiMode_t _mode = WIFI_STA;
+    WiFiSleepType_t _sleepMode = WIFI_MODEM_SLEEP;
+    wl_status_t _status = WL_IDLE_STATUS;
+    bool _joining = false;
+    bool _joinFails = false;
+    unsigned long _joinDuration = 0;
+    int32_t _apChannel = 6;
+    uint8_t _apBssid[6] = {0x11, 0x22, 0x33, 0x44, 0x55, 0x66};
+    IPAddress _staticIP;
+    std::string _psk;
+    unsigned long _joinStarted = 0;
+    bool _scanning = false;
+    unsigned long _scanStarted = 0;
+    bool _autoReconnect = true;
+    std::string _ssid;
+    std::string _apSsid;
+    std::string _apPsk;
+    std::string _hostname = "esp8266";
+    bool _persistent = true;
+};
+
+extern ESP8266WiFiClass WiFi;
+
+#endif
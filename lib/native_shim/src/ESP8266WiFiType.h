@@ -0,0 +1,58 @@
+#ifndef __NATIVE_SHIM_ESP8266WIFITYPE__
+#define __NATIVE_SHIM_ESP8266WIFITYPE__
+
+#include <stdint.h>
+
+typedef enum
+{
+    WIFI_OFF = 0,
+    WIFI_STA = 1,
+    WIFI_AP = 2,
+    WIFI_AP_STA = 3
+} WiFiMode_t;
+
+typedef enum WiFiSleepType
+{
+    WIFI_NONE_SLEEP = 0,
+    WIFI_LIGHT_SLEEP = 1,
+    WIFI_MODEM_SLEEP = 2
+} WiFiSleepType_t;
+
+typedef enum
+{
+    WL_NO_SHIELD = 255,
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL = 1,
+    WL_SCAN_COMPLETED = 2,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_CONNECTION_LOST = 5,
+    WL_WRONG_PASSWORD = 6,
+    WL_DISCONNECTED = 7
+} wl_status_t;
+
+enum wl_enc_type
+{
+    ENC_TYPE_WEP = 5,
+    ENC_TYPE_TKIP = 2,
+    ENC_TYPE_CCMP = 4,
+    ENC_TYPE_NONE = 7,
+    ENC_TYPE_AUTO = 8
+};
+
+enum tcp_state
+{
+    CLOSED = 0,
+    LISTEN = 1,
+    SYN_SENT = 2,
+    SYN_RCVD = 3,
+    ESTABLISHED = 4
+};
+
+enum dhcp_status
+{
+    DHCP_STOPPED,
+    DHCP_STARTED
+};
+
+#endif
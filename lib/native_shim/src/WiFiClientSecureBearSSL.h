@@ -0,0 +1,54 @@
+#ifndef __NATIVE_SHIM_WIFICLIENTSECURE__
+#define __NATIVE_SHIM_WIFICLIENTSECURE__
+
+#include "ESP8266WiFi.h"
+
+namespace BearSSL
+{
+
+/**
+ * TLS session parameters, filled by a full handshake and used to resume the session.
+ */
+class Session
+{
+public:
+    bool shim_valid = false;
+};
+
+/**
+ * TLS client: the data is passed through unencrypted, the handshakes are counted.
+ */
+class WiFiClientSecure : public WiFiClient
+{
+public:
+    using WiFiClient::connect;
+
+    int connect(const char *host, uint16_t port) override;
+
+    void setSession(Session *session) { _session = session; }
+    void setInsecure() { _fingerprint = false; }
+    bool setFingerprint(const uint8_t fingerprint[20]) { _fingerprint = true; return true; }
+    void setBufferSizes(int recv, int xmit) { shim_recv_buffer = recv; shim_xmit_buffer = xmit; }
+
+    static bool probeMaxFragmentLength(const char *hostname, uint16_t port, uint16_t len);
+
+    int shim_recv_buffer = 16384;
+    int shim_xmit_buffer = 512;
+
+    // Handshakes done by all the clients, and MFLN probes
+    static int shim_full_handshakes;
+    static int shim_resumed_handshakes;
+    static int shim_probes;
+
+    // MFLN support of the fake servers, and whether a fingerprint check fails
+    static bool shim_mfln_supported;
+    static bool shim_fingerprint_mismatch;
+
+private:
+    Session *_session = nullptr;
+    bool _fingerprint = false;
+};
+
+} // namespace BearSSL
+
+#endif
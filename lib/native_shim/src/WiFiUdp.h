@@ -0,0 +1,48 @@
+#ifndef __NATIVE_SHIM_WIFIUDP__
+#define __NATIVE_SHIM_WIFIUDP__
+
+#include "ESP8266WiFi.h"
+#include <string>
+
+struct ShimDatagram
+{
+    std::string data;
+    IPAddress ip;
+    uint16_t port;
+};
+
+/**
+ * State of a fake UDP socket: datagrams to receive (pushed by the test) and sent datagrams.
+ */
+struct ShimUdpSocket
+{
+    std::deque<ShimDatagram> rx;
+    std::deque<ShimDatagram> tx;
+    uint16_t localPort = 0;
+};
+
+class WiFiUDP
+{
+public:
+    uint8_t begin(uint16_t port);
+    void stop() { _socket = nullptr; }
+
+    int beginPacket(IPAddress ip, uint16_t port);
+    size_t write(const uint8_t *buffer, size_t size);
+    int endPacket();
+
+    int parsePacket();
+    int available() { return (int)(_packet.data.size() - _read); }
+    int read(uint8_t *buffer, size_t size);
+    IPAddress remoteIP() { return _packet.ip; }
+    uint16_t remotePort() { return _packet.port; }
+    uint16_t localPort() { return _socket ? _socket->localPort : 0; }
+
+private:
+    std::shared_ptr<ShimUdpSocket> _socket;
+    ShimDatagram _packet;
+    size_t _read = 0;
+    ShimDatagram _outgoing;
+};
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef __SHIM_SPI_FLASH__
+#define __SHIM_SPI_FLASH__
+
+#include <stdint.h>
+
+/**
+ * SPI flash API of the ESP8266 SDK, backed by memory.
+ * Writes only clear bits, as on a NOR flash: an area must be erased before being rewritten.
+ */
+#define SPI_FLASH_SEC_SIZE 4096
+#define SHIM_FLASH_SECTORS 16
+
+typedef enum
+{
+    SPI_FLASH_RESULT_OK,
+    SPI_FLASH_RESULT_ERR,
+    SPI_FLASH_RESULT_TIMEOUT
+} SpiFlashOpResult;
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+SpiFlashOpResult spi_flash_erase_sector(uint16_t sec);
+SpiFlashOpResult spi_flash_write(uint32_t des_addr, uint32_t *src_addr, uint32_t size);
+SpiFlashOpResult spi_flash_read(uint32_t src_addr, uint32_t *des_addr, uint32_t size);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
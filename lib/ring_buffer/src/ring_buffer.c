@@ -0,0 +1,128 @@
+#include "ring_buffer.h"
+
+#include <string.h>
+
+void rb_init(RING_BUFFER *rb, uint8_t *storage, uint16_t size)
+{
+    rb->data = storage;
+    rb->size = size;
+    rb_clear(rb);
+}
+
+void rb_clear(RING_BUFFER *rb)
+{
+    rb->head = 0;
+    rb->count = 0;
+}
+
+uint16_t rb_count(const RING_BUFFER *rb)
+{
+    return rb->count;
+}
+
+uint16_t rb_free(const RING_BUFFER *rb)
+{
+    return rb->size - rb->count;
+}
+
+uint16_t rb_peek_contiguous(const RING_BUFFER *rb, const uint8_t **segment)
+{
+    uint16_t len = rb->size - rb->head;
+
+    *segment = rb->data + rb->head;
+
+    return rb->count < len ? rb->count : len;
+}
+
+void rb_consume(RING_BUFFER *rb, uint16_t len)
+{
+    if(len > rb->count)
+    {
+        len = rb->count;
+    }
+
+    rb->head = (rb->head + len) % rb->size;
+    rb->count -= len;
+
+    // Reading from the start of the storage keeps the segments as large as possible
+    if(rb->count == 0)
+    {
+        rb->head = 0;
+    }
+}
+
+uint16_t rb_write_contiguous(RING_BUFFER *rb, uint8_t **segment)
+{
+    uint16_t tail = (rb->head + rb->count) % rb->size;
+    uint16_t len = tail >= rb->head ? rb->size - tail : rb->head - tail;
+
+    if(rb->count == rb->size)
+    {
+        len = 0;
+    }
+
+    *segment = rb->data + tail;
+
+    return len;
+}
+
+void rb_commit(RING_BUFFER *rb, uint16_t len)
+{
+    uint16_t free = rb_free(rb);
+
+    rb->count += len < free ? len : free;
+}
+
+uint16_t rb_write(RING_BUFFER *rb, const uint8_t *data, uint16_t len)
+{
+    uint16_t written = 0;
+
+    while(written < len)
+    {
+        uint8_t *segment;
+        uint16_t n = rb_write_contiguous(rb, &segment);
+
+        if(n == 0)
+        {
+            break;
+        }
+
+        if(n > len - written)
+        {
+            n = len - written;
+        }
+
+        memcpy(segment, data + written, n);
+        rb_commit(rb, n);
+        written += n;
+    }
+
+    return written;
+}
+
+uint16_t rb_read(RING_BUFFER *rb, uint8_t *data, uint16_t len)
+{
+    uint16_t read = 0;
+
+    while(read < len)
+    {
+        const uint8_t *segment;
+        uint16_t n = rb_peek_contiguous(rb, &segment);
+
+        if(n == 0)
+        {
+            break;
+        }
+
+        if(n > len - read)
+        {
+            n = len - read;
+        }
+
+        memcpy(data + read, segment, n);
+        rb_consume(rb, n);
+        read += n;
+    }
+
+    return read;
+}
@@ -0,0 +1,50 @@
+#ifndef __RING_BUFFER__
+#define __RING_BUFFER__
+
+#include <stdint.h>
+
+/**
+ * Fixed-size byte FIFO over a caller-provided storage.
+ * Readers and writers can access the storage in place through the
+ * contiguous segment functions, to avoid intermediate copies.
+ */
+typedef struct _ring_buffer
+{
+    uint8_t *data;
+    uint16_t size;
+    uint16_t head;
+    uint16_t count;
+} RING_BUFFER;
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+void rb_init(RING_BUFFER *rb, uint8_t *storage, uint16_t size);
+void rb_clear(RING_BUFFER *rb);
+
+uint16_t rb_count(const RING_BUFFER *rb);
+uint16_t rb_free(const RING_BUFFER *rb);
+
+uint16_t rb_write(RING_BUFFER *rb, const uint8_t *data, uint16_t len);
+uint16_t rb_read(RING_BUFFER *rb, uint8_t *data, uint16_t len);
+
+/**
+ * Returns the first contiguous readable segment.
+ * Call rb_consume once the bytes have been used.
+ */
+uint16_t rb_peek_contiguous(const RING_BUFFER *rb, const uint8_t **segment);
+void rb_consume(RING_BUFFER *rb, uint16_t len);
+
+/**
+ * Returns the first contiguous writable segment.
+ * Call rb_commit with the number of bytes actually written.
+ */
+uint16_t rb_write_contiguous(RING_BUFFER *rb, uint8_t **segment);
+void rb_commit(RING_BUFFER *rb, uint16_t len);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
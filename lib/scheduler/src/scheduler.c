@@ -0,0 +1,105 @@
+#include "scheduler.h"
+
+#include <Arduino.h>
+#include <string.h>
+#include "at_log.h"
+
+static TASK tasks[SCHEDULER_MAX_TASKS];
+static unsigned long last_loop_start = 0;
+
+LOOP_STATS loop_stats;
+const unsigned long loop_histogram_bounds_us[LOOP_HISTOGRAM_BUCKETS - 1] = LOOP_HISTOGRAM_BOUNDS_US;
+
+int scheduler_add(task_callback callback, void *context, unsigned long interval)
+{
+    for(int i = 0; i < SCHEDULER_MAX_TASKS; i++)
+    {
+        if(tasks[i].callback == NULL)
+        {
+            tasks[i].callback = callback;
+            tasks[i].context = context;
+            tasks[i].interval = interval;
+            tasks[i].last_run = millis();
+
+            return i;
+        }
+    }
+
+    LogErr("No more than %d tasks can be scheduled.", SCHEDULER_MAX_TASKS);
+    return -1;
+}
+
+void scheduler_remove(int id)
+{
+    if(id >= 0 && id < SCHEDULER_MAX_TASKS)
+    {
+        tasks[id].callback = NULL;
+    }
+}
+
+static void record_loop(unsigned long duration)
+{
+    unsigned char bucket = 0;
+
+    while(bucket < LOOP_HISTOGRAM_BUCKETS - 1 && duration >= loop_histogram_bounds_us[bucket])
+    {
+        bucket++;
+    }
+
+    loop_stats.histogram[bucket]++;
+    loop_stats.loops++;
+
+    if(duration > loop_stats.max_us)
+    {
+        loop_stats.max_us = duration;
+    }
+}
+
+void scheduler_run()
+{
+    unsigned long start = micros();
+
+    // The period includes the time spent by the core (WiFi stack) between two loops
+    if(loop_stats.loops > 0 && start - last_loop_start > loop_stats.period_max_us)
+    {
+        loop_stats.period_max_us = start - last_loop_start;
+    }
+
+    last_loop_start = start;
+
+    for(int i = 0; i < SCHEDULER_MAX_TASKS; i++)
+    {
+        TASK *task = &tasks[i];
+
+        if(task->callback == NULL)
+        {
+            continue;
+        }
+
+        if(task->interval > 0)
+        {
+            if(millis() - task->last_run < task->interval)
+            {
+                continue;
+            }
+
+            task->last_run = millis();
+        }
+
+        // The task may remove itself, or add other tasks, while it runs
+        task_callback callback = task->callback;
+
+        if(callback(task->context) == TASK_DONE && task->callback == callback)
+        {
+            task->callback = NULL;
+        }
+    }
+
+    record_loop(micros() - start);
+}
+
+void scheduler_reset_stats()
+{
+    memset(&loop_stats, 0, sizeof(loop_stats));
+    loop_stats.reset_at = millis();
+}
@@ -0,0 +1,72 @@
+#ifndef __SCHEDULER__
+#define __SCHEDULER__
+
+#include <stdint.h>
+
+/**
+ * Cooperative scheduler run from loop().
+ * Tasks must not block: long operations are split in steps, each task call
+ * doing one step and returning TASK_CONTINUE until the operation is done.
+ */
+#ifndef SCHEDULER_MAX_TASKS
+#define SCHEDULER_MAX_TASKS 12
+#endif
+
+#define TASK_CONTINUE 0
+#define TASK_DONE 1
+
+// Loop durations (us) of the histogram buckets: the last bucket holds the longer loops
+#define LOOP_HISTOGRAM_BUCKETS 10
+#define LOOP_HISTOGRAM_BOUNDS_US {50, 100, 250, 500, 1000, 2500, 5000, 10000, 50000}
+
+/**
+ * @brief Runs one step of a task.
+ *
+ * @return TASK_CONTINUE to be called again, TASK_DONE to be removed.
+ */
+typedef char (*task_callback)(void *context);
+
+typedef struct _task
+{
+    task_callback callback;
+    void *context;
+    unsigned long interval;
+    unsigned long last_run;
+} TASK;
+
+typedef struct _loop_stats
+{
+    unsigned long loops;
+    unsigned long max_us;
+    unsigned long period_max_us;    // longest time between two loop starts, including the time spent by the core
+    unsigned long reset_at;         // time (ms) of the last reset, for the mean period
+    unsigned long histogram[LOOP_HISTOGRAM_BUCKETS];
+} LOOP_STATS;
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+extern LOOP_STATS loop_stats;
+extern const unsigned long loop_histogram_bounds_us[LOOP_HISTOGRAM_BUCKETS - 1];
+
+/**
+ * @brief Adds a task, called every interval ms (0: on every loop).
+ *
+ * @return the task identifier, or -1 if the task table is full.
+ */
+int scheduler_add(task_callback callback, void *context, unsigned long interval);
+void scheduler_remove(int id);
+
+/**
+ * @brief Calls the tasks that are due, and records the duration and the period of the loop.
+ */
+void scheduler_run();
+
+void scheduler_reset_stats();
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
@@ -1,83 +1,392 @@
-
 #include <Arduino.h>
 
 #include "at_command_process.h"
 #include "at_parser.h"
-#include "logging.h"
+#include "at_log.h"
+#include "response.h"
+#include "counters.h"
 
 #define BUFFER_SIZE 2048
 
 bool stop_at_processing = false;
+bool batch_stop_on_error = false;
 
-void process_at_commands()
+/*
+ * Line assembler: bytes are read from the UART in bulk into a fixed buffer,
+ * and each command is parsed in place as a slice of this buffer. Consumed
+ * lines only move the start offset; the pending partial line is moved back to
+ * the front of the buffer when the end is reached. No heap is involved.
+ */
+static char line_buffer[AT_MAX_TEMP_STRING + 1];
+static uint16_t line_start = 0;
+static uint16_t line_scanned = 0;
+static uint16_t line_end = 0;
+static bool line_discarding = false;
+
+// The last command ended with CR: a LF following it is not part of the raw input
+static bool input_skip_lf = false;
+
+// A command completing asynchronously, without taking the UART over, did not report its result yet:
+// the next lines are refused
+static bool command_pending = false;
+
+static char ret[BUFFER_SIZE];
+
+/*
+ * Batch: commands of one line separated by ';' (AT+CWSTATE?;+CIPSTATE?;+CIPRECVLEN?).
+ * The commands run in sequence, each one followed by +BATCH:<index>,<result>, and
+ * the line ends with a single final result. A command completing asynchronously
+ * suspends the batch until its result is known: the rest of the line stays in the
+ * line buffer, which is not read meanwhile.
+ */
+static struct
+{
+  bool active;
+  bool pending;   // the current command did not report its result yet
+  bool failed;
+  uint8_t index;
+  char *next;     // rest of the line, in the line buffer
+  uint16_t remaining;
+} batch;
+
+/**
+ * @brief Trims the spaces around a slice.
+ */
+static void trim(char **line, uint16_t *len)
+{
+  while (*len > 0 && isspace((unsigned char)(*line)[0]))
+  {
+    (*line)++;
+    (*len)--;
+  }
+
+  while (*len > 0 && isspace((unsigned char)(*line)[*len - 1]))
+  {
+    (*len)--;
+  }
+}
+
+/**
+ * @brief Finds the first ';' out of the quoted parameters.
+ *
+ * @return its position, or len if there is none.
+ */
+static uint16_t find_separator(const char *line, uint16_t len)
+{
+  bool quoted = false;
+
+  for (uint16_t i = 0; i < len; i++)
+  {
+    if (quoted && line[i] == '\\')
+    {
+      i++;
+    }
+    else if (line[i] == '"')
+    {
+      quoted = !quoted;
+    }
+    else if (line[i] == ';' && !quoted)
+    {
+      return i;
+    }
+  }
+
+  return len;
+}
+
+/**
+ * @brief Executes a command: AT, AT+<command>, or +<command> in a batch.
+ *
+ * @return the result of the handler.
+ */
+static char execute_command(char *command, uint16_t len)
 {
-  static String readString = "";
-  char ret[BUFFER_SIZE];
   char res;
 
+  counter_add(COUNTER_AT_COMMANDS, 1);
+
+  if (len >= 2 && command[0] == 'A' && command[1] == 'T')
+  {
+    command += 2;
+    len -= 2;
+  }
+
+  if (len == 0)
+  {
+    return AT_OK;
+  }
+
+  if (command[0] != '+')
+  {
+    return AT_ERROR;
+  }
+
+  res = at_parse_command(command + 1, len - 1, (unsigned char *)ret);
+
+  if (res == AT_OK && ret[0] != 0)
+  {
+    response_println(ret);
+  }
+
+  return res;
+}
+
+static void print_final_result(char result)
+{
+  response_println("");
+  response_println(result == AT_OK ? AT_OK_STRING : AT_ERROR_STRING);
+}
+
+/**
+ * @brief Runs the commands of the batch up to its end, or up to a command completing asynchronously.
+ */
+static void run_batch()
+{
+  while (batch.remaining > 0 && !(batch.failed && batch_stop_on_error))
+  {
+    char *command = batch.next;
+    uint16_t len = find_separator(batch.next, batch.remaining);
+
+    // The command is terminated in place, over its separator
+    batch.next += len < batch.remaining ? len + 1 : len;
+    batch.remaining -= len < batch.remaining ? len + 1 : len;
+
+    trim(&command, &len);
+
+    if (len == 0)
+    {
+      continue;
+    }
+
+    batch.pending = true;
+
+    char res = execute_command(command, len);
+
+    if (res != AT_PENDING)
+    {
+      complete_at_command(res);
+    }
+
+    if (batch.pending)
+    {
+      // The handler prints its result once done
+      return;
+    }
+  }
+
+  batch.active = false;
+  print_final_result(batch.failed ? AT_ERROR : AT_OK);
+}
+
+/**
+ * @brief Executes a complete line, given as a slice of the line buffer.
+ */
+static void process_line(char *line, uint16_t len)
+{
+  trim(&line, &len);
+
+  if (len < 2 || line[0] != 'A' || line[1] != 'T')
+  {
+    return;
+  }
+
+  if (command_pending)
+  {
+    response_println(AT_BUSY_STRING);
+    return;
+  }
+
+  if (find_separator(line, len) < len)
+  {
+    batch.active = true;
+    batch.failed = false;
+    batch.index = 0;
+    batch.next = line;
+    batch.remaining = len;
+
+    run_batch();
+    return;
+  }
+
+  command_pending = true;
+
+  char res = execute_command(line, len);
+
+  if (res == AT_PENDING)
+  {
+    // The handler prints its result once done. A handler taking the UART over (data modes) is not
+    // given new lines anyway, and may end without a result (transparent transmission).
+    command_pending = command_pending && !stop_at_processing;
+    return;
+  }
+
+  complete_at_command(res);
+}
+
+void complete_at_command(char result)
+{
+  if (result != AT_OK)
+  {
+    counter_add(COUNTER_AT_ERRORS, 1);
+  }
+
+  if (batch.active)
+  {
+    response_printf("+BATCH:%d,%s\r\n", batch.index++, result == AT_OK ? AT_OK_STRING : AT_ERROR_STRING);
+    batch.failed |= result != AT_OK;
+    batch.pending = false;
+    return;
+  }
+
+  command_pending = false;
+  print_final_result(result);
+}
+
+bool parse_command_args(const char *value, const AT_ARG_SPEC *schema, uint8_t count, void *args)
+{
+  uint8_t index;
+  uint8_t error = at_parse_args(value, schema, count, args, &index);
+
+  if (error != AT_ARGS_OK)
+  {
+    response_printf("+ARGERR:%d,%d\r\n", index, error);
+    return false;
+  }
+
+  return true;
+}
+
+size_t read_at_input(char *buffer, size_t length)
+{
+  size_t n = 0;
+
+  if (input_skip_lf)
+  {
+    if (line_start < line_end)
+    {
+      input_skip_lf = false;
+      line_start += line_buffer[line_start] == '\n';
+    }
+    else if (Serial.available() > 0)
+    {
+      input_skip_lf = false;
+
+      if (Serial.peek() == '\n')
+      {
+        Serial.read();
+      }
+    }
+  }
+
+  // Bytes already pulled from the UART behind the last command come first
+  if (line_start < line_end)
+  {
+    n = (size_t)(line_end - line_start) < length ? line_end - line_start : length;
+    memcpy(buffer, line_buffer + line_start, n);
+    line_start += n;
+  }
+
+  if (line_scanned < line_start)
+  {
+    line_scanned = line_start;
+  }
+
+  if (n < length)
+  {
+    n += Serial.read(buffer + n, length - n);
+  }
+
+  return n;
+}
+
+void process_at_commands()
+{
+  // Checked here as well while a data mode owns the UART
+  if (Serial.hasOverrun())
+  {
+    counter_add(COUNTER_UART_OVERRUNS, 1);
+  }
+
   if (stop_at_processing)
   {
     return;
   }
 
-  while (Serial.available())
+  // A suspended batch is resumed before any new input
+  if (batch.active)
   {
-    if (Serial.available() > 0)
+    if (!batch.pending)
     {
-      // Get a byte from buffer
-      char c = Serial.read();
+      run_batch();
+    }
 
-      readString += c;
+    if (batch.active)
+    {
+      return;
+    }
+  }
 
-      // Input is too long
-      if (readString.length() > AT_MAX_TEMP_STRING)
+  do
+  {
+    if (line_end == AT_MAX_TEMP_STRING)
+    {
+      if (line_start > 0)
       {
-        LogErr("Input is too long");
-        Serial.println();
-        Serial.println(AT_ERROR_STRING);
-        readString = "";
+        memmove(line_buffer, line_buffer + line_start, line_end - line_start);
+        line_end -= line_start;
+        line_scanned -= line_start;
+        line_start = 0;
       }
       else
       {
-        if (c == '\r' || c == ';')
+        // Input is too long, drop it up to the next terminator
+        if (!line_discarding)
         {
-          readString.trim();
+          LogErr("Input is too long");
+          counter_add(COUNTER_AT_LINES_DROPPED, 1);
 
-          if (!readString.startsWith("AT"))
-          {
-            readString = "";
-          }
-          else if (readString == "AT")
+          if (command_pending)
           {
-            Serial.println();
-            Serial.println(AT_OK_STRING);
-            readString = "";
+            response_println(AT_BUSY_STRING);
           }
           else
           {
-            // Parsing the command
-            res = at_parse_line(readString.c_str(), (unsigned char *)ret);
-
-            readString = "";
-
-            if (res == AT_OK)
-            {
-              if (ms_strlen(ret) > 0)
-              {
-                String s_ret(ret);
-                Serial.println(s_ret);
-              }
-              Serial.println();
-              Serial.println(AT_OK_STRING);
-            }
-            else
-            {
-              Serial.println();
-              Serial.println(AT_ERROR_STRING);
-            }
+            complete_at_command(AT_ERROR);
           }
         }
+
+        line_end = line_scanned = 0;
+        line_discarding = true;
       }
-    } // end serial available
-  }   // end while
-}
\ No newline at end of file
+    }
+
+    size_t read = Serial.read(line_buffer + line_end, AT_MAX_TEMP_STRING - line_end);
+
+    line_end += read;
+    counter_add(COUNTER_AT_RX_BYTES, read);
+
+    for (; line_scanned < line_end && !stop_at_processing && !batch.active; line_scanned++)
+    {
+      char c = line_buffer[line_scanned];
+
+      if (c == '\r')
+      {
+        if (!line_discarding)
+        {
+          input_skip_lf = true;
+          process_line(line_buffer + line_start, line_scanned - line_start);
+        }
+
+        line_discarding = false;
+        line_start = line_scanned + 1;
+      }
+    }
+
+    if (line_start == line_end)
+    {
+      line_start = line_scanned = line_end = 0;
+    }
+
+    // Stop when a data mode took over the input, or a batch is suspended
+  } while (!stop_at_processing && !batch.active && Serial.available() > 0);
+}
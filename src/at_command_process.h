@@ -2,6 +2,7 @@
 #define __AT_COMMAND_PROCESS__
 
 #include <Arduino.h>
+#include "at_args.h"
 
 #ifdef __cplusplus
 extern "C"{
@@ -13,12 +14,39 @@ extern "C"{
  */
 extern bool stop_at_processing;
 
+/**
+ * @brief When set, a batch (AT+A;+B) stops at the first command that fails (AT+BATCHCFG).
+ */
+extern bool batch_stop_on_error;
+
 /**
  * @brief Processes the AT command.
  *     Reads the Serial buffer and processes the AT command. * 
  */
 void process_at_commands();
 
+/**
+ * @brief Prints the final result of a command whose handler returned AT_PENDING.
+ */
+void complete_at_command(char result);
+
+/**
+ * @brief Parses the parameters of a Set command as described by the schema (see at_args.h).
+ *      On error, +ARGERR:<parameter>,<error> is printed before the final result.
+ *
+ * @return false if the parameters do not match the schema.
+ */
+bool parse_command_args(const char *value, const AT_ARG_SPEC *schema, uint8_t count, void *args);
+
+/**
+ * @brief Reads raw input following the last processed command.
+ *      Bytes already assembled behind the command are returned first, then
+ *      the Serial buffer is read. Used by the data modes (e.g. AT+CIPSEND).
+ *
+ * @return the number of bytes copied in buffer.
+ */
+size_t read_at_input(char *buffer, size_t length);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -4,50 +4,499 @@
 
 #include "common.h"
 #include "basic_commands.h"
+#include "settings.h"
+#include "sleep_commands.h"
+#include "at_command_process.h"
+#include "at_log.h"
+#include "scheduler.h"
+#include "response.h"
+#include "counters.h"
+
+#ifdef ARDUINO_ARCH_ESP8266
+#include <esp8266_peri.h>
+#endif
+
+#define UART_MIN_BAUD 80
+#define UART_MAX_BAUD 5000000
+
+#define UART_FLOW_RTS 1
+#define UART_FLOW_CTS 2
+
+// RX FIFO level (bytes) above which RTS is deasserted
+#define UART_RTS_THRESHOLD 100
+
+// Pins of the UART0 hardware flow control
+#define UART_RTS_PIN 15
+#define UART_CTS_PIN 13
+
+// Lowest free heap seen since boot or the last AT+SYSSTAT
+uint32_t heapMinFree = UINT32_MAX;
 
 void reset() {
-    Serial.println("OK");
+    commit_settings();
+    save_sleep_state();
+    response_println("OK");
+    response_flush();
     ESP.restart();
 }
 
 char check_version_information(char *value) {
 
-    Serial.println("AT version:" + (String)AT_VERSION);
-    Serial.println("Bin version:" + (String)FIRMWARE_VERSION);
+    response_println("AT version:" AT_VERSION);
+    response_println("Bin version:" FIRMWARE_VERSION);
     return AT_OK;
 }
 
 char list_all_commands(char *value) {
     int i;
 
-    for(i = 0; i < AT_COMMANDS_NUM; i++)
+    for(i = 0; i < at_registered_commands_count; i++)
     {
-        if(at_registered_commands[i].hash != 0)
+        AT_COMMAND current = at_registered_commands[i];
+
+        response_printf("+CMD:%d,%s,%d,%d,%d,%d\r\n", i, (const char*)current.name,
+                        current.test != NULL, current.getter != NULL, current.setter != NULL, current.execute != NULL);
+    }
+
+    return AT_OK;
+}
+
+uint8_t uartFlowControl = 0;
+
+/**
+ * @brief Enables the hardware flow control of UART0, handled by the UART itself.
+ */
+void apply_uart_flow_control(uint8_t flow_control)
+{
+#ifdef ARDUINO_ARCH_ESP8266
+    if (flow_control & UART_FLOW_RTS)
+    {
+        pinMode(UART_RTS_PIN, FUNCTION_4);
+        USC1(0) = (USC1(0) & ~(0x7F << UCRXHFT)) | (UART_RTS_THRESHOLD << UCRXHFT) | (1 << UCRXHFE);
+    }
+    else
+    {
+        USC1(0) &= ~(1 << UCRXHFE);
+    }
+
+    if (flow_control & UART_FLOW_CTS)
+    {
+        pinMode(UART_CTS_PIN, FUNCTION_4);
+        USC0(0) |= (1 << UCTXHFE);
+    }
+    else
+    {
+        USC0(0) &= ~(1 << UCTXHFE);
+    }
+#endif
+}
+
+void begin_uart(unsigned long baud, uint8_t flow_control)
+{
+    Serial.setRxBufferSize(UART_RX_BUFFER_SIZE);
+    Serial.begin(baud);
+    apply_uart_flow_control(flow_control);
+    uartFlowControl = flow_control;
+}
+
+typedef struct _uart_args
+{
+    long baud;
+    long databits;
+    long stopbits;
+    long parity;
+    long flow;
+} UART_ARGS;
+
+static const AT_ARG_SPEC uart_args[] = {
+    AT_ARG_INT(UART_ARGS, baud, AT_ARG_REQUIRED, UART_MIN_BAUD, UART_MAX_BAUD),
+    AT_ARG_INT(UART_ARGS, databits, AT_ARG_REQUIRED, 5, 8),
+    AT_ARG_INT(UART_ARGS, stopbits, AT_ARG_REQUIRED, 1, 3),
+    AT_ARG_INT(UART_ARGS, parity, AT_ARG_REQUIRED, 0, 2),
+    AT_ARG_INT(UART_ARGS, flow, AT_ARG_REQUIRED, 0, UART_FLOW_RTS | UART_FLOW_CTS),
+};
+
+/**
+ * @brief Parses the UART configuration.
+ *  Only 8 data bits, 1 stop bit and no parity are supported.
+ *
+ * @param <baudrate>,<databits>,<stopbits>,<parity>,<flow control>
+ */
+bool parse_uart_config(const char *value, unsigned long *baud, uint8_t *flow_control)
+{
+    UART_ARGS args = {};
+
+    if (!parse_command_args(value, uart_args, AT_ARG_COUNT(uart_args), &args))
+    {
+        return false;
+    }
+
+    if (args.databits != 8 || args.stopbits != 1 || args.parity != 0)
+    {
+        LogWarn("Only 8 data bits, 1 stop bit and no parity are supported.");
+        return false;
+    }
+
+    *baud = args.baud;
+    *flow_control = args.flow;
+
+    return true;
+}
+
+/**
+ * Gets the current UART configuration.
+ *
+ * @param AT+UART_CUR?
+ * @return +UART_CUR:<baudrate>,<databits>,<stopbits>,<parity>,<flow control>
+ */
+char get_uart_current(char *value)
+{
+    sprintf(value, "+UART_CUR:%lu,8,1,0,%d", Serial.baudRate(), uartFlowControl);
+
+    return AT_OK;
+}
+
+/**
+ * Sets the current UART configuration, not saved in flash.
+ *  OK is sent with the previous configuration, which is changed right after.
+ *
+ * @param AT+UART_CUR=<baudrate>,<databits>,<stopbits>,<parity>,<flow control>
+ */
+char set_uart_current(char *value)
+{
+    unsigned long baud;
+    uint8_t flow_control;
+
+    if (!parse_uart_config(value, &baud, &flow_control))
+    {
+        return AT_ERROR;
+    }
+
+    complete_at_command(AT_OK);
+    response_flush();
+    Serial.flush();
+
+    Serial.updateBaudRate(baud);
+    apply_uart_flow_control(flow_control);
+    uartFlowControl = flow_control;
+
+    return AT_PENDING;
+}
+
+/**
+ * Gets the UART configuration saved in flash.
+ *
+ * @param AT+UART_DEF?
+ * @return +UART_DEF:<baudrate>,<databits>,<stopbits>,<parity>,<flow control>
+ */
+char get_uart_default(char *value)
+{
+    sprintf(value, "+UART_DEF:%lu,8,1,0,%d", (unsigned long)settings.uart_baud, settings.uart_flow_control);
+
+    return AT_OK;
+}
+
+/**
+ * Sets the UART configuration, and saves it in flash.
+ *
+ * @param AT+UART_DEF=<baudrate>,<databits>,<stopbits>,<parity>,<flow control>
+ */
+char set_uart_default(char *value)
+{
+    unsigned long baud;
+    uint8_t flow_control;
+
+    if (!parse_uart_config(value, &baud, &flow_control))
+    {
+        return AT_ERROR;
+    }
+
+    settings.uart_baud = baud;
+    settings.uart_flow_control = flow_control;
+    save_settings();
+
+    return set_uart_current(value);
+}
+
+/**
+ * Gets the loop duration histogram.
+ *
+ * @param AT+LOOPSTAT?
+ * @return +LOOPSTAT:<loops>,<max_us>,<period_max_us>,<period_mean_us>
+ *         +LOOPSTAT:<bucket_us>,<count> for each bucket
+ */
+char get_loop_stats(char *value)
+{
+    unsigned long elapsed = millis() - loop_stats.reset_at;
+    unsigned long period_mean = loop_stats.loops > 0 ? (unsigned long)((uint64_t)elapsed * 1000 / loop_stats.loops) : 0;
+
+    response_printf("+LOOPSTAT:%lu,%lu,%lu,%lu\r\n", loop_stats.loops, loop_stats.max_us, loop_stats.period_max_us, period_mean);
+
+    for (int i = 0; i < LOOP_HISTOGRAM_BUCKETS; i++)
+    {
+        // The last bucket has no upper bound
+        response_printf("+LOOPSTAT:%lu,%lu\r\n", i < LOOP_HISTOGRAM_BUCKETS - 1 ? loop_histogram_bounds_us[i] : 0, loop_stats.histogram[i]);
+    }
+
+    return AT_OK;
+}
+
+/**
+ * Writes a log message to the UART, in order with the responses (text log mode).
+ */
+void write_log_message(uint8_t level, const char *message)
+{
+    response_printf("%c: %s\r\n", "-EWIDT"[level], message);
+}
+
+/**
+ * Gets the log configuration.
+ *
+ * @param AT+LOG?
+ * @return +LOG:<mode>,<level>,<records>,<dropped>
+ */
+char get_log_config(char *value)
+{
+    sprintf(value, "+LOG:%d,%d,%u,%lu", at_log_mode, at_log_level, at_log_records(), at_log_dropped());
+
+    return AT_OK;
+}
+
+typedef struct _log_config_args
+{
+    long mode;
+    long level;
+} LOG_CONFIG_ARGS;
+
+static const AT_ARG_SPEC log_config_args[] = {
+    AT_ARG_INT(LOG_CONFIG_ARGS, mode, AT_ARG_REQUIRED, AT_LOG_MODE_OFF, AT_LOG_MODE_DEFERRED),
+    AT_ARG_INT(LOG_CONFIG_ARGS, level, AT_ARG_OPTIONAL, AT_LOG_LEVEL_NONE, AT_LOG_LEVEL),
+};
+
+/**
+ * Sets the log mode and level. Levels above AT_LOG_LEVEL are not compiled in.
+ *
+ * @param AT+LOG=<mode>[,<level>]
+ */
+char set_log_config(char *value)
+{
+    LOG_CONFIG_ARGS args = {0, at_log_level};
+
+    if (!parse_command_args(value, log_config_args, AT_ARG_COUNT(log_config_args), &args))
+    {
+        return AT_ERROR;
+    }
+
+    at_log_mode = args.mode;
+    at_log_level = args.level;
+
+    return AT_OK;
+}
+
+/**
+ * Prints the deferred log records, oldest first, and empties the log.
+ *
+ * @param AT+LOG
+ * @return +LOG:<time_ms>,<level>,<message> for each record
+ */
+char read_log(char *value)
+{
+    char message[AT_LOG_LINE_SIZE];
+    unsigned long time_ms;
+    uint8_t level;
+
+    while (at_log_next(message, sizeof(message), &time_ms, &level))
+    {
+        response_printf("+LOG:%lu,%d,%s\r\n", time_ms, level, message);
+    }
+
+    at_log_clear();
+
+    return AT_OK;
+}
+
+void process_system_stats()
+{
+    uint32_t free = ESP.getFreeHeap();
+
+    if (free < heapMinFree)
+    {
+        heapMinFree = free;
+    }
+}
+
+/**
+ * Gets the runtime counters, then the counters of the links that had traffic.
+ *
+ * @param AT+SYSSTAT?
+ * @return +SYSSTAT:<name>,<value> for each counter
+ *         +SYSSTAT:LINK,<link ID>,<rx_bytes>,<tx_bytes>,<dropped_bytes>,<buffer_full>
+ */
+char get_system_stats(char *value)
+{
+    for (int i = 0; i < COUNTER_COUNT; i++)
+    {
+        response_printf("+SYSSTAT:%s,%lu\r\n", counter_names[i], (unsigned long)counters[i]);
+    }
+
+    response_printf("+SYSSTAT:uptime_ms,%lu\r\n", millis());
+
+    for (int i = 0; i < COUNTERS_LINKS; i++)
+    {
+        LINK_COUNTERS *link = &link_counters[i];
+
+        if (link->rx_bytes == 0 && link->tx_bytes == 0 && link->dropped_bytes == 0 && link->buffer_full == 0)
+        {
+            continue;
+        }
+
+        response_printf("+SYSSTAT:LINK,%d,%lu,%lu,%lu,%lu\r\n", i, (unsigned long)link->rx_bytes, (unsigned long)link->tx_bytes, (unsigned long)link->dropped_bytes, (unsigned long)link->buffer_full);
+    }
+
+    return AT_OK;
+}
+
+/**
+ * Resets the runtime counters and the minimum free heap.
+ *
+ * @param AT+SYSSTAT
+ */
+char reset_system_stats(char *value)
+{
+    counters_reset();
+    heapMinFree = UINT32_MAX;
+    process_system_stats();
+
+    return AT_OK;
+}
+
+/**
+ * Gets the heap usage.
+ *
+ * @param AT+SYSRAM?
+ * @return +SYSRAM:<free>,<min_free>,<max_block>,<fragmentation>
+ */
+char get_system_ram(char *value)
+{
+    process_system_stats();
+
+    sprintf(value, "+SYSRAM:%lu,%lu,%lu,%d", (unsigned long)ESP.getFreeHeap(), (unsigned long)heapMinFree, (unsigned long)ESP.getMaxFreeBlockSize(), ESP.getHeapFragmentation());
+
+    return AT_OK;
+}
+
+/**
+ * Gets the execution time of the command handlers, for the commands called since the last reset.
+ *
+ * @param AT+CMDPROF?
+ * @return +CMDPROF:<command>,<calls>,<min_us>,<avg_us>,<max_us>,<count>,...,<count>
+ */
+char get_command_profiles(char *value)
+{
+    for (int i = 0; i < at_registered_commands_count; i++)
+    {
+        AT_COMMAND_PROFILE *profile = &at_command_profiles[i];
+
+        if (profile->calls == 0)
+        {
+            continue;
+        }
+
+        response_printf("+CMDPROF:%s,%lu,%lu,%lu,%lu", at_registered_commands[i].name, profile->calls, profile->min_us, (unsigned long)(profile->total_us / profile->calls), profile->max_us);
+
+        for (int bucket = 0; bucket < AT_PROFILE_BUCKETS; bucket++)
         {
-            AT_COMMAND current = at_registered_commands[i];
-
-            Serial.print("+CMD:");
-            Serial.print(i);
-            Serial.print(",");
-            Serial.print((const char*)current.name);
-            Serial.print(",");
-            Serial.print(current.test != NULL ? "1" : "0");
-            Serial.print(",");
-            Serial.print(current.getter != NULL ? "1" : "0");
-            Serial.print(",");
-            Serial.print(current.setter != NULL ? "1" : "0");
-            Serial.print(",");
-            Serial.print(current.execute != NULL ? "1" : "0");
-            Serial.println();
+            response_printf(",%lu", profile->histogram[bucket]);
         }
+
+        response_println("");
+    }
+
+    return AT_OK;
+}
+
+/**
+ * Resets the execution time of the command handlers.
+ *
+ * @param AT+CMDPROF
+ */
+char reset_command_profiles(char *value)
+{
+    at_reset_profiles();
+
+    return AT_OK;
+}
+
+/**
+ * Gets the batch configuration.
+ *
+ * @param AT+BATCHCFG?
+ * @return +BATCHCFG:<stop_on_error>
+ */
+char get_batch_config(char *value)
+{
+    sprintf(value, "+BATCHCFG:%d", batch_stop_on_error);
+
+    return AT_OK;
+}
+
+typedef struct _batch_config_args
+{
+    long stop_on_error;
+} BATCH_CONFIG_ARGS;
+
+static const AT_ARG_SPEC batch_config_args[] = {
+    AT_ARG_INT(BATCH_CONFIG_ARGS, stop_on_error, AT_ARG_REQUIRED, 0, 1),
+};
+
+/**
+ * Sets whether a batch stops at the first command that fails.
+ *
+ * @param AT+BATCHCFG=<stop_on_error>
+ */
+char set_batch_config(char *value)
+{
+    BATCH_CONFIG_ARGS args = {};
+
+    if (!parse_command_args(value, batch_config_args, AT_ARG_COUNT(batch_config_args), &args))
+    {
+        return AT_ERROR;
     }
 
+    batch_stop_on_error = args.stop_on_error;
+
     return AT_OK;
 }
 
-void register_basic_commands()
+/**
+ * Resets the loop duration histogram.
+ *
+ * @param AT+LOOPSTAT
+ */
+char reset_loop_stats(char *value)
 {
-    at_register_command("RST", 0, 0, 0, (at_callback)reset);
-    at_register_command("GMR", 0, 0, 0, (at_callback)check_version_information);
-    at_register_command("CMD", (at_callback)list_all_commands, 0, 0, 0);
+    scheduler_reset_stats();
+
+    return AT_OK;
+}
+
+bool register_basic_commands()
+{
+    at_log_set_writer(write_log_message);
+
+    bool registered = true;
+
+    registered &= at_register_command("RST", 0, 0, 0, (at_callback)reset) == AT_OK;
+    registered &= at_register_command("GMR", 0, 0, 0, (at_callback)check_version_information) == AT_OK;
+    registered &= at_register_command("CMD", (at_callback)list_all_commands, 0, 0, 0) == AT_OK;
+    registered &= at_register_command("UART_CUR", (at_callback)get_uart_current, (at_callback)set_uart_current, 0, 0) == AT_OK;
+    registered &= at_register_command("UART_DEF", (at_callback)get_uart_default, (at_callback)set_uart_default, 0, 0) == AT_OK;
+    registered &= at_register_command("LOOPSTAT", (at_callback)get_loop_stats, 0, 0, (at_callback)reset_loop_stats) == AT_OK;
+    registered &= at_register_command("LOG", (at_callback)get_log_config, (at_callback)set_log_config, 0, (at_callback)read_log) == AT_OK;
+    registered &= at_register_command("SYSSTAT", (at_callback)get_system_stats, 0, 0, (at_callback)reset_system_stats) == AT_OK;
+    registered &= at_register_command("SYSRAM", (at_callback)get_system_ram, 0, 0, 0) == AT_OK;
+    registered &= at_register_command("CMDPROF", (at_callback)get_command_profiles, 0, 0, (at_callback)reset_command_profiles) == AT_OK;
+    registered &= at_register_command("BATCHCFG", (at_callback)get_batch_config, (at_callback)set_batch_config, 0, 0) == AT_OK;
+
+    return registered;
 }
@@ -7,7 +7,17 @@
 extern "C"{
 #endif
 
-void register_basic_commands();
+/**
+ * @brief Starts UART0 with the larger RX buffer, and the given flow control (RTS: 1, CTS: 2).
+ */
+void begin_uart(unsigned long baud, uint8_t flow_control);
+
+/**
+ * @brief Samples the free heap, for the minimum reported by AT+SYSRAM.
+ */
+void process_system_stats();
+
+bool register_basic_commands();
 
 #ifdef __cplusplus
 } // extern "C"
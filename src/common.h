@@ -2,6 +2,11 @@
 #define FIRMWARE_VERSION "0.0.1"
 #define AT_VERSION "1.0.0"
 
-#ifndef AT_COMMANDS_NUM
-#define AT_COMMANDS_NUM 3
+#ifndef UART_DEFAULT_BAUD
+#define UART_DEFAULT_BAUD 115200
+#endif
+
+// Large enough to absorb ~40ms of input at 921600 bauds while Wi-Fi is serviced
+#ifndef UART_RX_BUFFER_SIZE
+#define UART_RX_BUFFER_SIZE 4096
 #endif
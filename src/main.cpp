@@ -3,21 +3,78 @@
 
 #include "at_parser.h"
 #include "at_command_process.h"
-#include "logging.h"
+#include "at_log.h"
+#include "settings.h"
+#include "scheduler.h"
+#include "response.h"
 
 #include "basic_commands.h"
 #include "wifi_commands.h"
 #include "tcp_ip_commands.h"
+#include "mqtt_commands.h"
+#include "sleep_commands.h"
+
+// Period of the free heap sampling (AT+SYSRAM)
+#define SYSTEM_STATS_INTERVAL_MS 100
+
+char tcp_server_task(void *context)
+{
+  process_tcp_server();
+  return TASK_CONTINUE;
+}
+
+char mqtt_task(void *context)
+{
+  process_mqtt();
+  return TASK_CONTINUE;
+}
+
+char at_commands_task(void *context)
+{
+  process_at_commands();
+  return TASK_CONTINUE;
+}
+
+char response_task(void *context)
+{
+  process_response();
+  return TASK_CONTINUE;
+}
+
+char system_stats_task(void *context)
+{
+  process_system_stats();
+  return TASK_CONTINUE;
+}
 
 void setup()
 {
-  Serial.begin(115200);
+  load_settings();
+  begin_uart(settings.uart_baud, settings.uart_flow_control);
 
-  register_basic_commands();
-  register_wifi_commands();
-  register_tcp_ip_commands();
+  bool registered = register_basic_commands();
+  registered &= register_wifi_commands();
+  registered &= register_tcp_ip_commands();
+  registered &= register_mqtt_commands();
+  registered &= register_sleep_commands();
 
-  Serial.println();
+  // The command table is full or two names collide: the failed commands are logged by at_register_command
+  if (!registered)
+  {
+    LogErr("Some AT commands could not be registered.");
+  }
+
+  restore_wifi_settings();
+  restore_tcp_ip_settings();
+  restore_sleep_state();
+
+  scheduler_add(tcp_server_task, NULL, 0);
+  scheduler_add(mqtt_task, NULL, 0);
+  scheduler_add(at_commands_task, NULL, 0);
+  scheduler_add(response_task, NULL, 0);
+  scheduler_add(system_stats_task, NULL, SYSTEM_STATS_INTERVAL_MS);
+
+  response_println("");
 
   LogInfo("ESP8266 AT - WIFI / TCP/IP / MQTT");
   LogInfo("This firmware is licensed under the MIT license");
@@ -29,6 +86,5 @@ void setup()
 
 void loop()
 {
-  process_tcp_server();
-  process_at_commands();
+  scheduler_run();
 }
\ No newline at end of file
@@ -0,0 +1,1037 @@
+#include <Arduino.h>
+#include "at_log.h"
+
+#include "mqtt_client.h"
+#include "ssl_client.h"
+#include "net_connect.h"
+
+#include <ESP8266WiFi.h>
+
+// MQTT 3.1.1 control packet types (first byte of the fixed header)
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH 0x30
+#define MQTT_PUBACK 0x40
+#define MQTT_PUBREC 0x50
+#define MQTT_PUBREL 0x62
+#define MQTT_PUBCOMP 0x70
+#define MQTT_SUBSCRIBE 0x82
+#define MQTT_SUBACK 0x90
+#define MQTT_UNSUBSCRIBE 0xA2
+#define MQTT_UNSUBACK 0xB0
+#define MQTT_PINGREQ 0xC0
+#define MQTT_PINGRESP 0xD0
+#define MQTT_DISCONNECT 0xE0
+
+#define MQTT_PUBLISH_DUP 0x08
+
+#define MQTT_PROTOCOL_LEVEL 4
+
+// CONNACK return code of a broker that can not take the connection for now: the client keeps retrying
+#define MQTT_CONNACK_SERVER_UNAVAILABLE 3
+
+#define MQTT_CONNECT_TIMEOUT_MS 10000
+#define MQTT_OPEN_TIMEOUT_MS 5000
+#define MQTT_RECONNECT_INTERVAL_MS 5000
+#define MQTT_RETRANSMIT_INTERVAL_MS 5000
+#define MQTT_MAX_RETRANSMITS 5
+
+// Connection opened by mqtt_connect, in progress until the CONNECT packet is sent
+#define MQTT_OPEN_IDLE 0
+#define MQTT_OPEN_CONNECTING 1
+
+#define INFLIGHT_FREE 0
+#define INFLIGHT_AWAIT_PUBACK 1
+#define INFLIGHT_AWAIT_PUBREC 2
+#define INFLIGHT_AWAIT_PUBCOMP 3
+
+// Large enough for a CONNECT packet with all its fields at their maximum length
+#define MQTT_TX_BUFFER_SIZE 640
+
+// QoS 2 messages received and not released yet (PUBREL) whose duplicates can be detected
+#define MQTT_MAX_RECEIVED_QOS2 8
+
+MQTT_CONFIG mqttConfig = {"", "", "", 120, true, "", "", 0, false, "", 1883, false, MQTT_SCHEME_TCP};
+int mqttState = MQTT_STATE_UNINITIALIZED;
+MQTT_SUBSCRIPTION mqttSubscriptions[MQTT_MAX_SUBSCRIPTIONS] = {};
+MQTT_STATS mqttStats = {};
+
+/**
+ * @brief QoS 1/2 message awaiting acknowledgment.
+ *  The topic and the payload are kept in data, so the message can be retransmitted.
+ */
+typedef struct _mqtt_inflight
+{
+    uint8_t state;
+    uint8_t flags;
+    uint8_t retransmits;
+    uint16_t packet_id;
+    uint16_t topic_len;
+    uint16_t payload_len;
+    unsigned long first_sent_at;
+    unsigned long sent_at;
+    uint8_t data[MQTT_INFLIGHT_DATA_SIZE];
+} MQTT_INFLIGHT;
+
+MQTT_INFLIGHT mqttInflight[MQTT_MAX_INFLIGHT] = {};
+
+/**
+ * @brief Packet identifiers of the QoS 2 messages received, until released by PUBREL (0: free).
+ *  A PUBLISH sent again by the broker before PUBREL is acknowledged but not delivered twice.
+ */
+uint16_t mqttReceivedQos2[MQTT_MAX_RECEIVED_QOS2] = {};
+
+/**
+ * @brief Client of the connection, depending on the scheme. The TLS client keeps its
+ *  session with the broker: reconnections resume it.
+ */
+WiFiClient mqttTcpClient;
+BearSSL::WiFiClientSecure mqttTlsClient;
+WiFiClient *mqttClient = &mqttTcpClient;
+
+uint8_t MQTT_TX_BUFFER[MQTT_TX_BUFFER_SIZE];
+uint8_t MQTT_RX_BUFFER[MQTT_RX_BUFFER_SIZE];
+
+mqtt_event_callback mqttOnEvent = nullptr;
+mqtt_message_callback mqttOnMessage = nullptr;
+
+uint16_t mqttNextPacketId = 1;
+unsigned long mqttLastSent = 0;
+unsigned long mqttLastReceived = 0;
+unsigned long mqttConnectStarted = 0;
+bool mqttPingPending = false;
+
+uint8_t mqttOpenStep = MQTT_OPEN_IDLE;
+NET_CONNECT mqttOpen;
+
+/**
+ * @brief State of the packet being received.
+ */
+struct
+{
+    uint8_t header;
+    uint32_t remaining;
+    uint8_t length_bytes;
+    bool length_complete;
+    uint32_t received;
+} mqttIncoming;
+
+void mqtt_set_callbacks(mqtt_event_callback on_event, mqtt_message_callback on_message)
+{
+    mqttOnEvent = on_event;
+    mqttOnMessage = on_message;
+}
+
+void mqtt_raise(int event, uint16_t packet_id)
+{
+    if (mqttOnEvent != nullptr)
+    {
+        mqttOnEvent(event, packet_id);
+    }
+}
+
+MQTT_INFLIGHT *mqtt_find_inflight(uint16_t packet_id);
+
+uint16_t mqtt_next_packet_id()
+{
+    uint16_t id;
+
+    // Skips the identifiers still used by in-flight messages
+    do
+    {
+        id = mqttNextPacketId++;
+
+        if (mqttNextPacketId == 0)
+        {
+            mqttNextPacketId = 1;
+        }
+    } while (mqtt_find_inflight(id) != nullptr);
+
+    return id;
+}
+
+/**
+ * @brief Writes the fixed header (type and remaining length) in buffer.
+ *
+ * @return the length of the fixed header.
+ */
+size_t mqtt_write_fixed_header(uint8_t *buffer, uint8_t type, uint32_t remaining)
+{
+    size_t len = 0;
+
+    buffer[len++] = type;
+
+    do
+    {
+        uint8_t digit = remaining % 128;
+        remaining /= 128;
+
+        if (remaining > 0)
+        {
+            digit |= 0x80;
+        }
+
+        buffer[len++] = digit;
+    } while (remaining > 0);
+
+    return len;
+}
+
+size_t mqtt_write_string(uint8_t *buffer, const char *str)
+{
+    size_t len = strlen(str);
+
+    buffer[0] = len >> 8;
+    buffer[1] = len & 0xFF;
+    memcpy(buffer + 2, str, len);
+
+    return len + 2;
+}
+
+bool mqtt_send(const uint8_t *buffer, size_t len)
+{
+    if (mqttClient->write(buffer, len) != len)
+    {
+        LogErr("Failed to send %u bytes to the MQTT broker.", (unsigned int)len);
+        return false;
+    }
+
+    mqttLastSent = millis();
+    return true;
+}
+
+/**
+ * @brief Sends a packet made of its fixed header and a packet identifier (PUBACK, PUBREC, PUBREL, PUBCOMP).
+ */
+bool mqtt_send_ack(uint8_t type, uint16_t packet_id)
+{
+    uint8_t packet[4] = {type, 2, (uint8_t)(packet_id >> 8), (uint8_t)(packet_id & 0xFF)};
+
+    return mqtt_send(packet, sizeof(packet));
+}
+
+/**
+ * @brief Closes the connection to the broker. The TLS client gives its receive buffer back.
+ */
+void mqtt_close()
+{
+    net_connect_abort(&mqttOpen);
+
+    if (mqttClient == &mqttTlsClient)
+    {
+        ssl_stop(&mqttTlsClient);
+    }
+    else
+    {
+        mqttClient->stop();
+    }
+}
+
+void mqtt_connection_lost()
+{
+    LogWarn("MQTT connection lost.");
+
+    mqtt_close();
+    mqttState = MQTT_STATE_DISCONNECTED;
+    mqttConnectStarted = millis();
+
+    mqtt_raise(MQTT_EVENT_DISCONNECTED, 0);
+}
+
+/**
+ * @brief Closes the connection being opened, and allows the reconnection after the interval.
+ */
+void mqtt_open_failed()
+{
+    LogErr("Unable to open the connection to %s:%d.", mqttConfig.host, mqttConfig.port);
+
+    mqtt_close();
+    mqttOpenStep = MQTT_OPEN_IDLE;
+    mqttState = MQTT_STATE_DISCONNECTED;
+    mqttConnectStarted = millis();
+
+    mqtt_raise(MQTT_EVENT_CONNECT_FAILED, 0);
+}
+
+void mqtt_connect()
+{
+    net_connect_abort(&mqttOpen);
+
+    mqttClient = mqttConfig.scheme == MQTT_SCHEME_TLS ? &mqttTlsClient : &mqttTcpClient;
+    mqttOpenStep = MQTT_OPEN_CONNECTING;
+    mqttState = MQTT_STATE_CONNECTING;
+    mqttConnectStarted = millis();
+}
+
+/**
+ * @brief Sends the CONNECT packet on the connection just opened.
+ */
+bool mqtt_send_connect()
+{
+    mqttClient->setNoDelay(true);
+
+    uint8_t flags = mqttConfig.clean_session ? 0x02 : 0x00;
+    uint32_t remaining = 10 + 2 + strlen(mqttConfig.client_id);
+
+    if (mqttConfig.lwt_topic[0] != 0)
+    {
+        flags |= 0x04 | (mqttConfig.lwt_qos << 3) | (mqttConfig.lwt_retain ? 0x20 : 0x00);
+        remaining += 2 + strlen(mqttConfig.lwt_topic) + 2 + strlen(mqttConfig.lwt_message);
+    }
+
+    if (mqttConfig.username[0] != 0)
+    {
+        flags |= 0x80;
+        remaining += 2 + strlen(mqttConfig.username);
+    }
+
+    if (mqttConfig.password[0] != 0)
+    {
+        flags |= 0x40;
+        remaining += 2 + strlen(mqttConfig.password);
+    }
+
+    uint8_t *packet = MQTT_TX_BUFFER;
+    size_t len = mqtt_write_fixed_header(packet, MQTT_CONNECT, remaining);
+
+    len += mqtt_write_string(packet + len, "MQTT");
+    packet[len++] = MQTT_PROTOCOL_LEVEL;
+    packet[len++] = flags;
+    packet[len++] = mqttConfig.keepalive >> 8;
+    packet[len++] = mqttConfig.keepalive & 0xFF;
+    len += mqtt_write_string(packet + len, mqttConfig.client_id);
+
+    if (flags & 0x04)
+    {
+        len += mqtt_write_string(packet + len, mqttConfig.lwt_topic);
+        len += mqtt_write_string(packet + len, mqttConfig.lwt_message);
+    }
+
+    if (flags & 0x80)
+    {
+        len += mqtt_write_string(packet + len, mqttConfig.username);
+    }
+
+    if (flags & 0x40)
+    {
+        len += mqtt_write_string(packet + len, mqttConfig.password);
+    }
+
+    memset(&mqttIncoming, 0, sizeof(mqttIncoming));
+    mqttPingPending = false;
+
+    // The broker does not send again the QoS 2 messages of a previous session once it is cleaned
+    if (mqttConfig.clean_session)
+    {
+        memset(mqttReceivedQos2, 0, sizeof(mqttReceivedQos2));
+    }
+
+    if (!mqtt_send(packet, len))
+    {
+        return false;
+    }
+
+    mqttConnectStarted = millis();
+    mqttLastReceived = millis();
+
+    return true;
+}
+
+/**
+ * @brief Opens the connection started by mqtt_connect, then sends the CONNECT packet. The name
+ *  resolution and the TCP handshake run in the background, each one for up to MQTT_OPEN_TIMEOUT_MS,
+ *  and the CONNACK is awaited without blocking. The TLS handshake is one blocking step:
+ *  BearSSL::WiFiClientSecure only handshakes on a connection it opens itself.
+ */
+void mqtt_open()
+{
+    if (mqttOpen.step == NET_CONNECT_IDLE)
+    {
+        net_connect_start(&mqttOpen, mqttConfig.host, mqttConfig.port, mqttClient == &mqttTcpClient, MQTT_OPEN_TIMEOUT_MS);
+    }
+
+    uint8_t step = net_connect_poll(&mqttOpen, &mqttTcpClient);
+    bool connected = false;
+
+    if (step == NET_CONNECT_RESOLVED)
+    {
+        // Connected by name, resolved from the DNS cache: the name is sent to the broker (SNI)
+        mqttTlsClient.setTimeout(MQTT_OPEN_TIMEOUT_MS);
+        connected = ssl_connect(&mqttTlsClient, &ssl_default_config, mqttConfig.host, mqttConfig.port);
+    }
+    else if (step == NET_CONNECT_OPEN)
+    {
+        connected = true;
+    }
+    else if (step != NET_CONNECT_FAILED)
+    {
+        return;
+    }
+
+    mqttOpen.step = NET_CONNECT_IDLE;
+
+    if (!connected || !mqtt_send_connect())
+    {
+        mqtt_open_failed();
+        return;
+    }
+
+    mqttOpenStep = MQTT_OPEN_IDLE;
+}
+
+void mqtt_disconnect()
+{
+    if (mqttClient->connected())
+    {
+        uint8_t packet[2] = {MQTT_DISCONNECT, 0};
+        mqtt_send(packet, sizeof(packet));
+    }
+
+    mqtt_close();
+    mqttOpenStep = MQTT_OPEN_IDLE;
+    memset(mqttSubscriptions, 0, sizeof(mqttSubscriptions));
+    memset(mqttReceivedQos2, 0, sizeof(mqttReceivedQos2));
+
+    for (int i = 0; i < MQTT_MAX_INFLIGHT; i++)
+    {
+        mqttInflight[i].state = INFLIGHT_FREE;
+    }
+
+    mqttStats.inflight = 0;
+
+    if (mqttState >= MQTT_STATE_DISCONNECTED)
+    {
+        mqttState = MQTT_STATE_DISCONNECTED;
+    }
+}
+
+/**
+ * @brief Finds the in-flight message with the given packet identifier.
+ */
+MQTT_INFLIGHT *mqtt_find_inflight(uint16_t packet_id)
+{
+    for (int i = 0; i < MQTT_MAX_INFLIGHT; i++)
+    {
+        if (mqttInflight[i].state != INFLIGHT_FREE && mqttInflight[i].packet_id == packet_id)
+        {
+            return &mqttInflight[i];
+        }
+    }
+
+    return nullptr;
+}
+
+void mqtt_release_inflight(MQTT_INFLIGHT *message)
+{
+    message->state = INFLIGHT_FREE;
+    mqttStats.inflight--;
+}
+
+/**
+ * @brief Sends the PUBLISH packet of a message, the payload being sent from its buffer without being copied.
+ */
+bool mqtt_send_publish(const char *topic, size_t topic_len, const uint8_t *payload, size_t len, uint8_t flags, uint16_t packet_id)
+{
+    uint8_t qos = (flags >> 1) & 0x03;
+    uint32_t remaining = 2 + topic_len + (qos > 0 ? 2 : 0) + len;
+    uint8_t *header = MQTT_TX_BUFFER;
+    size_t header_len = mqtt_write_fixed_header(header, MQTT_PUBLISH | flags, remaining);
+
+    header[header_len++] = topic_len >> 8;
+    header[header_len++] = topic_len & 0xFF;
+    memcpy(header + header_len, topic, topic_len);
+    header_len += topic_len;
+
+    if (qos > 0)
+    {
+        header[header_len++] = packet_id >> 8;
+        header[header_len++] = packet_id & 0xFF;
+    }
+
+    return mqtt_send(header, header_len) && (len == 0 || mqtt_send(payload, len));
+}
+
+/**
+ * @brief Sends again an in-flight message: PUBLISH with the DUP flag, or PUBREL once PUBREC was received.
+ */
+void mqtt_retransmit(MQTT_INFLIGHT *message)
+{
+    message->sent_at = millis();
+    message->retransmits++;
+    mqttStats.retransmits++;
+
+    if (message->state == INFLIGHT_AWAIT_PUBCOMP)
+    {
+        mqtt_send_ack(MQTT_PUBREL, message->packet_id);
+        return;
+    }
+
+    mqtt_send_publish((const char *)message->data, message->topic_len,
+                      message->data + message->topic_len, message->payload_len,
+                      message->flags | MQTT_PUBLISH_DUP, message->packet_id);
+}
+
+/**
+ * @brief Handles the acknowledgment of an in-flight message (PUBACK, PUBREC or PUBCOMP).
+ */
+void mqtt_acknowledge_inflight(uint8_t type, uint16_t packet_id)
+{
+    MQTT_INFLIGHT *message = mqtt_find_inflight(packet_id);
+
+    if (type == MQTT_PUBREC)
+    {
+        // PUBREL is also sent when the message is unknown, so that the broker releases it
+        if (message != nullptr && message->state == INFLIGHT_AWAIT_PUBREC)
+        {
+            message->state = INFLIGHT_AWAIT_PUBCOMP;
+            message->sent_at = millis();
+        }
+
+        mqtt_send_ack(MQTT_PUBREL, packet_id);
+        return;
+    }
+
+    if (message == nullptr || message->state != (type == MQTT_PUBACK ? INFLIGHT_AWAIT_PUBACK : INFLIGHT_AWAIT_PUBCOMP))
+    {
+        LogWarn("Unexpected acknowledgment 0x%02X for packet %d.", type, packet_id);
+        return;
+    }
+
+    unsigned long latency = millis() - message->first_sent_at;
+
+    mqttStats.acknowledged++;
+    mqttStats.ack_latency_total_ms += latency;
+
+    if (latency > mqttStats.ack_latency_max_ms)
+    {
+        mqttStats.ack_latency_max_ms = latency;
+    }
+
+    mqtt_release_inflight(message);
+    mqtt_raise(MQTT_EVENT_PUBLISHED, packet_id);
+}
+
+/**
+ * @brief Retransmits the in-flight messages not acknowledged in time, and drops those retransmitted too many times.
+ */
+void mqtt_process_inflight()
+{
+    for (int i = 0; i < MQTT_MAX_INFLIGHT; i++)
+    {
+        MQTT_INFLIGHT *message = &mqttInflight[i];
+
+        if (message->state == INFLIGHT_FREE || millis() - message->sent_at < MQTT_RETRANSMIT_INTERVAL_MS)
+        {
+            continue;
+        }
+
+        if (message->retransmits >= MQTT_MAX_RETRANSMITS)
+        {
+            LogErr("Message %d not acknowledged after %d retransmissions, dropped.", message->packet_id, message->retransmits);
+            mqttStats.failed++;
+            mqtt_release_inflight(message);
+            mqtt_raise(MQTT_EVENT_PUBLISH_FAILED, message->packet_id);
+            continue;
+        }
+
+        mqtt_retransmit(message);
+    }
+}
+
+bool mqtt_publish(const char *topic, const uint8_t *payload, size_t len, uint8_t qos, bool retain, uint16_t *packet_id)
+{
+    if (mqttState != MQTT_STATE_CONNECTED)
+    {
+        return false;
+    }
+
+    size_t topic_len = strlen(topic);
+    uint8_t flags = (qos << 1) | (retain ? 1 : 0);
+
+    *packet_id = 0;
+
+    if (qos == 0)
+    {
+        // The payload is sent from the caller's buffer, without being copied
+        return mqtt_send_publish(topic, topic_len, payload, len, flags, 0);
+    }
+
+    if (topic_len + len > MQTT_INFLIGHT_DATA_SIZE)
+    {
+        LogWarn("QoS %d messages are limited to %d bytes (topic and payload).", qos, MQTT_INFLIGHT_DATA_SIZE);
+        return false;
+    }
+
+    MQTT_INFLIGHT *message = nullptr;
+
+    for (int i = 0; i < MQTT_MAX_INFLIGHT && message == nullptr; i++)
+    {
+        if (mqttInflight[i].state == INFLIGHT_FREE)
+        {
+            message = &mqttInflight[i];
+        }
+    }
+
+    if (message == nullptr)
+    {
+        LogWarn("Publish window full (%d messages in flight).", MQTT_MAX_INFLIGHT);
+        return false;
+    }
+
+    *packet_id = mqtt_next_packet_id();
+
+    memcpy(message->data, topic, topic_len);
+    memcpy(message->data + topic_len, payload, len);
+    message->topic_len = topic_len;
+    message->payload_len = len;
+    message->flags = flags;
+    message->packet_id = *packet_id;
+    message->retransmits = 0;
+    message->state = qos == 1 ? INFLIGHT_AWAIT_PUBACK : INFLIGHT_AWAIT_PUBREC;
+    message->first_sent_at = message->sent_at = millis();
+
+    if (++mqttStats.inflight > mqttStats.inflight_peak)
+    {
+        mqttStats.inflight_peak = mqttStats.inflight;
+    }
+
+    // Once stored, the message is delivered by the retransmissions even if this send fails
+    mqtt_send_publish(topic, topic_len, payload, len, flags, *packet_id);
+
+    return true;
+}
+
+/**
+ * @brief Sends a SUBSCRIBE packet, without registering the subscription.
+ */
+bool mqtt_send_subscribe(const char *topic, uint8_t qos, uint16_t packet_id)
+{
+    uint8_t *packet = MQTT_TX_BUFFER;
+    size_t len = mqtt_write_fixed_header(packet, MQTT_SUBSCRIBE, 2 + 2 + strlen(topic) + 1);
+
+    packet[len++] = packet_id >> 8;
+    packet[len++] = packet_id & 0xFF;
+    len += mqtt_write_string(packet + len, topic);
+    packet[len++] = qos;
+
+    return mqtt_send(packet, len);
+}
+
+bool mqtt_subscribe(const char *topic, uint8_t qos, uint16_t *packet_id)
+{
+    MQTT_SUBSCRIPTION *free_slot = nullptr;
+
+    if (mqttState != MQTT_STATE_CONNECTED || strlen(topic) > MQTT_MAX_TOPIC_LENGTH)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < MQTT_MAX_SUBSCRIPTIONS; i++)
+    {
+        if (strcmp(mqttSubscriptions[i].topic, topic) == 0)
+        {
+            free_slot = &mqttSubscriptions[i];
+            break;
+        }
+
+        if (free_slot == nullptr && mqttSubscriptions[i].topic[0] == 0)
+        {
+            free_slot = &mqttSubscriptions[i];
+        }
+    }
+
+    if (free_slot == nullptr)
+    {
+        LogWarn("No more than %d subscriptions are supported.", MQTT_MAX_SUBSCRIPTIONS);
+        return false;
+    }
+
+    *packet_id = mqtt_next_packet_id();
+
+    if (!mqtt_send_subscribe(topic, qos, *packet_id))
+    {
+        return false;
+    }
+
+    strcpy(free_slot->topic, topic);
+    free_slot->qos = qos;
+
+    return true;
+}
+
+bool mqtt_unsubscribe(const char *topic, uint16_t *packet_id)
+{
+    if (mqttState != MQTT_STATE_CONNECTED)
+    {
+        return false;
+    }
+
+    uint8_t *packet = MQTT_TX_BUFFER;
+    size_t len = mqtt_write_fixed_header(packet, MQTT_UNSUBSCRIBE, 2 + 2 + strlen(topic));
+
+    *packet_id = mqtt_next_packet_id();
+    packet[len++] = *packet_id >> 8;
+    packet[len++] = *packet_id & 0xFF;
+    len += mqtt_write_string(packet + len, topic);
+
+    if (!mqtt_send(packet, len))
+    {
+        return false;
+    }
+
+    for (int i = 0; i < MQTT_MAX_SUBSCRIPTIONS; i++)
+    {
+        if (strcmp(mqttSubscriptions[i].topic, topic) == 0)
+        {
+            mqttSubscriptions[i].topic[0] = 0;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Records the packet identifier of a QoS 2 message received.
+ *
+ * @return false if the message was already received, and not released yet.
+ */
+bool mqtt_receive_qos2(uint16_t packet_id)
+{
+    uint16_t *free = nullptr;
+
+    for (int i = 0; i < MQTT_MAX_RECEIVED_QOS2; i++)
+    {
+        if (mqttReceivedQos2[i] == packet_id)
+        {
+            return false;
+        }
+
+        if (mqttReceivedQos2[i] == 0 && free == nullptr)
+        {
+            free = &mqttReceivedQos2[i];
+        }
+    }
+
+    if (free == nullptr)
+    {
+        LogWarn("Too many QoS 2 messages awaiting PUBREL, a duplicate of message %d would be delivered.", packet_id);
+        return true;
+    }
+
+    *free = packet_id;
+    return true;
+}
+
+void mqtt_release_qos2(uint16_t packet_id)
+{
+    for (int i = 0; i < MQTT_MAX_RECEIVED_QOS2; i++)
+    {
+        if (mqttReceivedQos2[i] == packet_id)
+        {
+            mqttReceivedQos2[i] = 0;
+        }
+    }
+}
+
+/**
+ * @brief Handles an incoming PUBLISH packet held in MQTT_RX_BUFFER.
+ *  A QoS 2 message is delivered once: its retransmissions are only acknowledged.
+ */
+void mqtt_handle_publish(uint8_t header, uint32_t len)
+{
+    uint8_t qos = (header >> 1) & 0x03;
+    uint16_t topic_len = (MQTT_RX_BUFFER[0] << 8) | MQTT_RX_BUFFER[1];
+    uint32_t offset = 2 + topic_len;
+    uint16_t packet_id = 0;
+
+    if (offset + (qos > 0 ? 2 : 0) > len || topic_len > MQTT_MAX_TOPIC_LENGTH)
+    {
+        LogErr("Malformed PUBLISH packet.");
+        return;
+    }
+
+    char topic[MQTT_MAX_TOPIC_LENGTH + 1];
+    memcpy(topic, MQTT_RX_BUFFER + 2, topic_len);
+    topic[topic_len] = 0;
+
+    if (qos > 0)
+    {
+        packet_id = (MQTT_RX_BUFFER[offset] << 8) | MQTT_RX_BUFFER[offset + 1];
+        offset += 2;
+    }
+
+    if (qos == 2 && !mqtt_receive_qos2(packet_id))
+    {
+        LogDebug("Duplicate of the QoS 2 message %d dropped.", packet_id);
+    }
+    else if (mqttOnMessage != nullptr)
+    {
+        mqttOnMessage(topic, MQTT_RX_BUFFER + offset, len - offset);
+    }
+
+    if (qos == 1)
+    {
+        mqtt_send_ack(MQTT_PUBACK, packet_id);
+    }
+    else if (qos == 2)
+    {
+        mqtt_send_ack(MQTT_PUBREC, packet_id);
+    }
+}
+
+/**
+ * @brief Acknowledges a PUBLISH larger than MQTT_RX_BUFFER_SIZE, from its head kept in the buffer.
+ *  The message is not delivered, but the broker does not send it again.
+ */
+void mqtt_drop_publish(uint8_t header)
+{
+    uint8_t qos = (header >> 1) & 0x03;
+    uint32_t offset = 2 + ((MQTT_RX_BUFFER[0] << 8) | MQTT_RX_BUFFER[1]);
+
+    if ((header & 0xF0) != MQTT_PUBLISH || qos == 0)
+    {
+        return;
+    }
+
+    if (offset + 2 > MQTT_RX_BUFFER_SIZE)
+    {
+        LogErr("Topic too long to acknowledge the PUBLISH packet.");
+        return;
+    }
+
+    uint16_t packet_id = (MQTT_RX_BUFFER[offset] << 8) | MQTT_RX_BUFFER[offset + 1];
+
+    if (qos == 1)
+    {
+        mqtt_send_ack(MQTT_PUBACK, packet_id);
+    }
+    else
+    {
+        // Released by the PUBREL: a duplicate sent before is recognized
+        mqtt_receive_qos2(packet_id);
+        mqtt_send_ack(MQTT_PUBREC, packet_id);
+    }
+}
+
+/**
+ * @brief Handles a complete incoming packet held in MQTT_RX_BUFFER.
+ */
+void mqtt_handle_packet(uint8_t header, uint32_t len)
+{
+    uint16_t packet_id = len >= 2 ? (MQTT_RX_BUFFER[0] << 8) | MQTT_RX_BUFFER[1] : 0;
+
+    switch (header & 0xF0)
+    {
+    case MQTT_CONNACK:
+        if (len >= 2 && MQTT_RX_BUFFER[1] == 0)
+        {
+            LogInfo("Connected to the MQTT broker %s:%d.", mqttConfig.host, mqttConfig.port);
+            mqttState = MQTT_STATE_CONNECTED;
+            mqtt_raise(MQTT_EVENT_CONNECTED, 0);
+
+            // Restore the subscriptions of a session that was lost
+            for (int i = 0; i < MQTT_MAX_SUBSCRIPTIONS; i++)
+            {
+                if (mqttSubscriptions[i].topic[0] != 0)
+                {
+                    mqtt_send_subscribe(mqttSubscriptions[i].topic, mqttSubscriptions[i].qos, mqtt_next_packet_id());
+                }
+            }
+
+            // Messages not acknowledged on the lost connection are sent again
+            for (int i = 0; i < MQTT_MAX_INFLIGHT; i++)
+            {
+                if (mqttInflight[i].state != INFLIGHT_FREE)
+                {
+                    mqtt_retransmit(&mqttInflight[i]);
+                }
+            }
+        }
+        else
+        {
+            int code = len >= 2 ? MQTT_RX_BUFFER[1] : -1;
+
+            LogErr("Connection refused by the MQTT broker (code %d).", code);
+            mqtt_close();
+            mqttState = MQTT_STATE_DISCONNECTED;
+            mqttConnectStarted = millis();
+
+            // The other refusals (protocol version, client ID, credentials, authorization) would be repeated
+            if (code != MQTT_CONNACK_SERVER_UNAVAILABLE)
+            {
+                mqttConfig.reconnect = false;
+            }
+
+            mqtt_raise(MQTT_EVENT_CONNECTION_REFUSED, 0);
+        }
+        break;
+    case MQTT_PUBLISH:
+        mqtt_handle_publish(header, len);
+        break;
+    case MQTT_PUBACK:
+    case MQTT_PUBREC:
+    case MQTT_PUBCOMP:
+        mqtt_acknowledge_inflight(header & 0xF0, packet_id);
+        break;
+    case MQTT_PUBREL & 0xF0:
+        mqtt_release_qos2(packet_id);
+        mqtt_send_ack(MQTT_PUBCOMP, packet_id);
+        break;
+    case MQTT_SUBACK:
+        mqtt_raise(len >= 3 && MQTT_RX_BUFFER[2] != 0x80 ? MQTT_EVENT_SUBSCRIBED : MQTT_EVENT_SUBSCRIBE_FAILED, packet_id);
+        break;
+    case MQTT_UNSUBACK:
+        mqtt_raise(MQTT_EVENT_UNSUBSCRIBED, packet_id);
+        break;
+    case MQTT_PINGRESP:
+        mqttPingPending = false;
+        break;
+    default:
+        LogWarn("Unexpected MQTT packet 0x%02X.", header);
+    }
+}
+
+/**
+ * @brief Reads the available bytes and handles the complete packets.
+ *  Packets larger than MQTT_RX_BUFFER_SIZE are read and dropped: the messages are acknowledged.
+ */
+void mqtt_receive()
+{
+    while (mqttClient->available() > 0)
+    {
+        mqttLastReceived = millis();
+
+        if (mqttIncoming.header == 0)
+        {
+            mqttIncoming.header = mqttClient->read();
+            continue;
+        }
+
+        if (!mqttIncoming.length_complete)
+        {
+            uint8_t digit = mqttClient->read();
+
+            mqttIncoming.remaining |= (uint32_t)(digit & 0x7F) << (7 * mqttIncoming.length_bytes++);
+            mqttIncoming.length_complete = (digit & 0x80) == 0;
+
+            if (!mqttIncoming.length_complete && mqttIncoming.length_bytes == 4)
+            {
+                LogErr("Malformed MQTT remaining length.");
+                mqtt_connection_lost();
+                return;
+            }
+        }
+
+        if (mqttIncoming.length_complete && mqttIncoming.received < mqttIncoming.remaining)
+        {
+            uint32_t missing = mqttIncoming.remaining - mqttIncoming.received;
+            int read;
+
+            // The head of a larger packet is kept: a PUBLISH dropped is still acknowledged
+            if (mqttIncoming.received < MQTT_RX_BUFFER_SIZE)
+            {
+                uint32_t room = MQTT_RX_BUFFER_SIZE - mqttIncoming.received;
+
+                read = mqttClient->read(MQTT_RX_BUFFER + mqttIncoming.received, missing < room ? missing : room);
+            }
+            else
+            {
+                uint8_t discard[64];
+                read = mqttClient->read(discard, missing < sizeof(discard) ? missing : sizeof(discard));
+            }
+
+            if (read <= 0)
+            {
+                return;
+            }
+
+            mqttIncoming.received += read;
+        }
+
+        if (mqttIncoming.length_complete && mqttIncoming.received == mqttIncoming.remaining)
+        {
+            if (mqttIncoming.remaining <= MQTT_RX_BUFFER_SIZE)
+            {
+                mqtt_handle_packet(mqttIncoming.header, mqttIncoming.remaining);
+            }
+            else
+            {
+                LogWarn("MQTT packet of %lu bytes dropped (buffer is %d bytes).", (unsigned long)mqttIncoming.remaining, MQTT_RX_BUFFER_SIZE);
+                mqtt_drop_publish(mqttIncoming.header);
+            }
+
+            memset(&mqttIncoming, 0, sizeof(mqttIncoming));
+        }
+    }
+}
+
+void mqtt_loop()
+{
+    if (mqttState == MQTT_STATE_DISCONNECTED)
+    {
+        if (mqttConfig.reconnect && millis() - mqttConnectStarted > MQTT_RECONNECT_INTERVAL_MS)
+        {
+            LogInfo("Reconnecting to the MQTT broker.");
+            mqttConnectStarted = millis();
+            mqtt_connect();
+        }
+
+        return;
+    }
+
+    if (mqttState != MQTT_STATE_CONNECTING && mqttState != MQTT_STATE_CONNECTED)
+    {
+        return;
+    }
+
+    if (mqttOpenStep != MQTT_OPEN_IDLE)
+    {
+        mqtt_open();
+        return;
+    }
+
+    if (!mqttClient->connected())
+    {
+        mqtt_connection_lost();
+        return;
+    }
+
+    mqtt_receive();
+
+    if (mqttState == MQTT_STATE_CONNECTING)
+    {
+        if (millis() - mqttConnectStarted > MQTT_CONNECT_TIMEOUT_MS)
+        {
+            LogErr("No CONNACK received from the MQTT broker.");
+            mqtt_connection_lost();
+        }
+
+        return;
+    }
+
+    if (mqttState != MQTT_STATE_CONNECTED)
+    {
+        return;
+    }
+
+    mqtt_process_inflight();
+
+    if (mqttConfig.keepalive == 0)
+    {
+        return;
+    }
+
+    unsigned long keepalive = mqttConfig.keepalive * 1000UL;
+
+    if (mqttPingPending && millis() - mqttLastReceived > keepalive)
+    {
+        LogErr("No PINGRESP received from the MQTT broker.");
+        mqtt_connection_lost();
+    }
+    else if (!mqttPingPending && millis() - mqttLastSent >= keepalive)
+    {
+        uint8_t packet[2] = {MQTT_PINGREQ, 0};
+
+        mqttPingPending = mqtt_send(packet, sizeof(packet));
+    }
+}
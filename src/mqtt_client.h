@@ -0,0 +1,149 @@
+#ifndef __MQTT_CLIENT__
+#define __MQTT_CLIENT__
+
+#include <Arduino.h>
+
+#define MQTT_MAX_CLIENT_ID_LENGTH 64
+#define MQTT_MAX_USERNAME_LENGTH 64
+#define MQTT_MAX_PASSWORD_LENGTH 64
+#define MQTT_MAX_HOST_LENGTH 128
+#define MQTT_MAX_TOPIC_LENGTH 128
+#define MQTT_MAX_LWT_MESSAGE_LENGTH 64
+#define MQTT_MAX_SUBSCRIPTIONS 8
+
+// Connection schemes (AT+MQTTUSERCFG): MQTT over TCP, MQTT over TLS without certificate verification
+#define MQTT_SCHEME_TCP 1
+#define MQTT_SCHEME_TLS 2
+
+// Incoming packets larger than the buffer are dropped
+#define MQTT_RX_BUFFER_SIZE 1024
+
+// QoS 1/2 messages awaiting acknowledgment (publish window)
+#ifndef MQTT_MAX_INFLIGHT
+#define MQTT_MAX_INFLIGHT 8
+#endif
+
+// Storage of an in-flight message (topic and payload)
+#ifndef MQTT_INFLIGHT_DATA_SIZE
+#define MQTT_INFLIGHT_DATA_SIZE 512
+#endif
+
+/**
+ * States of the MQTT connection (as reported by AT+MQTTCONN?).
+ */
+#define MQTT_STATE_UNINITIALIZED 0
+#define MQTT_STATE_USER_CONFIGURED 1
+#define MQTT_STATE_CONNECTION_CONFIGURED 2
+#define MQTT_STATE_DISCONNECTED 3
+#define MQTT_STATE_CONNECTED 4
+#define MQTT_STATE_CONNECTING 7
+
+/**
+ * Events reported by the client to the AT layer.
+ */
+#define MQTT_EVENT_CONNECTED 0
+#define MQTT_EVENT_CONNECTION_REFUSED 1
+#define MQTT_EVENT_DISCONNECTED 2
+#define MQTT_EVENT_PUBLISHED 3
+#define MQTT_EVENT_SUBSCRIBED 4
+#define MQTT_EVENT_SUBSCRIBE_FAILED 5
+#define MQTT_EVENT_UNSUBSCRIBED 6
+#define MQTT_EVENT_PUBLISH_FAILED 7
+#define MQTT_EVENT_CONNECT_FAILED 8   // the connection to the broker could not be opened
+
+/**
+ * @brief Called on connection and acknowledgment events.
+ *
+ * @param event one of MQTT_EVENT_*.
+ * @param packet_id the packet identifier acknowledged (0 for connection events).
+ */
+typedef void (*mqtt_event_callback)(int event, uint16_t packet_id);
+
+/**
+ * @brief Called when a message is received on a subscribed topic.
+ */
+typedef void (*mqtt_message_callback)(const char *topic, const uint8_t *payload, size_t len);
+
+typedef struct _mqtt_subscription
+{
+    char topic[MQTT_MAX_TOPIC_LENGTH + 1];
+    uint8_t qos;
+} MQTT_SUBSCRIPTION;
+
+/**
+ * Counters of the publish window (as reported by AT+MQTTSTAT?).
+ */
+typedef struct _mqtt_stats
+{
+    uint8_t inflight;
+    uint8_t inflight_peak;
+    unsigned long acknowledged;
+    unsigned long retransmits;
+    unsigned long failed;
+    unsigned long ack_latency_total_ms;
+    unsigned long ack_latency_max_ms;
+} MQTT_STATS;
+
+typedef struct _mqtt_config
+{
+    char client_id[MQTT_MAX_CLIENT_ID_LENGTH + 1];
+    char username[MQTT_MAX_USERNAME_LENGTH + 1];
+    char password[MQTT_MAX_PASSWORD_LENGTH + 1];
+    uint16_t keepalive;
+    bool clean_session;
+    char lwt_topic[MQTT_MAX_TOPIC_LENGTH + 1];
+    char lwt_message[MQTT_MAX_LWT_MESSAGE_LENGTH + 1];
+    uint8_t lwt_qos;
+    bool lwt_retain;
+    char host[MQTT_MAX_HOST_LENGTH + 1];
+    uint16_t port;
+    bool reconnect;
+    uint8_t scheme;
+} MQTT_CONFIG;
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+extern MQTT_CONFIG mqttConfig;
+extern int mqttState;
+extern MQTT_SUBSCRIPTION mqttSubscriptions[MQTT_MAX_SUBSCRIPTIONS];
+extern MQTT_STATS mqttStats;
+
+void mqtt_set_callbacks(mqtt_event_callback on_event, mqtt_message_callback on_message);
+
+/**
+ * @brief Starts opening the TCP or TLS connection to mqttConfig.host. The connection is opened
+ *  from mqtt_loop, then the CONNECT packet is sent: the MQTT_EVENT_CONNECTED event is raised once
+ *  the broker accepted the connection, MQTT_EVENT_CONNECT_FAILED if it could not be opened.
+ */
+void mqtt_connect();
+
+/**
+ * @brief Sends DISCONNECT, closes the connection and forgets the subscriptions.
+ */
+void mqtt_disconnect();
+
+/**
+ * @brief Publishes a message.
+ *  QoS 1 and 2 messages are copied in the in-flight table, and retransmitted until acknowledged:
+ *  MQTT_EVENT_PUBLISHED is then raised with the packet identifier (MQTT_EVENT_PUBLISH_FAILED after too many retransmissions).
+ *  Fails if the in-flight table is full.
+ *
+ * @param packet_id receives the packet identifier (0 for QoS 0).
+ */
+bool mqtt_publish(const char *topic, const uint8_t *payload, size_t len, uint8_t qos, bool retain, uint16_t *packet_id);
+
+bool mqtt_subscribe(const char *topic, uint8_t qos, uint16_t *packet_id);
+bool mqtt_unsubscribe(const char *topic, uint16_t *packet_id);
+
+/**
+ * @brief Processes incoming packets, keepalive and reconnection. Called from the main loop.
+ */
+void mqtt_loop();
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
@@ -0,0 +1,496 @@
+#include "mqtt_commands.h"
+
+#include "at_parser.h"
+#include "at_command_process.h"
+#include "mqtt_client.h"
+#include "response.h"
+
+#include "at_log.h"
+
+#define MQTT_COMMAND_TIMEOUT_MS 10000
+
+/**
+ * @brief AT command waiting for an acknowledgment of the broker.
+ */
+struct
+{
+    bool active;
+    int success_event;
+    uint16_t packet_id;
+    unsigned long started;
+} pendingMqttCommand = {false, 0, 0, 0};
+
+void wait_mqtt_event(int success_event, uint16_t packet_id)
+{
+    pendingMqttCommand.active = true;
+    pendingMqttCommand.success_event = success_event;
+    pendingMqttCommand.packet_id = packet_id;
+    pendingMqttCommand.started = millis();
+
+    stop_at_processing = true;
+}
+
+void complete_mqtt_command(bool success)
+{
+    pendingMqttCommand.active = false;
+    stop_at_processing = false;
+
+    complete_at_command(success ? AT_OK : AT_ERROR);
+}
+
+void on_mqtt_event(int event, uint16_t packet_id)
+{
+    switch (event)
+    {
+    case MQTT_EVENT_CONNECTED:
+        response_printf("+MQTTCONNECTED:0,%d,\"%s\",\"%d\",\"\",%d\r\n", mqttConfig.scheme, mqttConfig.host, mqttConfig.port, mqttConfig.reconnect);
+        break;
+    case MQTT_EVENT_DISCONNECTED:
+    case MQTT_EVENT_CONNECTION_REFUSED:
+        response_println("+MQTTDISCONNECTED:0");
+        break;
+    case MQTT_EVENT_PUBLISHED:
+        response_printf("+MQTTPUB:OK,%u\r\n", packet_id);
+        break;
+    case MQTT_EVENT_PUBLISH_FAILED:
+        response_printf("+MQTTPUB:FAIL,%u\r\n", packet_id);
+        break;
+    }
+
+    if (!pendingMqttCommand.active)
+    {
+        return;
+    }
+
+    if (event == pendingMqttCommand.success_event && packet_id == pendingMqttCommand.packet_id)
+    {
+        complete_mqtt_command(true);
+    }
+    else if ((event == MQTT_EVENT_SUBSCRIBE_FAILED && packet_id == pendingMqttCommand.packet_id) ||
+             event == MQTT_EVENT_CONNECTION_REFUSED ||
+             event == MQTT_EVENT_CONNECT_FAILED ||
+             event == MQTT_EVENT_DISCONNECTED)
+    {
+        complete_mqtt_command(false);
+    }
+}
+
+void on_mqtt_message(const char *topic, const uint8_t *payload, size_t len)
+{
+    response_printf("+MQTTSUBRECV:0,\"%s\",%u,", topic, (unsigned int)len);
+    response_write(payload, len);
+    response_print("\r\n");
+}
+
+void process_mqtt()
+{
+    mqtt_loop();
+
+    if (pendingMqttCommand.active && millis() - pendingMqttCommand.started > MQTT_COMMAND_TIMEOUT_MS)
+    {
+        LogErr("No acknowledgment received from the MQTT broker.");
+        complete_mqtt_command(false);
+    }
+}
+
+typedef struct _user_config_args
+{
+    long link;
+    long scheme;
+    char client_id[sizeof(mqttConfig.client_id)];
+    char username[sizeof(mqttConfig.username)];
+    char password[sizeof(mqttConfig.password)];
+    long cert_key_id;
+    long ca_id;
+    char path[MQTT_MAX_HOST_LENGTH + 1];
+} USER_CONFIG_ARGS;
+
+static const AT_ARG_SPEC user_config_args[] = {
+    AT_ARG_INT(USER_CONFIG_ARGS, link, AT_ARG_REQUIRED, 0, 0),
+    AT_ARG_INT(USER_CONFIG_ARGS, scheme, AT_ARG_REQUIRED, MQTT_SCHEME_TCP, MQTT_SCHEME_TLS),
+    AT_ARG_STRING(USER_CONFIG_ARGS, client_id, AT_ARG_REQUIRED),
+    AT_ARG_STRING(USER_CONFIG_ARGS, username, AT_ARG_REQUIRED),
+    AT_ARG_STRING(USER_CONFIG_ARGS, password, AT_ARG_REQUIRED),
+    AT_ARG_INT(USER_CONFIG_ARGS, cert_key_id, AT_ARG_OPTIONAL, 0, 255),
+    AT_ARG_INT(USER_CONFIG_ARGS, ca_id, AT_ARG_OPTIONAL, 0, 255),
+    AT_ARG_STRING(USER_CONFIG_ARGS, path, AT_ARG_OPTIONAL),
+};
+
+/**
+ * Sets the MQTT user configuration.
+ *
+ * @param AT+MQTTUSERCFG=<LinkID>,<scheme>,<"client_id">,<"username">,<"password">[,<cert_key_ID>,<CA_ID>,<"path">]
+ *  <scheme>: 1 MQTT over TCP, 2 MQTT over TLS (no certificate verification)
+ */
+char set_mqtt_user_config(char *value)
+{
+    USER_CONFIG_ARGS args = {};
+
+    if (!parse_command_args(value, user_config_args, AT_ARG_COUNT(user_config_args), &args))
+    {
+        return AT_ERROR;
+    }
+
+    if (mqttState == MQTT_STATE_CONNECTED || mqttState == MQTT_STATE_CONNECTING)
+    {
+        LogWarn("The MQTT configuration cannot be changed while connected.");
+        return AT_ERROR;
+    }
+
+    strcpy(mqttConfig.client_id, args.client_id);
+    strcpy(mqttConfig.username, args.username);
+    strcpy(mqttConfig.password, args.password);
+    mqttConfig.scheme = args.scheme;
+
+    if (mqttState == MQTT_STATE_UNINITIALIZED)
+    {
+        mqttState = MQTT_STATE_USER_CONFIGURED;
+    }
+
+    return AT_OK;
+}
+
+typedef struct _connection_config_args
+{
+    long link;
+    long keepalive;
+    long disable_clean_session;
+    char lwt_topic[sizeof(mqttConfig.lwt_topic)];
+    char lwt_message[sizeof(mqttConfig.lwt_message)];
+    long lwt_qos;
+    long lwt_retain;
+} CONNECTION_CONFIG_ARGS;
+
+static const AT_ARG_SPEC connection_config_args[] = {
+    AT_ARG_INT(CONNECTION_CONFIG_ARGS, link, AT_ARG_REQUIRED, 0, 0),
+    AT_ARG_INT(CONNECTION_CONFIG_ARGS, keepalive, AT_ARG_REQUIRED, 0, 7200),
+    AT_ARG_INT(CONNECTION_CONFIG_ARGS, disable_clean_session, AT_ARG_REQUIRED, 0, 1),
+    AT_ARG_STRING(CONNECTION_CONFIG_ARGS, lwt_topic, AT_ARG_REQUIRED),
+    AT_ARG_STRING(CONNECTION_CONFIG_ARGS, lwt_message, AT_ARG_REQUIRED),
+    AT_ARG_INT(CONNECTION_CONFIG_ARGS, lwt_qos, AT_ARG_REQUIRED, 0, 2),
+    AT_ARG_INT(CONNECTION_CONFIG_ARGS, lwt_retain, AT_ARG_REQUIRED, 0, 1),
+};
+
+/**
+ * Sets the MQTT connection configuration.
+ *
+ * @param AT+MQTTCONNCFG=<LinkID>,<keepalive>,<disable_clean_session>,<"lwt_topic">,<"lwt_msg">,<lwt_qos>,<lwt_retain>
+ */
+char set_mqtt_connection_config(char *value)
+{
+    CONNECTION_CONFIG_ARGS args = {};
+
+    if (!parse_command_args(value, connection_config_args, AT_ARG_COUNT(connection_config_args), &args))
+    {
+        return AT_ERROR;
+    }
+
+    if (mqttState == MQTT_STATE_UNINITIALIZED)
+    {
+        return AT_ERROR;
+    }
+
+    strcpy(mqttConfig.lwt_topic, args.lwt_topic);
+    strcpy(mqttConfig.lwt_message, args.lwt_message);
+    mqttConfig.keepalive = args.keepalive;
+    mqttConfig.clean_session = args.disable_clean_session == 0;
+    mqttConfig.lwt_qos = args.lwt_qos;
+    mqttConfig.lwt_retain = args.lwt_retain != 0;
+
+    if (mqttState == MQTT_STATE_USER_CONFIGURED)
+    {
+        mqttState = MQTT_STATE_CONNECTION_CONFIGURED;
+    }
+
+    return AT_OK;
+}
+
+/**
+ * Gets the MQTT connection state.
+ *
+ * @param AT+MQTTCONN?
+ * @return +MQTTCONN:<LinkID>,<state>,<scheme>,<"host">,<port>,<"path">,<reconnect>
+ */
+char get_mqtt_connection(char *value)
+{
+    sprintf(value, "+MQTTCONN:0,%d,%d,\"%s\",%d,\"\",%d", mqttState, mqttConfig.scheme, mqttConfig.host, mqttConfig.port, mqttConfig.reconnect);
+
+    return AT_OK;
+}
+
+typedef struct _connection_args
+{
+    long link;
+    char host[sizeof(mqttConfig.host)];
+    long port;
+    long reconnect;
+} CONNECTION_ARGS;
+
+static const AT_ARG_SPEC connection_args[] = {
+    AT_ARG_INT(CONNECTION_ARGS, link, AT_ARG_REQUIRED, 0, 0),
+    AT_ARG_STRING(CONNECTION_ARGS, host, AT_ARG_REQUIRED),
+    AT_ARG_INT(CONNECTION_ARGS, port, AT_ARG_REQUIRED, 1, 65535),
+    AT_ARG_INT(CONNECTION_ARGS, reconnect, AT_ARG_REQUIRED, 0, 1),
+};
+
+/**
+ * Connects to a MQTT broker. OK is returned once the broker accepted the connection.
+ *
+ * @param AT+MQTTCONN=<LinkID>,<"host">,<port>,<reconnect>
+ */
+char set_mqtt_connection(char *value)
+{
+    CONNECTION_ARGS args = {};
+
+    if (!parse_command_args(value, connection_args, AT_ARG_COUNT(connection_args), &args))
+    {
+        return AT_ERROR;
+    }
+
+    if (mqttState == MQTT_STATE_UNINITIALIZED)
+    {
+        return AT_ERROR;
+    }
+
+    if (mqttState == MQTT_STATE_CONNECTED || mqttState == MQTT_STATE_CONNECTING)
+    {
+        LogWarn("Already connected to the MQTT broker.");
+        return AT_ERROR;
+    }
+
+    strcpy(mqttConfig.host, args.host);
+    mqttConfig.port = args.port;
+    mqttConfig.reconnect = args.reconnect != 0;
+
+    mqtt_connect();
+    wait_mqtt_event(MQTT_EVENT_CONNECTED, 0);
+
+    return AT_PENDING;
+}
+
+typedef struct _publish_args
+{
+    long link;
+    char topic[MQTT_MAX_TOPIC_LENGTH + 1];
+    char data[AT_MAX_TEMP_STRING];
+    long qos;
+    long retain;
+} PUBLISH_ARGS;
+
+static const AT_ARG_SPEC publish_args[] = {
+    AT_ARG_INT(PUBLISH_ARGS, link, AT_ARG_REQUIRED, 0, 0),
+    AT_ARG_STRING(PUBLISH_ARGS, topic, AT_ARG_REQUIRED),
+    AT_ARG_STRING(PUBLISH_ARGS, data, AT_ARG_REQUIRED),
+    AT_ARG_INT(PUBLISH_ARGS, qos, AT_ARG_REQUIRED, 0, 2),
+    AT_ARG_INT(PUBLISH_ARGS, retain, AT_ARG_REQUIRED, 0, 1),
+};
+
+/**
+ * Publishes a message.
+ *
+ * @param AT+MQTTPUB=<LinkID>,<"topic">,<"data">,<qos>,<retain>
+ * @return +MQTTPUB:<packet_id> for QoS 1 and 2
+ */
+char publish_mqtt_message(char *value)
+{
+    PUBLISH_ARGS args = {};
+    uint16_t packet_id;
+
+    if (!parse_command_args(value, publish_args, AT_ARG_COUNT(publish_args), &args))
+    {
+        return AT_ERROR;
+    }
+
+    if (!mqtt_publish(args.topic, (const uint8_t *)args.data, strlen(args.data), args.qos, args.retain != 0, &packet_id))
+    {
+        return AT_ERROR;
+    }
+
+    // Identifier matching the +MQTTPUB:OK / +MQTTPUB:FAIL reported once acknowledged or dropped
+    if (args.qos > 0)
+    {
+        response_printf("+MQTTPUB:%u\r\n", packet_id);
+    }
+
+    return AT_OK;
+}
+
+/**
+ * Gets the counters of the publish window.
+ *
+ * @param AT+MQTTSTAT?
+ * @return +MQTTSTAT:<LinkID>,<inflight>,<inflight_peak>,<window>,<acknowledged>,<retransmits>,<failed>,<ack_latency_avg>,<ack_latency_max>
+ */
+char get_mqtt_stats(char *value)
+{
+    unsigned long average = mqttStats.acknowledged > 0 ? mqttStats.ack_latency_total_ms / mqttStats.acknowledged : 0;
+
+    sprintf(value, "+MQTTSTAT:0,%d,%d,%d,%lu,%lu,%lu,%lu,%lu",
+            mqttStats.inflight, mqttStats.inflight_peak, MQTT_MAX_INFLIGHT,
+            mqttStats.acknowledged, mqttStats.retransmits, mqttStats.failed,
+            average, mqttStats.ack_latency_max_ms);
+
+    return AT_OK;
+}
+
+/**
+ * Resets the counters of the publish window.
+ *
+ * @param AT+MQTTSTAT
+ */
+char reset_mqtt_stats(char *value)
+{
+    uint8_t inflight = mqttStats.inflight;
+
+    memset(&mqttStats, 0, sizeof(mqttStats));
+    mqttStats.inflight = inflight;
+    mqttStats.inflight_peak = inflight;
+
+    return AT_OK;
+}
+
+/**
+ * Lists the subscribed topics.
+ *
+ * @param AT+MQTTSUB?
+ * @return +MQTTSUB:<LinkID>,<state>,<"topic">,<qos>
+ */
+char get_mqtt_subscriptions(char *value)
+{
+    for (int i = 0; i < MQTT_MAX_SUBSCRIPTIONS; i++)
+    {
+        if (mqttSubscriptions[i].topic[0] == 0)
+        {
+            continue;
+        }
+
+        response_printf("+MQTTSUB:0,%d,\"%s\",%d\r\n", mqttState, mqttSubscriptions[i].topic, mqttSubscriptions[i].qos);
+    }
+
+    return AT_OK;
+}
+
+typedef struct _subscribe_args
+{
+    long link;
+    char topic[MQTT_MAX_TOPIC_LENGTH + 1];
+    long qos;
+} SUBSCRIBE_ARGS;
+
+static const AT_ARG_SPEC subscribe_args[] = {
+    AT_ARG_INT(SUBSCRIBE_ARGS, link, AT_ARG_REQUIRED, 0, 0),
+    AT_ARG_STRING(SUBSCRIBE_ARGS, topic, AT_ARG_REQUIRED),
+    AT_ARG_INT(SUBSCRIBE_ARGS, qos, AT_ARG_REQUIRED, 0, 2),
+};
+
+/**
+ * Subscribes to a topic. OK is returned once the broker acknowledged the subscription.
+ *
+ * @param AT+MQTTSUB=<LinkID>,<"topic">,<qos>
+ */
+char subscribe_mqtt_topic(char *value)
+{
+    SUBSCRIBE_ARGS args = {};
+    uint16_t packet_id;
+
+    if (!parse_command_args(value, subscribe_args, AT_ARG_COUNT(subscribe_args), &args))
+    {
+        return AT_ERROR;
+    }
+
+    if (!mqtt_subscribe(args.topic, args.qos, &packet_id))
+    {
+        return AT_ERROR;
+    }
+
+    wait_mqtt_event(MQTT_EVENT_SUBSCRIBED, packet_id);
+
+    return AT_PENDING;
+}
+
+typedef struct _unsubscribe_args
+{
+    long link;
+    char topic[MQTT_MAX_TOPIC_LENGTH + 1];
+} UNSUBSCRIBE_ARGS;
+
+static const AT_ARG_SPEC unsubscribe_args[] = {
+    AT_ARG_INT(UNSUBSCRIBE_ARGS, link, AT_ARG_REQUIRED, 0, 0),
+    AT_ARG_STRING(UNSUBSCRIBE_ARGS, topic, AT_ARG_REQUIRED),
+};
+
+/**
+ * Unsubscribes from a topic.
+ *
+ * @param AT+MQTTUNSUB=<LinkID>,<"topic">
+ */
+char unsubscribe_mqtt_topic(char *value)
+{
+    UNSUBSCRIBE_ARGS args = {};
+    uint16_t packet_id;
+
+    if (!parse_command_args(value, unsubscribe_args, AT_ARG_COUNT(unsubscribe_args), &args))
+    {
+        return AT_ERROR;
+    }
+
+    if (!mqtt_unsubscribe(args.topic, &packet_id))
+    {
+        return AT_ERROR;
+    }
+
+    return AT_OK;
+}
+
+typedef struct _clean_args
+{
+    long link;
+} CLEAN_ARGS;
+
+static const AT_ARG_SPEC clean_args[] = {
+    AT_ARG_INT(CLEAN_ARGS, link, AT_ARG_REQUIRED, 0, 0),
+};
+
+/**
+ * Closes the MQTT connection and releases its configuration.
+ *
+ * @param AT+MQTTCLEAN=<LinkID>
+ */
+char clean_mqtt_connection(char *value)
+{
+    CLEAN_ARGS args = {};
+
+    if (!parse_command_args(value, clean_args, AT_ARG_COUNT(clean_args), &args))
+    {
+        return AT_ERROR;
+    }
+
+    mqttConfig.reconnect = false;
+    mqtt_disconnect();
+
+    memset(&mqttConfig, 0, sizeof(mqttConfig));
+    mqttConfig.keepalive = 120;
+    mqttConfig.clean_session = true;
+    mqttConfig.port = 1883;
+    mqttState = MQTT_STATE_UNINITIALIZED;
+
+    return AT_OK;
+}
+
+bool register_mqtt_commands()
+{
+    mqtt_set_callbacks(on_mqtt_event, on_mqtt_message);
+
+    bool registered = true;
+
+    registered &= at_register_command("MQTTUSERCFG", 0, (at_callback)set_mqtt_user_config, 0, 0) == AT_OK;
+    registered &= at_register_command("MQTTCONNCFG", 0, (at_callback)set_mqtt_connection_config, 0, 0) == AT_OK;
+    registered &= at_register_command("MQTTCONN", (at_callback)get_mqtt_connection, (at_callback)set_mqtt_connection, 0, 0) == AT_OK;
+    registered &= at_register_command("MQTTPUB", 0, (at_callback)publish_mqtt_message, 0, 0) == AT_OK;
+    registered &= at_register_command("MQTTSUB", (at_callback)get_mqtt_subscriptions, (at_callback)subscribe_mqtt_topic, 0, 0) == AT_OK;
+    registered &= at_register_command("MQTTUNSUB", 0, (at_callback)unsubscribe_mqtt_topic, 0, 0) == AT_OK;
+    registered &= at_register_command("MQTTCLEAN", 0, (at_callback)clean_mqtt_connection, 0, 0) == AT_OK;
+    registered &= at_register_command("MQTTSTAT", (at_callback)get_mqtt_stats, 0, 0, (at_callback)reset_mqtt_stats) == AT_OK;
+
+    return registered;
+}
@@ -0,0 +1,17 @@
+#ifndef __MQTT_COMMANDS__
+#define __MQTT_COMMANDS__
+
+#include <Arduino.h>
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+void process_mqtt();
+bool register_mqtt_commands();
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
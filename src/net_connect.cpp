@@ -0,0 +1,231 @@
+#ifdef ARDUINO_ARCH_ESP8266
+// Raw lwIP API, as used by the ESP8266WiFi library
+#define LWIP_INTERNAL
+#endif
+
+#include <Arduino.h>
+#include "at_log.h"
+
+#include "net_connect.h"
+
+#ifdef ARDUINO_ARCH_ESP8266
+#include <lwip/dns.h>
+#include <lwip/tcp.h>
+#include <include/ClientContext.h>
+
+/**
+ * @brief Client of a connection established by net_connect: the constructor taking
+ *  the connection context is only available to the subclasses of WiFiClient.
+ */
+class NetClient : public WiFiClient
+{
+public:
+    explicit NetClient(ClientContext *context) : WiFiClient(context) {}
+};
+
+/**
+ * @brief Result of the name resolution, called by lwIP between two loops.
+ */
+static void net_dns_found(const char *name, const ip_addr_t *ipaddr, void *arg)
+{
+    NET_CONNECT *connect = (NET_CONNECT *)arg;
+
+    // A resolution abandoned by net_connect_abort may complete after another one started
+    if (connect->step != NET_CONNECT_RESOLVING || strcmp(name, connect->host) != 0)
+    {
+        return;
+    }
+
+    if (ipaddr == NULL)
+    {
+        connect->step = NET_CONNECT_FAILED;
+        return;
+    }
+
+    connect->ip = IPAddress(ipaddr);
+    connect->step = NET_CONNECT_RESOLVED;
+}
+
+/**
+ * @brief End of the TCP handshake: the client context takes over the callbacks of the connection,
+ *  so the data received before the client is created is kept.
+ */
+static err_t net_tcp_connected(void *arg, struct tcp_pcb *pcb, err_t err)
+{
+    NET_CONNECT *connect = (NET_CONNECT *)arg;
+
+    connect->context = new ClientContext(pcb, nullptr, nullptr);
+    connect->pcb = nullptr;
+    connect->step = NET_CONNECT_OPEN;
+
+    return ERR_OK;
+}
+
+/**
+ * @brief Failure of the TCP handshake (refused, timed out by lwIP): the pcb is already freed.
+ */
+static void net_tcp_error(void *arg, err_t err)
+{
+    NET_CONNECT *connect = (NET_CONNECT *)arg;
+
+    connect->pcb = nullptr;
+    connect->step = NET_CONNECT_FAILED;
+}
+
+static void net_resolve_start(NET_CONNECT *connect)
+{
+    ip_addr_t addr;
+    err_t err = dns_gethostbyname(connect->host, &addr, net_dns_found, connect);
+
+    // Addresses and names in the cache are resolved at once
+    if (err == ERR_OK)
+    {
+        connect->ip = IPAddress(&addr);
+        connect->step = NET_CONNECT_RESOLVED;
+    }
+    else if (err != ERR_INPROGRESS)
+    {
+        connect->step = NET_CONNECT_FAILED;
+    }
+}
+
+static void net_tcp_start(NET_CONNECT *connect)
+{
+    struct tcp_pcb *pcb = tcp_new();
+
+    if (pcb == nullptr)
+    {
+        connect->step = NET_CONNECT_FAILED;
+        return;
+    }
+
+    tcp_arg(pcb, connect);
+    tcp_err(pcb, net_tcp_error);
+
+    if (tcp_connect(pcb, connect->ip, connect->port, net_tcp_connected) != ERR_OK)
+    {
+        tcp_arg(pcb, nullptr);
+        tcp_err(pcb, nullptr);
+        tcp_abort(pcb);
+
+        connect->step = NET_CONNECT_FAILED;
+        return;
+    }
+
+    connect->pcb = pcb;
+}
+
+/**
+ * @brief Steps completed in the background by the lwIP callbacks.
+ */
+static void net_progress(NET_CONNECT *connect, WiFiClient *client)
+{
+}
+
+static void net_take_client(NET_CONNECT *connect, WiFiClient *client)
+{
+    *client = NetClient((ClientContext *)connect->context);
+    connect->context = nullptr;
+}
+
+static void net_release(NET_CONNECT *connect)
+{
+    if (connect->pcb != nullptr)
+    {
+        struct tcp_pcb *pcb = (struct tcp_pcb *)connect->pcb;
+
+        tcp_arg(pcb, nullptr);
+        tcp_err(pcb, nullptr);
+        tcp_abort(pcb);
+        connect->pcb = nullptr;
+    }
+
+    // Closed and freed with its last client
+    if (connect->context != nullptr)
+    {
+        WiFiClient client = NetClient((ClientContext *)connect->context);
+
+        connect->context = nullptr;
+        client.stop();
+    }
+}
+#else
+// Host build: the shim resolves and connects at once, one step per poll
+
+static void net_resolve_start(NET_CONNECT *connect)
+{
+}
+
+static void net_tcp_start(NET_CONNECT *connect)
+{
+}
+
+static void net_progress(NET_CONNECT *connect, WiFiClient *client)
+{
+    if (connect->step == NET_CONNECT_RESOLVING)
+    {
+        connect->step = WiFi.hostByName(connect->host, connect->ip) ? NET_CONNECT_RESOLVED : NET_CONNECT_FAILED;
+    }
+    else if (connect->step == NET_CONNECT_CONNECTING)
+    {
+        connect->step = client->connect(connect->ip, connect->port) ? NET_CONNECT_OPEN : NET_CONNECT_FAILED;
+    }
+}
+
+static void net_take_client(NET_CONNECT *connect, WiFiClient *client)
+{
+}
+
+static void net_release(NET_CONNECT *connect)
+{
+}
+#endif
+
+void net_connect_start(NET_CONNECT *connect, const char *host, uint16_t port, bool tcp, unsigned long timeout)
+{
+    connect->step = NET_CONNECT_RESOLVING;
+    connect->tcp = tcp;
+    connect->host = host;
+    connect->port = port;
+    connect->timeout = timeout;
+    connect->step_started = millis();
+    connect->pcb = nullptr;
+    connect->context = nullptr;
+
+    net_resolve_start(connect);
+}
+
+uint8_t net_connect_poll(NET_CONNECT *connect, WiFiClient *client)
+{
+    net_progress(connect, client);
+
+    if (connect->step == NET_CONNECT_RESOLVED && connect->tcp)
+    {
+        connect->step = NET_CONNECT_CONNECTING;
+        connect->step_started = millis();
+
+        net_tcp_start(connect);
+    }
+
+    if (connect->step == NET_CONNECT_OPEN && connect->context != nullptr)
+    {
+        net_take_client(connect, client);
+    }
+
+    if ((connect->step == NET_CONNECT_RESOLVING || connect->step == NET_CONNECT_CONNECTING) &&
+        millis() - connect->step_started >= connect->timeout)
+    {
+        LogErr("%s %s timed out.", connect->step == NET_CONNECT_RESOLVING ? "Resolving" : "Connecting to", connect->host);
+
+        net_release(connect);
+        connect->step = NET_CONNECT_FAILED;
+    }
+
+    return connect->step;
+}
+
+void net_connect_abort(NET_CONNECT *connect)
+{
+    net_release(connect);
+    connect->step = NET_CONNECT_IDLE;
+}
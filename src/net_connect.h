@@ -0,0 +1,50 @@
+#ifndef __NET_CONNECT__
+#define __NET_CONNECT__
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+/**
+ * Steps of an outgoing connection opened without blocking the main loop:
+ * the name is resolved, then the TCP handshake is done, each one completing
+ * in the background while net_connect_poll is called from the loop.
+ */
+#define NET_CONNECT_IDLE 0
+#define NET_CONNECT_RESOLVING 1
+#define NET_CONNECT_RESOLVED 2      // final step when only the name is resolved
+#define NET_CONNECT_CONNECTING 3
+#define NET_CONNECT_OPEN 4
+#define NET_CONNECT_FAILED 5
+
+typedef struct _net_connect
+{
+    uint8_t step;
+    bool tcp;                   // false: stop once the name is resolved
+    const char *host;           // kept by the caller until the connection is open
+    uint16_t port;
+    IPAddress ip;
+    unsigned long timeout;      // for each step (ms)
+    unsigned long step_started;
+    void *pcb;                  // TCP handshake in progress
+    void *context;              // connection established, not handed to a client yet
+} NET_CONNECT;
+
+/**
+ * @brief Starts resolving the host name, then opening a TCP connection to it when tcp is set.
+ */
+void net_connect_start(NET_CONNECT *connect, const char *host, uint16_t port, bool tcp, unsigned long timeout);
+
+/**
+ * @brief Moves the connection to its next step when the current one is complete.
+ *  Once the connection is open, it is handed to client.
+ *
+ * @return the current step: NET_CONNECT_RESOLVED (without tcp), NET_CONNECT_OPEN and NET_CONNECT_FAILED are final.
+ */
+uint8_t net_connect_poll(NET_CONNECT *connect, WiFiClient *client);
+
+/**
+ * @brief Abandons the connection being opened.
+ */
+void net_connect_abort(NET_CONNECT *connect);
+
+#endif
@@ -0,0 +1,127 @@
+#include <Arduino.h>
+#include <stdarg.h>
+
+#include "response.h"
+#include "ring_buffer.h"
+#include "counters.h"
+
+// Output buffered for the UART. Larger writes wait for the buffer to be drained, then go straight to the UART.
+#ifndef RESPONSE_BUFFER_SIZE
+#define RESPONSE_BUFFER_SIZE 2048
+#endif
+
+// Formatted output up to this size is built on the stack
+#define RESPONSE_LINE_SIZE 128
+
+static uint8_t response_storage[RESPONSE_BUFFER_SIZE];
+static RING_BUFFER response_buffer = {response_storage, RESPONSE_BUFFER_SIZE, 0, 0};
+
+/**
+ * @brief Writes the oldest contiguous segment of the buffer, at most len bytes.
+ *  Serial.write blocks while the TX FIFO is full.
+ */
+static void write_segment(size_t len)
+{
+    const uint8_t *segment;
+    size_t n = rb_peek_contiguous(&response_buffer, &segment);
+
+    if (n > len)
+    {
+        n = len;
+    }
+
+    Serial.write(segment, n);
+    rb_consume(&response_buffer, n);
+    counter_add(COUNTER_UART_TX_BYTES, n);
+}
+
+void response_write(const uint8_t *data, size_t len)
+{
+    if (len > rb_free(&response_buffer))
+    {
+        counter_add(COUNTER_UART_TX_STALLS, 1);
+        response_flush();
+
+        if (len > RESPONSE_BUFFER_SIZE)
+        {
+            Serial.write(data, len);
+            counter_add(COUNTER_UART_TX_BYTES, len);
+            return;
+        }
+    }
+
+    rb_write(&response_buffer, data, len);
+}
+
+void response_print(const char *text)
+{
+    response_write((const uint8_t *)text, strlen(text));
+}
+
+void response_println(const char *text)
+{
+    response_print(text);
+    response_write((const uint8_t *)"\r\n", 2);
+}
+
+void response_printf(const char *format, ...)
+{
+    char line[RESPONSE_LINE_SIZE];
+    va_list args;
+
+    va_start(args, format);
+    int len = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+
+    if (len < 0)
+    {
+        return;
+    }
+
+    if ((size_t)len < sizeof(line))
+    {
+        response_write((const uint8_t *)line, len);
+        return;
+    }
+
+    // Rare long lines (e.g. topics) are formatted on the heap
+    char *text = (char *)malloc(len + 1);
+
+    if (text == NULL)
+    {
+        return;
+    }
+
+    va_start(args, format);
+    vsnprintf(text, len + 1, format, args);
+    va_end(args);
+
+    response_write((const uint8_t *)text, len);
+    free(text);
+}
+
+size_t response_room()
+{
+    return rb_free(&response_buffer);
+}
+
+void response_flush()
+{
+    while (rb_count(&response_buffer) > 0)
+    {
+        write_segment(rb_count(&response_buffer));
+    }
+}
+
+void process_response()
+{
+    size_t room = Serial.availableForWrite();
+
+    while (room > 0 && rb_count(&response_buffer) > 0)
+    {
+        size_t before = rb_count(&response_buffer);
+
+        write_segment(room);
+        room -= before - rb_count(&response_buffer);
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef __RESPONSE__
+#define __RESPONSE__
+
+#include <Arduino.h>
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/**
+ * @brief Output of the AT command processor.
+ *  Every byte sent to the host (responses, final results, URCs and received data) is
+ *  written through these functions, in a bounded buffer drained to the UART as its TX
+ *  FIFO empties: the output keeps its order, and the handlers do not wait for the UART.
+ *  The writer only blocks when the buffer is full.
+ */
+void response_write(const uint8_t *data, size_t len);
+void response_print(const char *text);
+void response_println(const char *text);
+void response_printf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+/**
+ * @brief Number of bytes that can be written without blocking.
+ */
+size_t response_room();
+
+/**
+ * @brief Writes the buffered output to the UART, and waits for it to be accepted.
+ *  Required before the UART is reconfigured, or before a reset or a deep sleep.
+ */
+void response_flush();
+
+/**
+ * @brief Moves the buffered output to the UART, as much as its TX FIFO accepts.
+ *  Called from the main loop.
+ */
+void process_response();
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
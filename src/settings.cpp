@@ -0,0 +1,135 @@
+#include "settings.h"
+
+#include <spi_flash.h>
+#include "scheduler.h"
+#include "at_log.h"
+
+#include "common.h"
+
+#ifdef ARDUINO_ARCH_ESP8266
+extern "C" uint32_t _FS_start;
+extern "C" uint32_t _FS_end;
+extern "C" uint32_t _EEPROM_start;
+
+#define FLASH_SECTOR(symbol) (((uint32_t)&(symbol) - 0x40200000) / SPI_FLASH_SEC_SIZE)
+#endif
+
+#if SETTINGS_SECTORS < 2
+#error "The settings need at least 2 flash sectors: a full sector is compacted into the next one"
+#endif
+
+SETTINGS settings;
+
+static SETTINGS committedSettings;
+static CONFIG_STORE store;
+static int commitTask = -1;
+static bool storeAvailable = false;
+
+static const SETTINGS default_settings = {UART_DEFAULT_BAUD, 0, FAST_JOIN_DISABLED, SETTINGS_UNSET, SETTINGS_DHCP_STA | SETTINGS_DHCP_AP, 0, 0, {}, "", {}, 4, 0};
+
+/**
+ * @brief Flash sectors of the store: the EEPROM sector and the last sectors of the file system area,
+ *  reserved for the settings by the linker script selected in platformio.ini (the firmware mounts no file system).
+ * @return false if the linker script does not leave SETTINGS_SECTORS sectors there.
+ */
+static bool settings_sectors(uint32_t *first_sector)
+{
+#ifdef ARDUINO_ARCH_ESP8266
+    uint32_t eeprom = FLASH_SECTOR(_EEPROM_start);
+
+    if (&_FS_end == &_FS_start || FLASH_SECTOR(_FS_end) != eeprom || eeprom - FLASH_SECTOR(_FS_start) < SETTINGS_SECTORS - 1)
+    {
+        return false;
+    }
+
+    *first_sector = eeprom - (SETTINGS_SECTORS - 1);
+#else
+    *first_sector = 0;
+#endif
+
+    return true;
+}
+
+void load_settings()
+{
+    uint32_t first_sector;
+    uint16_t version;
+
+    settings = default_settings;
+    committedSettings = default_settings;
+
+    // Called before the UART is started: nothing can be logged here, commit_settings reports the missing sectors
+    storeAvailable = settings_sectors(&first_sector);
+
+    if (!storeAvailable)
+    {
+        return;
+    }
+
+    config_store_begin(&store, first_sector, SETTINGS_SECTORS);
+
+    if (config_store_load(&store, &settings, sizeof(SETTINGS), &version) < 0)
+    {
+        return;
+    }
+
+    if (version != SETTINGS_VERSION)
+    {
+        settings = default_settings;
+    }
+
+    committedSettings = settings;
+}
+
+static char commit_settings_task(void *context)
+{
+    commitTask = -1;
+    commit_settings();
+
+    return TASK_DONE;
+}
+
+void save_settings()
+{
+    if (commitTask >= 0 || memcmp(&settings, &committedSettings, sizeof(SETTINGS)) == 0)
+    {
+        return;
+    }
+
+    commitTask = scheduler_add(commit_settings_task, NULL, SETTINGS_COMMIT_DELAY);
+
+    if (commitTask < 0)
+    {
+        commit_settings();
+    }
+}
+
+bool commit_settings()
+{
+    if (commitTask >= 0)
+    {
+        scheduler_remove(commitTask);
+        commitTask = -1;
+    }
+
+    if (memcmp(&settings, &committedSettings, sizeof(SETTINGS)) == 0)
+    {
+        return true;
+    }
+
+    if (!storeAvailable)
+    {
+        LogErr("No flash sectors reserved for the settings.");
+        return false;
+    }
+
+    if (!config_store_save(&store, &settings, sizeof(SETTINGS), SETTINGS_VERSION))
+    {
+        LogErr("Failed to save the settings.");
+        return false;
+    }
+
+    committedSettings = settings;
+
+    return true;
+}
@@ -0,0 +1,114 @@
+#ifndef __SETTINGS__
+#define __SETTINGS__
+
+#include <Arduino.h>
+
+#include "config_store.h"
+
+/**
+ * Settings persisted in flash (config store record log), restored at boot.
+ * New fields are appended: shorter records saved by a previous firmware are completed with the defaults.
+ * Bump SETTINGS_VERSION when a field is changed or removed: records of another version are ignored.
+ */
+#define SETTINGS_VERSION 3
+
+// Flash sectors of the config store (wear leveling)
+#ifndef SETTINGS_SECTORS
+#define SETTINGS_SECTORS 4
+#endif
+
+// Delay (ms) during which the changes are coalesced before being written to flash
+#ifndef SETTINGS_COMMIT_DELAY
+#define SETTINGS_COMMIT_DELAY 500
+#endif
+
+#define SETTINGS_UNSET 0xFF
+
+// DHCP enabled (AT+CWDHCP)
+#define SETTINGS_DHCP_STA 1
+#define SETTINGS_DHCP_AP 2
+
+/**
+ * RTC user memory layout (offsets in 4-byte blocks): kept across resets and deep sleep, lost on power down.
+ */
+#define RTC_WIFI_CACHE_OFFSET 0
+#define RTC_SLEEP_STATE_OFFSET 16
+
+/**
+ * Fast reconnect modes (AT+CWFASTJAP).
+ */
+#define FAST_JOIN_DISABLED 0
+#define FAST_JOIN_BSSID 1
+#define FAST_JOIN_BSSID_AND_IP 2
+
+/**
+ * AP and IP configuration of the last successful join, used to skip the scan (and DHCP) on the next one.
+ */
+typedef struct _wifi_cache
+{
+    uint32_t crc;
+    char ssid[33];
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint32_t ip;
+    uint32_t gateway;
+    uint32_t netmask;
+    uint32_t dns;
+} WIFI_CACHE;
+
+/**
+ * SoftAP configuration (AT+CWSAP).
+ */
+typedef struct _ap_config
+{
+    char ssid[33];
+    char pwd[65];
+    uint8_t channel;
+    uint8_t ecn;
+    uint8_t max_connection;
+    uint8_t hidden;
+} AP_CONFIG;
+
+typedef struct _settings
+{
+    uint32_t uart_baud;
+    uint8_t uart_flow_control;
+    uint8_t fast_join;
+    uint8_t wifi_mode;          // SETTINGS_UNSET: mode of the SDK
+    uint8_t dhcp;
+    uint16_t server_port;       // 0: no server
+    uint16_t reserved;
+    WIFI_CACHE wifi_cache;
+    char hostname[33];          // empty: default host name
+    AP_CONFIG ap;               // empty SSID: configuration of the SDK
+    uint8_t max_links;          // AT+CIPSERVERMAXCONN
+    uint8_t accept_queue;
+} SETTINGS;
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+extern SETTINGS settings;
+
+/**
+ * @brief Loads the settings from flash (a single record read), or the defaults if none were saved.
+ */
+void load_settings();
+
+/**
+ * @brief Schedules the write of the settings to flash.
+ *  The changes made until the write are coalesced into a single record.
+ */
+void save_settings();
+
+/**
+ * @brief Writes the pending changes to flash now (before a restart or a deep sleep).
+ */
+bool commit_settings();
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
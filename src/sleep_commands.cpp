@@ -0,0 +1,287 @@
+#include "sleep_commands.h"
+
+#include <ESP8266WiFi.h>
+
+#include "at_parser.h"
+#include "at_command_process.h"
+#include "tcp_ip_commands.h"
+#include "settings.h"
+#include "response.h"
+#include "at_log.h"
+
+// Power states (AT+SLEEP values, then deep sleep)
+#define POWER_STATE_NONE 0
+#define POWER_STATE_LIGHT 1
+#define POWER_STATE_MODEM 2
+#define POWER_STATE_DEEP 3
+#define POWER_STATE_COUNT 4
+
+/**
+ * @brief Time spent in each power state (ms), and number of deep sleeps.
+ *  Kept in RTC memory across deep sleeps and AT+RST.
+ */
+typedef struct _power_stats
+{
+    uint32_t time_ms[POWER_STATE_COUNT];
+    uint32_t deep_sleeps;
+} POWER_STATS;
+
+/**
+ * @brief State saved in RTC memory by AT+GSLP, restored at wake up, and by AT+RST for the counters.
+ *  It is read once: a later reset (watchdog, exception) does not restore it again.
+ */
+typedef struct _sleep_state
+{
+    uint32_t crc;
+    uint8_t wifi_mode;
+    uint8_t sleep_mode;
+    uint8_t receive_mode;
+    uint8_t mux_mode;
+    uint16_t server_port;
+    uint16_t ipd_max_len;
+    uint16_t ipd_max_latency;
+    uint16_t reserved2;
+    POWER_STATS stats;
+} SLEEP_STATE;
+
+POWER_STATS powerStats = {};
+uint8_t powerState = POWER_STATE_MODEM;
+unsigned long powerStateSince = 0;
+
+uint32_t sleep_state_crc(const SLEEP_STATE *state)
+{
+    return crc32((const uint8_t *)state + sizeof(state->crc), sizeof(SLEEP_STATE) - sizeof(state->crc));
+}
+
+/**
+ * @brief Adds the time spent in the current power state to its counter.
+ */
+void account_power_state()
+{
+    unsigned long now = millis();
+
+    powerStats.time_ms[powerState] += now - powerStateSince;
+    powerStateSince = now;
+}
+
+void set_power_state(uint8_t state)
+{
+    account_power_state();
+    powerState = state;
+}
+
+bool save_sleep_state()
+{
+    SLEEP_STATE state = {};
+
+    account_power_state();
+
+    state.wifi_mode = WiFi.getMode();
+    state.sleep_mode = WiFi.getSleepMode();
+    state.receive_mode = receiveMode;
+    state.mux_mode = muxMode;
+    state.server_port = tcp_server_port();
+    state.ipd_max_len = ipdMaxLen;
+    state.ipd_max_latency = ipdMaxLatency;
+    state.stats = powerStats;
+    state.crc = sleep_state_crc(&state);
+
+    return ESP.rtcUserMemoryWrite(RTC_SLEEP_STATE_OFFSET, (uint32_t *)&state, sizeof(state));
+}
+
+void restore_sleep_state()
+{
+    SLEEP_STATE state;
+    uint32_t reason = ESP.getResetInfoPtr()->reason;
+
+    powerState = WiFi.getSleepMode();
+    powerStateSince = millis();
+
+    if (!ESP.rtcUserMemoryRead(RTC_SLEEP_STATE_OFFSET, (uint32_t *)&state, sizeof(state)) ||
+        state.crc != sleep_state_crc(&state))
+    {
+        return;
+    }
+
+    // Read once: the next reset only restores the state if it is saved again
+    uint32_t invalid = 0;
+    ESP.rtcUserMemoryWrite(RTC_SLEEP_STATE_OFFSET, &invalid, sizeof(invalid));
+
+    // The snapshot is only current when taken right before this reset
+    if (reason != REASON_DEEP_SLEEP_AWAKE && reason != REASON_SOFT_RESTART)
+    {
+        return;
+    }
+
+    powerStats = state.stats;
+
+    if (reason != REASON_DEEP_SLEEP_AWAKE)
+    {
+        return;
+    }
+
+    LogInfo("Waking up from deep sleep.");
+
+    WiFi.mode((WiFiMode_t)state.wifi_mode);
+    WiFi.setSleepMode((WiFiSleepType_t)state.sleep_mode);
+    powerState = state.sleep_mode;
+
+    receiveMode = state.receive_mode;
+    muxMode = state.mux_mode;
+    ipdMaxLen = state.ipd_max_len;
+    ipdMaxLatency = state.ipd_max_latency;
+
+    if (state.server_port != 0)
+    {
+        start_tcp_server(state.server_port);
+    }
+}
+
+/**
+ * Gets the sleep mode.
+ *
+ * @param AT+SLEEP?
+ * @return +SLEEP:<sleep mode>
+ */
+char get_sleep_mode(char *value)
+{
+    sprintf(value, "+SLEEP:%d", WiFi.getSleepMode());
+
+    return AT_OK;
+}
+
+typedef struct _sleep_mode_args
+{
+    long mode;
+} SLEEP_MODE_ARGS;
+
+static const AT_ARG_SPEC sleep_mode_args[] = {
+    AT_ARG_INT(SLEEP_MODE_ARGS, mode, AT_ARG_REQUIRED, WIFI_NONE_SLEEP, WIFI_MODEM_SLEEP),
+};
+
+/**
+ * Sets the sleep mode.
+ *
+ * @param AT+SLEEP=<sleep mode>
+ */
+char set_sleep_mode(char *value)
+{
+    SLEEP_MODE_ARGS args = {};
+
+    if (!parse_command_args(value, sleep_mode_args, AT_ARG_COUNT(sleep_mode_args), &args))
+    {
+        return AT_ERROR;
+    }
+
+    int mode = args.mode;
+
+    if (!WiFi.setSleepMode((WiFiSleepType_t)mode))
+    {
+        return AT_ERROR;
+    }
+
+    set_power_state(mode);
+
+    return AT_OK;
+}
+
+typedef struct _deep_sleep_args
+{
+    long time_ms;
+} DEEP_SLEEP_ARGS;
+
+static const AT_ARG_SPEC deep_sleep_args[] = {
+    AT_ARG_INT(DEEP_SLEEP_ARGS, time_ms, AT_ARG_REQUIRED, 0, LONG_MAX),
+};
+
+/**
+ * Enters deep sleep. The module wakes up after the given time if GPIO16 is wired to RST.
+ *  The Wi-Fi mode, sleep mode, connection mode and TCP server configuration are kept in RTC memory
+ *  and restored at wake up.
+ *
+ * @param AT+GSLP=<time>
+ * @return <time>
+ */
+char enter_deep_sleep(char *value)
+{
+    DEEP_SLEEP_ARGS args = {};
+
+    if (!parse_command_args(value, deep_sleep_args, AT_ARG_COUNT(deep_sleep_args), &args))
+    {
+        return AT_ERROR;
+    }
+
+    unsigned long time_ms = args.time_ms;
+
+    if ((uint64_t)time_ms * 1000 > ESP.deepSleepMax())
+    {
+        return AT_ERROR;
+    }
+
+    account_power_state();
+    powerStats.time_ms[POWER_STATE_DEEP] += time_ms;
+    powerStats.deep_sleeps++;
+
+    if (!save_sleep_state())
+    {
+        powerStats.time_ms[POWER_STATE_DEEP] -= time_ms;
+        powerStats.deep_sleeps--;
+        return AT_ERROR;
+    }
+
+    commit_settings();
+
+    response_printf("%lu\r\n", time_ms);
+    complete_at_command(AT_OK);
+    response_flush();
+    Serial.flush();
+
+    ESP.deepSleep((uint64_t)time_ms * 1000);
+
+    return AT_PENDING;
+}
+
+/**
+ * Gets the time spent in each power state since the module was powered on.
+ *  The deep sleep time is the time requested with AT+GSLP.
+ *
+ * @param AT+SLEEPSTAT?
+ * @return +SLEEPSTAT:<none_ms>,<light_ms>,<modem_ms>,<deep_ms>,<deep_sleeps>
+ */
+char get_sleep_stats(char *value)
+{
+    account_power_state();
+
+    sprintf(value, "+SLEEPSTAT:%lu,%lu,%lu,%lu,%lu",
+            (unsigned long)powerStats.time_ms[POWER_STATE_NONE],
+            (unsigned long)powerStats.time_ms[POWER_STATE_LIGHT],
+            (unsigned long)powerStats.time_ms[POWER_STATE_MODEM],
+            (unsigned long)powerStats.time_ms[POWER_STATE_DEEP],
+            (unsigned long)powerStats.deep_sleeps);
+
+    return AT_OK;
+}
+
+/**
+ * Resets the power state counters.
+ *
+ * @param AT+SLEEPSTAT
+ */
+char reset_sleep_stats(char *value)
+{
+    memset(&powerStats, 0, sizeof(powerStats));
+    powerStateSince = millis();
+
+    return AT_OK;
+}
+
+bool register_sleep_commands()
+{
+    bool registered = true;
+
+    registered &= at_register_command("SLEEP", (at_callback)get_sleep_mode, (at_callback)set_sleep_mode, 0, 0) == AT_OK;
+    registered &= at_register_command("GSLP", 0, (at_callback)enter_deep_sleep, 0, 0) == AT_OK;
+    registered &= at_register_command("SLEEPSTAT", (at_callback)get_sleep_stats, 0, 0, (at_callback)reset_sleep_stats) == AT_OK;
+
+    return registered;
+}
@@ -0,0 +1,29 @@
+#ifndef __SLEEP_COMMANDS__
+#define __SLEEP_COMMANDS__
+
+#include <Arduino.h>
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+/**
+ * @brief Saves the configuration and the power state counters in RTC memory, before a deep
+ *  sleep or a restart.
+ */
+bool save_sleep_state();
+
+/**
+ * @brief Restores the configuration saved by AT+GSLP when waking up from deep sleep, and the
+ *  power state counters after a deep sleep or AT+RST. Nothing is restored after other resets.
+ *  Called from setup(), once the commands are registered.
+ */
+void restore_sleep_state();
+
+bool register_sleep_commands();
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif
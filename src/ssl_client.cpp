@@ -0,0 +1,180 @@
+#include <Arduino.h>
+#include "at_log.h"
+
+#include "ssl_client.h"
+
+// Number of servers whose TLS session is kept for resumption
+#ifndef SSL_SESSION_CACHE_SIZE
+#define SSL_SESSION_CACHE_SIZE 4
+#endif
+
+// Receive buffer without maximum fragment length: a full TLS record
+#define SSL_FULL_RECORD_SIZE 16384
+
+// Records sent by the client are split at this size
+#define SSL_TX_BUFFER_SIZE 512
+
+#define MFLN_UNKNOWN 0
+#define MFLN_SUPPORTED 1
+#define MFLN_UNSUPPORTED 2
+
+const SSL_CONFIG ssl_default_config = {SSL_AUTH_NONE, SSL_DEFAULT_MFLN, {}};
+
+/**
+ * @brief Session of a server, and its support of the maximum fragment length, probed once.
+ *  The session is only resumed with the authentication it was negotiated with: a session
+ *  established without verification can not bypass the fingerprint check.
+ */
+typedef struct _ssl_session_entry
+{
+    char host[SSL_MAX_HOST_LENGTH + 1];
+    uint16_t port;
+    uint8_t auth_mode;
+    uint8_t fingerprint[20];
+    uint16_t mfln;
+    uint8_t mfln_status;
+    unsigned long used_at;
+    BearSSL::Session session;
+} SSL_SESSION_ENTRY;
+
+SSL_SESSION_ENTRY sslSessions[SSL_SESSION_CACHE_SIZE];
+
+/**
+ * @brief The client holding a full record receive buffer: one at most, so that the TLS links and
+ *  the MQTT connection can not exhaust the heap.
+ */
+BearSSL::WiFiClientSecure *sslFullRecordClient = nullptr;
+
+bool ssl_valid_mfln(int mfln)
+{
+    return mfln == 0 || mfln == 512 || mfln == 1024 || mfln == 2048 || mfln == 4096;
+}
+
+bool ssl_parse_fingerprint(const char *text, uint8_t fingerprint[20])
+{
+    for (int i = 0; i < 20; i++)
+    {
+        if (i > 0 && *text == ':')
+        {
+            text++;
+        }
+
+        if (!isxdigit((unsigned char)text[0]) || !isxdigit((unsigned char)text[1]))
+        {
+            return false;
+        }
+
+        char digits[3] = {text[0], text[1], 0};
+
+        fingerprint[i] = strtoul(digits, NULL, 16);
+        text += 2;
+    }
+
+    return *text == '\0';
+}
+
+/**
+ * @brief Finds the cache entry of the server and authentication, or recycles the least recently used one.
+ */
+SSL_SESSION_ENTRY *ssl_session_entry(const char *host, uint16_t port, const SSL_CONFIG *config)
+{
+    SSL_SESSION_ENTRY *oldest = &sslSessions[0];
+
+    for (int i = 0; i < SSL_SESSION_CACHE_SIZE; i++)
+    {
+        SSL_SESSION_ENTRY *entry = &sslSessions[i];
+
+        if (entry->port == port && strcmp(entry->host, host) == 0 && entry->auth_mode == config->auth_mode &&
+            (config->auth_mode != SSL_AUTH_SERVER || memcmp(entry->fingerprint, config->fingerprint, sizeof(entry->fingerprint)) == 0))
+        {
+            return entry;
+        }
+
+        if (entry->port == 0 || (oldest->port != 0 && entry->used_at < oldest->used_at))
+        {
+            oldest = entry;
+        }
+    }
+
+    LogDebug("New TLS session entry for %s:%d.", host, port);
+
+    strncpy(oldest->host, host, sizeof(oldest->host) - 1);
+    oldest->host[sizeof(oldest->host) - 1] = '\0';
+    oldest->port = port;
+    oldest->auth_mode = config->auth_mode;
+    memcpy(oldest->fingerprint, config->fingerprint, sizeof(oldest->fingerprint));
+    oldest->mfln_status = MFLN_UNKNOWN;
+    oldest->session = BearSSL::Session();
+
+    return oldest;
+}
+
+bool ssl_connect(BearSSL::WiFiClientSecure *client, const SSL_CONFIG *config, const char *host, uint16_t port)
+{
+    SSL_SESSION_ENTRY *entry = ssl_session_entry(host, port, config);
+
+    entry->used_at = millis();
+
+    // The probe is an extra connection: its result is kept with the session
+    if (config->mfln != 0 && (entry->mfln_status == MFLN_UNKNOWN || entry->mfln != config->mfln))
+    {
+        entry->mfln = config->mfln;
+        entry->mfln_status = BearSSL::WiFiClientSecure::probeMaxFragmentLength(host, port, config->mfln) ? MFLN_SUPPORTED : MFLN_UNSUPPORTED;
+
+        LogDebug("Maximum fragment length of %d bytes %s by %s.", config->mfln, entry->mfln_status == MFLN_SUPPORTED ? "supported" : "not supported", host);
+    }
+
+    bool mfln = config->mfln != 0 && entry->mfln_status == MFLN_SUPPORTED;
+
+    if (!mfln && sslFullRecordClient != nullptr && sslFullRecordClient != client)
+    {
+        LogWarn("A TLS connection with %d bytes records is already open.", SSL_FULL_RECORD_SIZE);
+        return false;
+    }
+
+    if (!mfln)
+    {
+        sslFullRecordClient = client;
+    }
+    else if (sslFullRecordClient == client)
+    {
+        sslFullRecordClient = nullptr;
+    }
+
+    client->setBufferSizes(mfln ? config->mfln : SSL_FULL_RECORD_SIZE, SSL_TX_BUFFER_SIZE);
+
+    if (config->auth_mode == SSL_AUTH_SERVER)
+    {
+        client->setFingerprint(config->fingerprint);
+    }
+    else
+    {
+        client->setInsecure();
+    }
+
+    client->setSession(&entry->session);
+
+    bool connected = client->connect(host, port);
+
+    // The session is only used during the handshake: the entry can be recycled afterwards
+    client->setSession(nullptr);
+
+    if (!connected)
+    {
+        LogErr("TLS handshake with %s:%d failed.", host, port);
+        entry->session = BearSSL::Session();
+        ssl_stop(client);
+    }
+
+    return connected;
+}
+
+void ssl_stop(BearSSL::WiFiClientSecure *client)
+{
+    client->stop();
+
+    if (sslFullRecordClient == client)
+    {
+        sslFullRecordClient = nullptr;
+    }
+}
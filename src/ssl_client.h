@@ -0,0 +1,54 @@
+#ifndef __SSL_CLIENT__
+#define __SSL_CLIENT__
+
+#include <Arduino.h>
+#include <WiFiClientSecureBearSSL.h>
+
+// Authentication of the server (AT+CIPSSLCCONF): none, or by the SHA-1 fingerprint of its certificate
+#define SSL_AUTH_NONE 0
+#define SSL_AUTH_SERVER 2
+
+#define SSL_MAX_HOST_LENGTH 128
+
+// Maximum fragment length requested to the server (bytes), 0 to keep the standard 16 KB records
+#define SSL_DEFAULT_MFLN 1024
+
+/**
+ * @brief TLS settings of a client.
+ */
+typedef struct _ssl_config
+{
+    uint8_t auth_mode;
+    uint16_t mfln;
+    uint8_t fingerprint[20];
+} SSL_CONFIG;
+
+extern const SSL_CONFIG ssl_default_config;
+
+/**
+ * @brief Checks a maximum fragment length: 0, 512, 1024, 2048 or 4096.
+ */
+bool ssl_valid_mfln(int mfln);
+
+/**
+ * @brief Parses a SHA-1 fingerprint: 40 hexadecimal digits, bytes optionally separated by ':'.
+ */
+bool ssl_parse_fingerprint(const char *text, uint8_t fingerprint[20]);
+
+/**
+ * @brief Establishes a TLS connection (blocking).
+ *  The session of the last connection to the same host and port, with the same authentication,
+ *  is resumed when the server accepts it, which skips the key exchange. The receive buffer is
+ *  reduced to the maximum fragment length when the server supports it; otherwise it takes a full
+ *  16 KB record, and only one client at a time may hold such a buffer.
+ *
+ * @return true once the handshake is complete.
+ */
+bool ssl_connect(BearSSL::WiFiClientSecure *client, const SSL_CONFIG *config, const char *host, uint16_t port);
+
+/**
+ * @brief Closes a connection established by ssl_connect, and frees its receive buffer.
+ */
+void ssl_stop(BearSSL::WiFiClientSecure *client);
+
+#endif
@@ -1,42 +1,467 @@
 
 #include <Arduino.h>
 #include "at_parser.h"
-#include "logging.h"
-#include "Array.h"
+#include "at_log.h"
+#include "ring_buffer.h"
 
 #include "common.h"
+#include "settings.h"
 #include "tcp_ip_commands.h"
 #include "at_command_process.h"
+#include "scheduler.h"
+#include "response.h"
+#include "ssl_client.h"
+#include "net_connect.h"
+#include "counters.h"
 
 #include <ESP8266WiFi.h>
+#include <WiFiUdp.h>
 
-#define MAX_BUFFER_SIZE 1024
-#define MAX_CLIENT_COUNT 4
-#define MAX_SERVER_COUNT 4
+// Size of the link table: link IDs are in [0, MAX_LINK_COUNT)
+#ifndef MAX_LINK_COUNT
+#define MAX_LINK_COUNT 16
+#endif
+
+#if MAX_LINK_COUNT > COUNTERS_LINKS
+#error "MAX_LINK_COUNT exceeds COUNTERS_LINKS, the links would not have counters"
+#endif
+
+// Receive buffers of the links, shared evenly by the links allowed by AT+CIPSERVERMAXCONN
+#ifndef LINK_BUFFER_POOL_SIZE
+#define LINK_BUFFER_POOL_SIZE 8192
+#endif
+
+#define DEFAULT_MAX_LINKS 4
+
+// Link states: a link is reserved while its outgoing connection is established (AT+CIPSTART)
+#define LINK_FREE 0
+#define LINK_CONNECTING 1
+#define LINK_OPEN 2
+
+#define LINK_TCP 0
+#define LINK_UDP 1
+#define LINK_SSL 2
+
+// TLS links open at the same time: each one holds a BearSSL context and its record buffers on the heap
+#ifndef MAX_SSL_LINKS
+#define MAX_SSL_LINKS 2
+#endif
+
+// Remote of a UDP link (AT+CIPSTART): fixed, set by the first datagram received, or by each datagram received
+#define UDP_REMOTE_FIXED 0
+#define UDP_REMOTE_ONCE 1
+#define UDP_REMOTE_ANY 2
+
+// Timeout of each step of AT+CIPSTART: name resolution, then TCP or TLS handshake
+#define CONNECT_TIMEOUT_MS 5000
+
+// Largest payload of an AT+CIPSEND on a UDP link (one datagram)
+#define UDP_MAX_DATAGRAM 2048
+
+// Connections held while all the links are used (AT+CIPSERVERMAXCONN), and how long they wait for a free link
+#define MAX_ACCEPT_QUEUE 4
+#define ACCEPT_QUEUE_TIMEOUT_MS 10000
+
+// Maximum number of bytes moved from a client to its buffer per loop, so that every channel gets its turn
+#define CHANNEL_READ_QUANTUM 512
+
+// Receive modes (AT+CIPRECVMODE)
+#define RECV_MODE_ACTIVE 0
+#define RECV_MODE_PASSIVE 1
+
+// Active mode: default size and latency bounds used to coalesce received data in +IPD frames
+#define IPD_DEFAULT_MAX_LEN 1024
+#define IPD_DEFAULT_MAX_LATENCY_MS 10
+
+// Maximum time without any byte received from the UART while sending data
+#define SEND_DATA_TIMEOUT_MS 10000
+
+// Bytes forwarded from the UART by one call of process_pending_send (the UART RX buffer size)
+#define SEND_DATA_MAX_PER_LOOP 4096
+
+// Transparent transmission: UART data is sent as soon as a packet is full or the UART is idle
+#define PASSTHROUGH_PACKET_SIZE 2048
+#define PASSTHROUGH_IDLE_FLUSH_MS 20
+#define PASSTHROUGH_ESCAPE "+++"
 
 bool tcpServerStarted = false;
 WiFiServer *tcpServer = nullptr;
 
-Array<WiFiClient, MAX_CLIENT_COUNT> tcpClients;
+/**
+ * @brief Link slot. The link ID is the index of the slot: it does not change while the connection is open.
+ */
+typedef struct _link
+{
+    uint8_t state;
+    uint8_t type;
+    WiFiClient client;
+    BearSSL::WiFiClientSecure *secure;  // SSL links
+    WiFiUDP *udp;
+    IPAddress remote_ip;        // UDP links
+    uint16_t remote_port;
+    uint8_t udp_mode;
+    uint16_t datagrams;         // UDP links: number of datagrams in the buffer
+    RING_BUFFER rx;
+    unsigned long rx_since;
+} LINK;
+
+LINK links[MAX_LINK_COUNT];
+
+/**
+ * @brief TLS settings of the links, set by AT+CIPSSLCCONF and used by the next AT+CIPSTART.
+ */
+SSL_CONFIG sslConfig[MAX_LINK_COUNT];
+
+/**
+ * @brief Header of a datagram in the buffer of a UDP link, followed by its payload.
+ *  Datagrams keep their boundaries and source address until delivered.
+ */
+typedef struct _datagram_header
+{
+    uint32_t ip;
+    uint16_t port;
+    uint16_t len;
+} DATAGRAM_HEADER;
+
+/**
+ * @brief Number of links accepted by the server, and number of connections queued when they are all used.
+ */
+int maxLinks = DEFAULT_MAX_LINKS;
+int acceptQueueSize = 0;
+
+struct
+{
+    WiFiClient client;
+    unsigned long accepted_at;
+} acceptQueue[MAX_ACCEPT_QUEUE];
+
+int acceptQueueCount = 0;
+
+/**
+ * @brief Multiple connections mode set by AT+CIPMUX (0: single connection, on link 0).
+ */
+int muxMode = 1;
+
+/**
+ * @brief Outgoing TCP connection of the AT+CIPSTART in progress.
+ */
+struct
+{
+    int link;
+    char host[65];
+    uint16_t port;
+    NET_CONNECT connect;
+} pendingConnect;
 
 char TCP_TX_BUFFER[4096] = {};
-char TCP_RX_BUFFER[MAX_CLIENT_COUNT][MAX_BUFFER_SIZE] = {};
-int TCP_RX_BYTES[MAX_CLIENT_COUNT] = {};
+uint8_t LINK_BUFFER_POOL[LINK_BUFFER_POOL_SIZE] = {};
+
+/**
+ * @brief Receive mode set by AT+CIPRECVMODE, and +IPD coalescing bounds of the active mode.
+ */
+int receiveMode = RECV_MODE_PASSIVE;
+int ipdMaxLen = IPD_DEFAULT_MAX_LEN;
+int ipdMaxLatency = IPD_DEFAULT_MAX_LATENCY_MS;
+
+/**
+ * @brief State of an AT+CIPSEND in progress.
+ *  The payload is forwarded to the client chunk by chunk as it arrives on the UART.
+ */
+struct
+{
+    bool active;
+    int link;
+    unsigned long remaining;
+    unsigned long last_activity;
+} pendingSend;
+
+/**
+ * @brief Transmission mode set by AT+CIPMODE (0: normal, 1: transparent).
+ */
+int transmissionMode = 0;
+
+/**
+ * @brief State of the transparent transmission (AT+CIPMODE=1 then AT+CIPSEND).
+ *  UART data is batched in TCP_TX_BUFFER, and TCP data is written straight to the UART.
+ */
+struct
+{
+    bool active;
+    int link;
+    WiFiClient *client;
+    size_t pending;
+    unsigned long last_rx;
+    bool idle_before_batch;
+} passthrough;
+
+/**
+ * @brief Splits the buffer pool between the links accepted by the server.
+ *  Must not be called while links are open.
+ */
+void configure_links(int count)
+{
+    uint16_t size = (LINK_BUFFER_POOL_SIZE / count) & ~3;
+
+    maxLinks = count;
+
+    for (int i = 0; i < MAX_LINK_COUNT; i++)
+    {
+        rb_init(&links[i].rx, i < count ? LINK_BUFFER_POOL + i * size : NULL, i < count ? size : 0);
+        links[i].datagrams = 0;
+    }
+}
+
+int open_links()
+{
+    int count = 0;
+
+    for (int i = 0; i < MAX_LINK_COUNT; i++)
+    {
+        count += links[i].state != LINK_FREE;
+    }
+
+    return count;
+}
+
+/**
+ * @brief Prints a link event: <link ID>,<event>, or <event> alone in single connection mode.
+ */
+void print_link_event(int linkID, const char *event)
+{
+    if (muxMode)
+    {
+        response_printf("%d,%s\n", linkID, event);
+    }
+    else
+    {
+        response_println(event);
+    }
+}
 
 /**
- * @brief Registers the WiFi Client channel for further processing.
+ * @brief Registers the WiFi Client in the first free link.
  *
  * @param client
- * @return int representing the channel ID for the client.
+ * @return the link ID, or -1 if all the links are used.
  */
 int register_client(WiFiClient client)
 {
-    LogDebug("Registering client %s:%d in channel %d", client.remoteIP().toString().c_str(), client.remotePort(), tcpClients.size());
-    tcpClients.push_back(client);
+    for (int linkID = 0; linkID < maxLinks; linkID++)
+    {
+        if (links[linkID].state != LINK_FREE)
+        {
+            continue;
+        }
+
+        LogDebug("Registering client %s:%d in link %d", client.remoteIP().toString().c_str(), client.remotePort(), linkID);
+
+        links[linkID].state = LINK_OPEN;
+        links[linkID].type = LINK_TCP;
+        links[linkID].client = client;
+        links[linkID].rx_since = millis();
+        links[linkID].datagrams = 0;
+        rb_clear(&links[linkID].rx);
+        counter_add(COUNTER_LINKS_ACCEPTED, 1);
+
+        print_link_event(linkID, "CONNECT");
+
+        return linkID;
+    }
+
+    return -1;
+}
+
+void complete_pending_send(bool success);
+void close_link(int linkID);
+
+/**
+ * @brief Frees a link, and fails the AT+CIPSEND in progress on it.
+ */
+void release_link(int linkID)
+{
+    LINK *link = &links[linkID];
+
+    if (pendingSend.active && pendingSend.link == linkID)
+    {
+        LogErr("Link %d closed while sending data.", linkID);
+        complete_pending_send(false);
+    }
+
+    if (link->udp != nullptr)
+    {
+        link->udp->stop();
+        delete link->udp;
+        link->udp = nullptr;
+    }
+
+    if (link->secure != nullptr)
+    {
+        ssl_stop(link->secure);
+        delete link->secure;
+        link->secure = nullptr;
+    }
+
+    link->state = LINK_FREE;
+    link->client = WiFiClient();
+    link->datagrams = 0;
+    rb_clear(&link->rx);
+
+    print_link_event(linkID, "CLOSED");
+}
+
+/**
+ * @brief Client of a TCP or SSL link.
+ */
+WiFiClient *link_client(LINK *link)
+{
+    return link->secure != nullptr ? link->secure : &link->client;
+}
+
+IPAddress link_remote_ip(LINK *link)
+{
+    return link->type == LINK_UDP ? link->remote_ip : link_client(link)->remoteIP();
+}
+
+uint16_t link_remote_port(LINK *link)
+{
+    return link->type == LINK_UDP ? link->remote_port : link_client(link)->remotePort();
+}
+
+uint16_t link_local_port(LINK *link)
+{
+    return link->type == LINK_UDP ? link->udp->localPort() : link_client(link)->localPort();
+}
+
+int open_ssl_links()
+{
+    int count = 0;
+
+    for (int i = 0; i < MAX_LINK_COUNT; i++)
+    {
+        count += links[i].state != LINK_FREE && links[i].type == LINK_SSL;
+    }
+
+    return count;
+}
+
+/**
+ * @brief Number of bytes received on the link, datagram headers excluded.
+ */
+int link_rx_len(LINK *link)
+{
+    return rb_count(&link->rx) - link->datagrams * sizeof(DATAGRAM_HEADER);
+}
+
+/**
+ * @brief Holds a client while all the links are used, or closes it if the accept queue is full.
+ */
+void queue_client(WiFiClient client)
+{
+    if (acceptQueueCount >= acceptQueueSize)
+    {
+        LogWarn("All the %d links are used, connection from %s:%d refused.", maxLinks, client.remoteIP().toString().c_str(), client.remotePort());
+        counter_add(COUNTER_LINKS_REFUSED, 1);
+        client.stop();
+        return;
+    }
+
+    LogDebug("All the %d links are used, connection from %s:%d queued.", maxLinks, client.remoteIP().toString().c_str(), client.remotePort());
+
+    acceptQueue[acceptQueueCount].client = client;
+    acceptQueue[acceptQueueCount].accepted_at = millis();
+    acceptQueueCount++;
+}
+
+void clear_accept_queue()
+{
+    for (int i = 0; i < acceptQueueCount; i++)
+    {
+        acceptQueue[i].client.stop();
+        acceptQueue[i].client = WiFiClient();
+    }
+
+    acceptQueueCount = 0;
+}
+
+/**
+ * @brief Gives the free links to the queued clients, oldest first.
+ *  The clients that closed or waited for more than ACCEPT_QUEUE_TIMEOUT_MS are dropped.
+ */
+void process_accept_queue()
+{
+    int kept = 0;
+
+    for (int i = 0; i < acceptQueueCount; i++)
+    {
+        WiFiClient client = acceptQueue[i].client;
+
+        acceptQueue[i].client = WiFiClient();
+
+        if (!client.connected() || register_client(client) >= 0)
+        {
+            continue;
+        }
+
+        if (millis() - acceptQueue[i].accepted_at > ACCEPT_QUEUE_TIMEOUT_MS)
+        {
+            LogWarn("No free link for %s:%d, connection closed.", client.remoteIP().toString().c_str(), client.remotePort());
+            counter_add(COUNTER_LINKS_REFUSED, 1);
+            client.stop();
+            continue;
+        }
+
+        acceptQueue[kept].client = client;
+        acceptQueue[kept].accepted_at = acceptQueue[i].accepted_at;
+        kept++;
+    }
+
+    acceptQueueCount = kept;
+}
+
+void start_tcp_server(uint16_t port)
+{
+    if (tcpServerStarted == true)
+    {
+        tcpServer->close();
+        delete tcpServer;
+    }
+
+    tcpServer = new WiFiServer(port);
+    tcpServer->begin();
+    tcpServerStarted = true;
+}
+
+uint16_t tcp_server_port()
+{
+    return tcpServerStarted ? tcpServer->port() : 0;
+}
+
+void restore_tcp_ip_settings()
+{
+    if (settings.max_links >= 1 && settings.max_links <= MAX_LINK_COUNT)
+    {
+        configure_links(settings.max_links);
+    }
+
+    acceptQueueSize = settings.accept_queue <= MAX_ACCEPT_QUEUE ? settings.accept_queue : 0;
 
-    return tcpClients.size() - 1;
+    if (settings.server_port != 0)
+    {
+        start_tcp_server(settings.server_port);
+    }
 }
 
+typedef struct _server_args
+{
+    long mode;
+    long port;
+} SERVER_ARGS;
+
+static const AT_ARG_SPEC server_args[] = {
+    AT_ARG_INT(SERVER_ARGS, mode, AT_ARG_REQUIRED, 0, 1),
+    AT_ARG_INT(SERVER_ARGS, port, AT_ARG_REQUIRED, 1, 65535),
+};
+
 /**
  * Sets the server port to listen for incoming TCP connections.
  *
@@ -44,383 +469,1467 @@ int register_client(WiFiClient client)
  */
 char set_server(char *value)
 {
-    int mode;
-    int port;
+    SERVER_ARGS args = {};
+
+    if (!parse_command_args(value, server_args, AT_ARG_COUNT(server_args), &args))
+    {
+        return AT_ERROR;
+    }
 
-    sscanf(value, "%d,%d", &mode, &port);
+    int mode = args.mode;
+    int port = args.port;
 
     if (mode == 1)
+    {
+        if (!muxMode)
+        {
+            LogWarn("AT+CIPSERVER requires AT+CIPMUX=1.");
+            return AT_ERROR;
+        }
+
+        if (tcpServerStarted == true && tcpServer->port() == port)
+        {
+            return AT_OK;
+        }
+
+        start_tcp_server(port);
+
+        settings.server_port = port;
+        save_settings();
+
+        return AT_OK;
+    }
+    else if (mode == 0)
     {
         if (tcpServerStarted == true)
         {
-            if (tcpServer->port() == port)
+            if (tcpServer->port() != port)
             {
                 return AT_OK;
             }
 
-            tcpServer->close();
-            delete tcpServer;
-            tcpServer = nullptr;
-            tcpServerStarted = false;
-        }
+            tcpServer->close();
+            delete tcpServer;
+            tcpServer = nullptr;
+            tcpServerStarted = false;
+            clear_accept_queue();
+
+            settings.server_port = 0;
+            save_settings();
+
+            return AT_OK;
+        }
+
+        return AT_OK;
+    }
+
+    return AT_ERROR;
+}
+
+/**
+ * Gets the servers.
+ *
+ * @param AT+CIPSERVER?
+ *
+ * @returns +CIPSERVER:<mode>,<port>
+ */
+char get_server(char *value)
+{
+    if (tcpServerStarted == false)
+    {
+        return AT_OK;
+    }
+
+    sprintf(value, "+CIPSERVER:%d,%d", tcpServer->status(), tcpServer->port());
+
+    return AT_OK;
+}
+
+/**
+ * Get Station IP information.
+ *
+ * @param AT+CIPSTA?
+ * @returns
+ * +CIPSTA:ip:<"ip">
+ * +CIPSTA:gateway:<"gateway">
+ * +CIPSTA:netmask:<"netmask">
+ */
+char get_sta_ip_info(char *value)
+{
+    sprintf(value, "+CIPSTA:%s,%s,%s",
+            WiFi.localIP().toString().c_str(),
+            WiFi.gatewayIP().toString().c_str(),
+            WiFi.subnetMask().toString().c_str());
+
+    return AT_OK;
+}
+
+/**
+ * @brief Obtain Socket Data Length in Passive Receiving Mode
+ *
+ * @param AT+CIPRECVLEN?
+ * @returns +CIPRECVLEN:<length>
+ */
+char get_server_data_len(char *value)
+{
+    LogTrace("%d clients are connected.", open_links());
+
+    for (int i = 0; i < MAX_LINK_COUNT; i++)
+    {
+        if (links[i].state == LINK_OPEN)
+        {
+            response_printf("+CIPRECVLEN:%d,%d\n", i, link_rx_len(&links[i]));
+        }
+    }
+
+    return AT_OK;
+}
+
+/**
+ * @brief Writes len bytes of the channel buffer to the UART and consumes them.
+ *  The data is written straight from the buffer (at most two contiguous segments), whatever its content.
+ */
+void write_channel_data(RING_BUFFER *buffer, int len)
+{
+    while (len > 0)
+    {
+        const uint8_t *segment;
+        int n = rb_peek_contiguous(buffer, &segment);
+
+        if (n > len)
+        {
+            n = len;
+        }
+
+        response_write(segment, n);
+        rb_consume(buffer, n);
+        len -= n;
+    }
+}
+
+/**
+ * @brief Writes the next datagram of a UDP link (passive receive mode).
+ *  As with recvfrom(), the part of the datagram beyond len is discarded.
+ *
+ * @return +CIPRECVDATA:<chan>,<a_len>,<remote_ip>,<remote_port>,<data>
+ */
+char get_datagram(int chan, int len)
+{
+    LINK *link = &links[chan];
+    DATAGRAM_HEADER header = {link->remote_ip, link->remote_port, 0};
+
+    if (link->datagrams > 0)
+    {
+        rb_read(&link->rx, (uint8_t *)&header, sizeof(header));
+        link->datagrams--;
+    }
+
+    if (len > header.len)
+    {
+        len = header.len;
+    }
+
+    response_printf("+CIPRECVDATA:%d,%d,%s,%d\n", chan, len, IPAddress(header.ip).toString().c_str(), header.port);
+    write_channel_data(&link->rx, len);
+    rb_consume(&link->rx, header.len - len);
+
+    return AT_OK;
+}
+
+typedef struct _receive_args
+{
+    long chan;
+    long len;
+} RECEIVE_ARGS;
+
+static const AT_ARG_SPEC receive_args[] = {
+    AT_ARG_INT(RECEIVE_ARGS, chan, AT_ARG_REQUIRED, 0, MAX_LINK_COUNT - 1),
+    AT_ARG_INT(RECEIVE_ARGS, len, AT_ARG_REQUIRED, 1, INT_MAX),
+};
+
+/**
+ * @brief Obtain Socket Data in Passive Receiving Mode
+ *
+ * @param AT+CIPRECVDATA=<chan>,<len>
+ * @returns +CIPRECVDATA=<chan>,<a_len>,<remote_ip>,<remote_port>,<data>
+ *
+ */
+char get_server_data(char *value)
+{
+    RECEIVE_ARGS args = {};
+
+    // Without <chan> in single connection mode
+    if (!parse_command_args(value, receive_args + !muxMode, AT_ARG_COUNT(receive_args) - !muxMode, &args))
+    {
+        return AT_ERROR;
+    }
+
+    int chan = args.chan;
+    int len = args.len;
+
+    if (links[chan].state != LINK_OPEN)
+    {
+        return AT_ERROR;
+    }
+
+    LogTrace("Reading %d bytes from channel %d", len, chan);
+
+    if (links[chan].type == LINK_UDP)
+    {
+        return get_datagram(chan, len);
+    }
+
+    RING_BUFFER *buffer = &links[chan].rx;
+
+    if (len > (int)rb_count(buffer))
+    {
+        LogTrace("Actual length of the received data of channel %d is less than %d, the actual length %d will be returned.", chan, len, rb_count(buffer));
+        len = rb_count(buffer);
+    }
+
+    response_printf("+CIPRECVDATA:%d,%d,%s,%d\n", chan, len, link_remote_ip(&links[chan]).toString().c_str(), link_remote_port(&links[chan]));
+    write_channel_data(buffer, len);
+
+    return AT_OK;
+}
+
+/**
+ * @brief Sends the datagrams buffered for the UDP link, one +IPD frame each (active receive mode).
+ *  The payload is written to the UART straight from the link buffer.
+ *
+ * @return +IPD,<link ID>,<len>,<remote ip>,<remote port>:<data>
+ */
+void deliver_datagrams(int channelID)
+{
+    LINK *link = &links[channelID];
+    DATAGRAM_HEADER header;
+
+    while (link->datagrams > 0)
+    {
+        rb_read(&link->rx, (uint8_t *)&header, sizeof(header));
+        link->datagrams--;
+
+        response_println("");
+
+        if (muxMode)
+        {
+            response_printf("+IPD,%d,%d,%s,%d:", channelID, header.len, IPAddress(header.ip).toString().c_str(), header.port);
+        }
+        else
+        {
+            response_printf("+IPD,%d,%s,%d:", header.len, IPAddress(header.ip).toString().c_str(), header.port);
+        }
+
+        write_channel_data(&link->rx, header.len);
+    }
+}
+
+/**
+ * @brief Sends the data buffered for the channel in +IPD frames (active receive mode).
+ *  Small segments are coalesced: a frame is sent once ipdMaxLen bytes are buffered, once the
+ *  oldest byte has waited for ipdMaxLatency ms, or when flush is set.
+ *  The frame payload is written to the UART straight from the channel buffer.
+ *
+ * @return +IPD,<link ID>,<len>:<data>
+ */
+void deliver_channel_data(int channelID, bool flush)
+{
+    RING_BUFFER *buffer = &links[channelID].rx;
+
+    if (links[channelID].type == LINK_UDP)
+    {
+        deliver_datagrams(channelID);
+        return;
+    }
+
+    // The frames can not be larger than the link buffer
+    int maxLen = ipdMaxLen < buffer->size ? ipdMaxLen : buffer->size;
+
+    while (rb_count(buffer) > 0)
+    {
+        if (!flush && rb_count(buffer) < maxLen && millis() - links[channelID].rx_since < (unsigned long)ipdMaxLatency)
+        {
+            return;
+        }
+
+        int len = rb_count(buffer) < maxLen ? rb_count(buffer) : maxLen;
+
+        response_println("");
+
+        if (muxMode)
+        {
+            response_printf("+IPD,%d,%d:", channelID, len);
+        }
+        else
+        {
+            response_printf("+IPD,%d:", len);
+        }
+
+        write_channel_data(buffer, len);
+
+        links[channelID].rx_since = millis();
+    }
+}
+
+/**
+ * @brief Frees the links whose connection is closed. The other links keep their ID.
+ */
+void remove_closed_tcp_clients()
+{
+    for (int channelID = 0; channelID < MAX_LINK_COUNT; channelID++)
+    {
+        // UDP links are only closed by AT+CIPCLOSE
+        if (links[channelID].state != LINK_OPEN || links[channelID].type == LINK_UDP)
+        {
+            continue;
+        }
+
+        WiFiClient *client = link_client(&links[channelID]);
+
+        if (client->status() == CLOSED || !client->connected())
+        {
+            LogTrace("Client on channel %d is not connected.", channelID);
+
+            if (receiveMode == RECV_MODE_ACTIVE)
+            {
+                deliver_channel_data(channelID, true);
+            }
+
+            release_link(channelID);
+        }
+    }
+}
+
+/**
+ * @brief Moves the datagrams received on a UDP link to its buffer: a header with the length and
+ *  the source address, then the payload, read from the socket straight into the buffer.
+ *  Datagrams that do not fit in the buffer are dropped. The remote of the link follows the
+ *  source of the datagrams in the UDP_REMOTE_ONCE and UDP_REMOTE_ANY modes.
+ *
+ * @return the number of bytes received.
+ */
+int receive_datagrams(int channelID)
+{
+    LINK *link = &links[channelID];
+    int received = 0;
+
+    while (received < CHANNEL_READ_QUANTUM)
+    {
+        int size = link->udp->parsePacket();
+
+        if (size <= 0)
+        {
+            break;
+        }
+
+        if (size + sizeof(DATAGRAM_HEADER) > rb_free(&link->rx))
+        {
+            LogWarn("Buffer of channel %d is full, datagram of %d bytes dropped.", channelID, size);
+            counter_add(COUNTER_RX_DROPPED_BYTES, size);
+            link_counters[channelID].dropped_bytes += size;
+            continue;
+        }
+
+        DATAGRAM_HEADER header = {link->udp->remoteIP(), link->udp->remotePort(), (uint16_t)size};
+
+        rb_write(&link->rx, (uint8_t *)&header, sizeof(header));
+
+        while (size > 0)
+        {
+            uint8_t *segment;
+            int len = rb_write_contiguous(&link->rx, &segment);
+
+            if (len > size)
+            {
+                len = size;
+            }
+
+            int read = link->udp->read(segment, len);
+
+            // The header gives the length: a short read is padded
+            if (read < len)
+            {
+                memset(segment + (read > 0 ? read : 0), 0, len - (read > 0 ? read : 0));
+            }
+
+            rb_commit(&link->rx, len);
+            size -= len;
+        }
+
+        link->datagrams++;
+        received += header.len;
+        link_counters[channelID].rx_bytes += header.len;
+
+        if (link->udp_mode != UDP_REMOTE_FIXED)
+        {
+            link->remote_ip = header.ip;
+            link->remote_port = header.port;
+
+            if (link->udp_mode == UDP_REMOTE_ONCE)
+            {
+                link->udp_mode = UDP_REMOTE_FIXED;
+            }
+        }
+    }
+
+    return received;
+}
+
+/**
+ * @brief Moves the data received by the client of the channel to the channel buffer.
+ *  At most CHANNEL_READ_QUANTUM bytes are read. When the channel buffer is full, the data is
+ *  left in the TCP stack: the TCP window closes until the host reads the channel.
+ *
+ * @return the number of bytes received.
+ */
+int receive_channel_data(int channelID)
+{
+    RING_BUFFER *buffer = &links[channelID].rx;
+
+    WiFiClient *client = link_client(&links[channelID]);
+    int available = client->available();
+
+    if (!available)
+    {
+        return 0;
+    }
+
+    if (rb_free(buffer) == 0)
+    {
+        LogTrace("Buffer of channel %d is full, %d bytes left in the TCP stack.", channelID, available);
+        counter_add(COUNTER_RX_BUFFER_FULL, 1);
+        link_counters[channelID].buffer_full++;
+        return 0;
+    }
+
+    if (rb_count(buffer) == 0)
+    {
+        links[channelID].rx_since = millis();
+    }
+
+    int received = 0;
+
+    while (available > 0 && received < CHANNEL_READ_QUANTUM)
+    {
+        uint8_t *segment;
+        int len = rb_write_contiguous(buffer, &segment);
+
+        if (len > available)
+        {
+            len = available;
+        }
+
+        if (len > CHANNEL_READ_QUANTUM - received)
+        {
+            len = CHANNEL_READ_QUANTUM - received;
+        }
+
+        if (len == 0)
+        {
+            break;
+        }
+
+        int read = client->read(segment, len);
+
+        if (read <= 0)
+        {
+            break;
+        }
+
+        rb_commit(buffer, read);
+        received += read;
+        available -= read;
+    }
+
+    if (received > 0)
+    {
+        link_counters[channelID].rx_bytes += received;
+        LogTrace("Got %d bytes on channel %d - Now %d bytes are waiting.", received, channelID, rb_count(buffer));
+    }
+
+    return received;
+}
+
+/**
+ * @brief Process the TCP Clients
+ *  it checks for each connected clients if some data are present and moves it to the channel buffer.
+ *  In passive receive mode, the host is notified with +CIPRECVLEN:<chan>,<len>; in active receive
+ *  mode, the data is sent in +IPD frames.
+ *
+ *  Channels are serviced in turn, starting from a different channel on each call.
+ */
+void process_existing_channels()
+{
+    static int firstChannel = 0;
+
+    remove_closed_tcp_clients();
+
+    for (int n = 0; n < MAX_LINK_COUNT; n++)
+    {
+        int channelID = (firstChannel + n) % MAX_LINK_COUNT;
+
+        // The link of the transparent transmission is read by process_passthrough
+        if (links[channelID].state != LINK_OPEN || (passthrough.active && channelID == passthrough.link))
+        {
+            continue;
+        }
+
+        int received = links[channelID].type == LINK_UDP ? receive_datagrams(channelID) : receive_channel_data(channelID);
+
+        if (receiveMode == RECV_MODE_ACTIVE)
+        {
+            deliver_channel_data(channelID, false);
+        }
+        else if (received > 0)
+        {
+            response_printf("+CIPRECVLEN:%d,%d\r\n", channelID, link_rx_len(&links[channelID]));
+        }
+    }
+
+    firstChannel = (firstChannel + 1) % MAX_LINK_COUNT;
+}
+
+/**
+ * @brief Ends the AT+CIPSEND in progress and gives the UART back to the AT command processor.
+ */
+void complete_pending_send(bool success)
+{
+    pendingSend.active = false;
+    stop_at_processing = false;
+
+    response_println(success ? "SEND OK" : "SEND FAIL");
+    complete_at_command(success ? AT_OK : AT_ERROR);
+}
+
+/**
+ * @brief Forwards the payload of the AT+CIPSEND in progress.
+ *  Reads what is available on the UART, without exceeding what the client can accept,
+ *  and writes it to the client right away.
+ */
+void process_pending_send()
+{
+    if (!pendingSend.active)
+    {
+        return;
+    }
+
+    LINK *link = &links[pendingSend.link];
+
+    if (link->type != LINK_UDP && !link_client(link)->connected())
+    {
+        LogErr("Client disconnected while sending data.");
+        complete_pending_send(false);
+        return;
+    }
+
+    // Drains the UART as long as the connection accepts data, so that high baud rates keep up
+    size_t sent = 0;
+
+    while (pendingSend.remaining > 0 && sent < SEND_DATA_MAX_PER_LOOP)
+    {
+        size_t chunk = pendingSend.remaining < sizeof(TCP_TX_BUFFER) ? pendingSend.remaining : sizeof(TCP_TX_BUFFER);
+        size_t room = link->type != LINK_UDP ? link_client(link)->availableForWrite() : chunk;
+
+        if (chunk > room)
+        {
+            chunk = room;
+        }
+
+        size_t read = chunk > 0 ? read_at_input(TCP_TX_BUFFER, chunk) : 0;
+
+        if (read == 0)
+        {
+            break;
+        }
+
+        LogTrace("Sending %d bytes, %lu remaining", read, pendingSend.remaining - read);
+
+        size_t written = link->type != LINK_UDP ? link_client(link)->write((const uint8_t *)TCP_TX_BUFFER, read) : link->udp->write((uint8_t *)TCP_TX_BUFFER, read);
+
+        if (written != read)
+        {
+            LogErr("Failed to send %u bytes", (unsigned int)read);
+            complete_pending_send(false);
+            return;
+        }
+
+        pendingSend.remaining -= read;
+        sent += read;
+        link_counters[pendingSend.link].tx_bytes += read;
+    }
+
+    if (sent == 0)
+    {
+        if (millis() - pendingSend.last_activity > SEND_DATA_TIMEOUT_MS)
+        {
+            LogErr("Timeout while waiting for data to send (%lu bytes missing).", pendingSend.remaining);
+            complete_pending_send(false);
+        }
+
+        return;
+    }
+
+    pendingSend.last_activity = millis();
+
+    if (pendingSend.remaining == 0)
+    {
+        complete_pending_send(link->type != LINK_UDP || link->udp->endPacket());
+    }
+}
+
+/**
+ * @brief Leaves the transparent transmission and gives the UART back to the AT command processor.
+ */
+void stop_passthrough()
+{
+    passthrough.active = false;
+    passthrough.client = nullptr;
+    stop_at_processing = false;
+
+    LogDebug("Transparent transmission stopped.");
+}
+
+/**
+ * @brief Sends the batched UART data to the client.
+ *
+ * @return false if the client did not accept the data.
+ */
+bool flush_passthrough()
+{
+    size_t sent = passthrough.client->write(TCP_TX_BUFFER, passthrough.pending);
+    link_counters[passthrough.link].tx_bytes += sent;
+
+    if (sent != passthrough.pending)
+    {
+        LogErr("Failed to send %u bytes", (unsigned int)passthrough.pending);
+        return false;
+    }
+
+    passthrough.pending = 0;
+    return true;
+}
+
+/**
+ * @brief Leaves the transparent transmission after a failed send: the data can no longer be
+ *  delivered in order, so the link is closed and the host notified with CLOSED.
+ */
+void abort_passthrough()
+{
+    int linkID = passthrough.link;
+
+    passthrough.pending = 0;
+    stop_passthrough();
+    close_link(linkID);
+}
+
+/**
+ * @brief Pipes data between the UART and the client in transparent transmission.
+ *  UART data is batched and sent when the batch is full or when the UART has been
+ *  idle for PASSTHROUGH_IDLE_FLUSH_MS. A batch made of "+++" alone, surrounded by
+ *  idle periods, ends the transparent transmission.
+ */
+void process_passthrough()
+{
+    char chunk[128];
+
+    // The link is released, and CLOSED reported, by remove_closed_tcp_clients
+    if (!passthrough.client->connected())
+    {
+        stop_passthrough();
+        return;
+    }
+
+    // TCP -> UART
+    while (passthrough.client->available() > 0 && response_room() > 0)
+    {
+        size_t room = response_room();
+        int read = passthrough.client->read((uint8_t *)chunk, room < sizeof(chunk) ? room : sizeof(chunk));
+
+        if (read <= 0)
+        {
+            break;
+        }
+
+        response_write((const uint8_t *)chunk, read);
+        link_counters[passthrough.link].rx_bytes += read;
+    }
+
+    // UART -> TCP
+    size_t read = read_at_input(TCP_TX_BUFFER + passthrough.pending, PASSTHROUGH_PACKET_SIZE - passthrough.pending);
+
+    if (read > 0)
+    {
+        if (passthrough.pending == 0)
+        {
+            passthrough.idle_before_batch = millis() - passthrough.last_rx >= PASSTHROUGH_IDLE_FLUSH_MS;
+        }
+
+        passthrough.pending += read;
+        passthrough.last_rx = millis();
+
+        if (passthrough.pending == PASSTHROUGH_PACKET_SIZE && !flush_passthrough())
+        {
+            abort_passthrough();
+        }
+
+        return;
+    }
+
+    if (passthrough.pending == 0 || millis() - passthrough.last_rx < PASSTHROUGH_IDLE_FLUSH_MS)
+    {
+        return;
+    }
+
+    if (passthrough.idle_before_batch &&
+        passthrough.pending == strlen(PASSTHROUGH_ESCAPE) &&
+        memcmp(TCP_TX_BUFFER, PASSTHROUGH_ESCAPE, passthrough.pending) == 0)
+    {
+        passthrough.pending = 0;
+        stop_passthrough();
+        return;
+    }
+
+    if (!flush_passthrough())
+    {
+        abort_passthrough();
+    }
+}
+
+/**
+ * @brief Realizes the tcp connection processing.
+ *  If a client is connected, it registers the client as a channel and read its incoming data.
+ *  During the transparent transmission, the other links and the accept queue are still serviced.
+ */
+void process_tcp_server()
+{
+    if (passthrough.active)
+    {
+        process_passthrough();
+    }
+
+    process_pending_send();
+    process_existing_channels();
+
+    if (!tcpServerStarted)
+    {
+        return;
+    }
+
+    process_accept_queue();
+
+    if (!tcpServer->hasClient())
+    {
+        return;
+    }
+
+    WiFiClient client = tcpServer->available();
+
+    if (!client)
+    {
+        LogTrace("TcpServer has client but unable to get the available client.");
+        return;
+    }
+
+    if (!client.connected())
+    {
+        LogTrace("Client is not connected.");
+        return;
+    }
+
+    if (acceptQueueCount > 0 || register_client(client) < 0)
+    {
+        queue_client(client);
+    }
+}
+
+/**
+ * @brief Get the connections status
+ *
+ * @param AT+CIPSTATE?
+ * @return +CIPSTATE:<link ID>,<remote IP>,<remote port>,<local port>
+ */
+char get_connections_status(char *value)
+{
+    for (int i = 0; i < MAX_LINK_COUNT; i++)
+    {
+        if (links[i].state != LINK_OPEN)
+        {
+            continue;
+        }
+
+        response_printf("+CIPSTATE:%d,%s,%d,%d\r\n", i, link_remote_ip(&links[i]).toString().c_str(), link_remote_port(&links[i]), link_local_port(&links[i]));
+    }
+
+    return AT_OK;
+}
+
+typedef struct _send_args
+{
+    long chan;
+    long len;
+    char host[65];
+    long port;
+} SEND_ARGS;
+
+static const AT_ARG_SPEC send_args[] = {
+    AT_ARG_INT(SEND_ARGS, chan, AT_ARG_REQUIRED, 0, MAX_LINK_COUNT - 1),
+    AT_ARG_INT(SEND_ARGS, len, AT_ARG_REQUIRED, 1, LONG_MAX),
+    AT_ARG_STRING(SEND_ARGS, host, AT_ARG_OPTIONAL),
+    AT_ARG_INT(SEND_ARGS, port, AT_ARG_OPTIONAL, 1, 65535),
+};
+
+/**
+ * @brief Sends the data to the client at specified channel.
+ *  The command returns immediately; the payload is then streamed to the client
+ *  from the main loop as it is received (see process_pending_send).
+ *
+ * @param AT+CIPSEND=<link_ID>,<length>[,<"remote host">,<remote port>] (without <link_ID> in single connection mode)
+ *  The remote host and port only apply to UDP links: the datagram is sent to them instead of the link remote.
+ * @return  OK
+ *          >
+ *          ...
+ *          SEND OK
+ */
+char send_data(char *value)
+{
+    SEND_ARGS args = {};
+
+    // Without <link_ID> in single connection mode
+    if (!parse_command_args(value, send_args + !muxMode, AT_ARG_COUNT(send_args) - !muxMode, &args))
+    {
+        return AT_ERROR;
+    }
+
+    unsigned long len = args.len;
+    int chan = args.chan;
+    const char *host = args.host;
+    int port = args.port;
+
+    if (transmissionMode != 0)
+    {
+        return AT_ERROR;
+    }
+
+    if (links[chan].state != LINK_OPEN)
+    {
+        LogWarn("Specified chan %d is not present (%d chanels currently connected).", chan, open_links());
+        return AT_ERROR;
+    }
+
+    LogTrace("Preparing to send %lu bytes to channel %d", len, chan);
+
+    LINK *link = &links[chan];
+
+    if (link->type != LINK_UDP && !link_client(link)->connected())
+    {
+        LogErr("Client is not connected.");
+        return AT_ERROR;
+    }
+
+    if (link->type == LINK_UDP)
+    {
+        IPAddress ip = link->remote_ip;
+
+        if (host[0] != '\0' && (port == 0 || !WiFi.hostByName(host, ip)))
+        {
+            return AT_ERROR;
+        }
+
+        if (len > UDP_MAX_DATAGRAM || !link->udp->beginPacket(ip, host[0] != '\0' ? port : link->remote_port))
+        {
+            return AT_ERROR;
+        }
+    }
+    else if (host[0] != '\0')
+    {
+        return AT_ERROR;
+    }
+
+    stop_at_processing = true;
+
+    pendingSend.active = true;
+    pendingSend.link = chan;
+    pendingSend.remaining = len;
+    pendingSend.last_activity = millis();
+
+    response_println("OK");
+    response_print("> ");
+
+    return AT_PENDING;
+}
+
+/**
+ * @brief Starts the transparent transmission on the first connected TCP or SSL channel (lowest link ID).
+ *
+ * @param AT+CIPSEND
+ * @return  OK
+ *          >
+ */
+char start_passthrough(char *value)
+{
+    if (transmissionMode != 1)
+    {
+        LogWarn("AT+CIPSEND without length requires AT+CIPMODE=1.");
+        return AT_ERROR;
+    }
+
+    if (muxMode)
+    {
+        LogWarn("The transparent transmission requires AT+CIPMUX=0.");
+        return AT_ERROR;
+    }
 
-        tcpServer = new WiFiServer(port);
-        tcpServer->begin();
-        tcpServerStarted = true;
+    int linkID = 0;
 
-        return AT_OK;
+    while (linkID < MAX_LINK_COUNT && (links[linkID].state != LINK_OPEN || links[linkID].type == LINK_UDP))
+    {
+        linkID++;
     }
-    else if (mode == 0)
+
+    if (linkID == MAX_LINK_COUNT || !link_client(&links[linkID])->connected())
     {
-        if (tcpServerStarted == true)
-        {
-            if (tcpServer->port() != port)
-            {
-                return AT_OK;
-            }
+        LogErr("Client is not connected.");
+        return AT_ERROR;
+    }
 
-            tcpServer->close();
-            delete tcpServer;
-            tcpServer = nullptr;
-            tcpServerStarted = false;
+    stop_at_processing = true;
 
-            return AT_OK;
-        }
+    passthrough.active = true;
+    passthrough.link = linkID;
+    passthrough.client = link_client(&links[linkID]);
+    passthrough.pending = 0;
+    passthrough.last_rx = millis();
 
-        return AT_OK;
-    }
+    response_println("OK");
+    response_println("");
+    response_print(">");
 
-    return AT_ERROR;
+    return AT_PENDING;
 }
 
 /**
- * Gets the servers.
+ * @brief Gets the transmission mode.
  *
- * @param AT+CIPSERVER?
+ * @param AT+CIPMODE?
+ * @return +CIPMODE:<mode>
+ */
+char get_transmission_mode(char *value)
+{
+    sprintf(value, "+CIPMODE:%d", transmissionMode);
+
+    return AT_OK;
+}
+
+typedef struct _mode_args
+{
+    long mode;
+} MODE_ARGS;
+
+static const AT_ARG_SPEC mode_args[] = {
+    AT_ARG_INT(MODE_ARGS, mode, AT_ARG_REQUIRED, 0, 1),
+};
+
+/**
+ * @brief Sets the transmission mode.
  *
- * @returns +CIPSERVER:<mode>,<port>
+ * @param AT+CIPMODE=<mode>
  */
-char get_server(char *value)
+char set_transmission_mode(char *value)
 {
-    if (tcpServerStarted == false)
+    MODE_ARGS args = {};
+
+    if (!parse_command_args(value, mode_args, AT_ARG_COUNT(mode_args), &args))
     {
-        return AT_OK;
+        return AT_ERROR;
     }
 
-    Serial.print("+CIPSERVER:");
-    Serial.print(tcpServer->status());
-    Serial.print(",");
-    Serial.print(tcpServer->port());
+    transmissionMode = args.mode;
 
     return AT_OK;
 }
 
 /**
- * Get Station IP information.
+ * @brief Gets the receive mode.
  *
- * @param AT+CIPSTA?
- * @returns
- * +CIPSTA:ip:<"ip">
- * +CIPSTA:gateway:<"gateway">
- * +CIPSTA:netmask:<"netmask">
+ * @param AT+CIPRECVMODE?
+ * @return +CIPRECVMODE:<mode>,<ipd_len>,<ipd_latency>
  */
-char get_sta_ip_info(char *value)
+char get_receive_mode(char *value)
 {
-    sprintf(value, "+CIPSTA:%s,%s,%s",
-            WiFi.localIP().toString().c_str(),
-            WiFi.gatewayIP().toString().c_str(),
-            WiFi.subnetMask().toString().c_str());
+    sprintf(value, "+CIPRECVMODE:%d,%d,%d", receiveMode, ipdMaxLen, ipdMaxLatency);
 
     return AT_OK;
 }
 
+typedef struct _receive_mode_args
+{
+    long mode;
+    long len;
+    long latency;
+} RECEIVE_MODE_ARGS;
+
+static const AT_ARG_SPEC receive_mode_args[] = {
+    AT_ARG_INT(RECEIVE_MODE_ARGS, mode, AT_ARG_REQUIRED, RECV_MODE_ACTIVE, RECV_MODE_PASSIVE),
+    AT_ARG_INT(RECEIVE_MODE_ARGS, len, AT_ARG_OPTIONAL, 1, LINK_BUFFER_POOL_SIZE),
+    AT_ARG_INT(RECEIVE_MODE_ARGS, latency, AT_ARG_OPTIONAL, 0, INT_MAX),
+};
+
 /**
- * @brief Obtain Socket Data Length in Passive Receiving Mode
+ * @brief Sets the receive mode.
  *
- * @param AT+CIPRECVLEN?
- * @returns +CIPRECVLEN:<length>
+ * @param AT+CIPRECVMODE=<mode>[,<ipd_len>,<ipd_latency>]
  */
-char get_server_data_len(char *value)
+char set_receive_mode(char *value)
 {
-    LogTrace("%d clients are connected.", tcpClients.size());
+    RECEIVE_MODE_ARGS args = {-1, ipdMaxLen, ipdMaxLatency};
 
-    for (size_t i = 0; i < tcpClients.size(); i++)
+    if (!parse_command_args(value, receive_mode_args, AT_ARG_COUNT(receive_mode_args), &args))
     {
-        Serial.printf("+CIPRECVLEN:%d,%d\n", i, TCP_RX_BYTES[i]);
+        return AT_ERROR;
     }
 
+    receiveMode = args.mode;
+    ipdMaxLen = args.len;
+    ipdMaxLatency = args.latency;
+
     return AT_OK;
 }
 
 /**
- * @brief Obtain Socket Data in Passive Receiving Mode
- *
- * @param AT+CIPRECVDATA=<chan>,<len>
- * @returns +CIPRECVDATA=<chan>,<a_len>,<remote_ip>,<remote_port>,<data>
- *
+ * @brief Establishes the TCP or SSL connection of the AT+CIPSTART in progress: the name is resolved,
+ *  then the TCP handshake is done in the background, the task only checking their progress.
+ *  SSL links then do the TLS handshake in one step, which blocks up to CONNECT_TIMEOUT_MS:
+ *  BearSSL::WiFiClientSecure only handshakes on a connection it opens itself.
  */
-char get_server_data(char *value)
+char connect_link_task(void *context)
 {
-    int len;
-    int chan;
+    LINK *link = &links[pendingConnect.link];
+    uint8_t step = net_connect_poll(&pendingConnect.connect, &link->client);
+    bool connected = false;
 
-    sscanf(value, "%d,%d", &chan, &len);
-
-    if (chan < 0 || chan > 9)
+    if (step == NET_CONNECT_RESOLVED)
     {
-        return AT_ERROR;
+        // Connected by name, resolved from the DNS cache: the name is sent to the server (SNI)
+        link->secure->setTimeout(CONNECT_TIMEOUT_MS);
+        connected = ssl_connect(link->secure, &sslConfig[pendingConnect.link], pendingConnect.host, pendingConnect.port);
     }
-
-    LogTrace("Reading %d bytes from channel %d", len, chan);
-
-    if (len > TCP_RX_BYTES[chan])
+    else if (step == NET_CONNECT_OPEN)
+    {
+        connected = true;
+    }
+    else if (step != NET_CONNECT_FAILED)
     {
-        LogTrace("Actual length of the received data of channel %d is less than %d, the actual length %d will be returned.", chan, len, TCP_RX_BYTES[chan]);
-        len = TCP_RX_BYTES[chan];
+        return TASK_CONTINUE;
     }
 
-    char *buffer = (char *)malloc(len + 1);
-    memcpy(buffer, TCP_RX_BUFFER, len);
+    if (connected)
+    {
+        link->state = LINK_OPEN;
+        link->rx_since = millis();
+        link->datagrams = 0;
+        rb_clear(&link->rx);
 
-    WiFiClient client = tcpClients[chan];
+        print_link_event(pendingConnect.link, "CONNECT");
+    }
+    else
+    {
+        LogErr("Failed to connect to %s:%d.", pendingConnect.host, pendingConnect.port);
 
-    Serial.printf("+CIPRECVDATA:%d,%d,%s,%d\n", chan, TCP_RX_BYTES[chan], client.remoteIP().toString().c_str(), client.remotePort());
+        link->state = LINK_FREE;
+        link->client = WiFiClient();
 
-    for (int i = 0; i < len; i++)
-    {
-        Serial.print(TCP_RX_BUFFER[chan][i]);
+        delete link->secure;
+        link->secure = nullptr;
     }
 
-    TCP_RX_BYTES[chan] = 0;
-
-    free(buffer);
+    complete_at_command(connected ? AT_OK : AT_ERROR);
 
-    return AT_OK;
+    return TASK_DONE;
 }
 
 /**
- * @brief Remove from pool connections that are closed.
- *
+ * @brief Opens a UDP link. Datagrams are sent to the remote host (a broadcast address is allowed),
+ *  and received on the local port from any source.
  */
-void remove_closed_tcp_clients()
+char open_udp_link(int linkID, const char *host, int port, int localPort, int mode)
 {
-    Array<int, MAX_CLIENT_COUNT> chan;
+    LINK *link = &links[linkID];
+    IPAddress ip;
 
-    for (size_t channelID = 0; channelID < tcpClients.size(); channelID++)
+    if (localPort < 0 || localPort > 65535 || mode < UDP_REMOTE_FIXED || mode > UDP_REMOTE_ANY || !WiFi.hostByName(host, ip))
     {
-        if (tcpClients[channelID].status() == CLOSED || !tcpClients[channelID].connected())
-        {
-            LogTrace("Client on channel %d is not connected.", channelID);
-            chan.push_back(channelID);
-        }
+        return AT_ERROR;
     }
 
-    for (int channelID : chan)
+    link->udp = new WiFiUDP();
+
+    if (!link->udp->begin(localPort))
     {
-        tcpClients.remove(channelID);
-        TCP_RX_BYTES[channelID] = 0;
+        delete link->udp;
+        link->udp = nullptr;
+        return AT_ERROR;
     }
+
+    link->state = LINK_OPEN;
+    link->type = LINK_UDP;
+    link->remote_ip = ip;
+    link->remote_port = port;
+    link->udp_mode = mode;
+    link->datagrams = 0;
+    link->rx_since = millis();
+    rb_clear(&link->rx);
+
+    print_link_event(linkID, "CONNECT");
+
+    return AT_OK;
 }
 
+typedef struct _start_args
+{
+    long link;
+    char type[4];
+    char host[sizeof(pendingConnect.host)];
+    long port;
+    long local_port;
+    long mode;
+} START_ARGS;
+
+static const AT_ARG_SPEC start_args[] = {
+    AT_ARG_INT(START_ARGS, link, AT_ARG_REQUIRED, 0, MAX_LINK_COUNT - 1),
+    AT_ARG_STRING(START_ARGS, type, AT_ARG_REQUIRED),
+    AT_ARG_STRING(START_ARGS, host, AT_ARG_REQUIRED),
+    AT_ARG_INT(START_ARGS, port, AT_ARG_REQUIRED, 1, 65535),
+    AT_ARG_INT(START_ARGS, local_port, AT_ARG_OPTIONAL, 0, 65535),
+    AT_ARG_INT(START_ARGS, mode, AT_ARG_OPTIONAL, UDP_REMOTE_FIXED, UDP_REMOTE_ANY),
+};
+
 /**
- * @brief Process the TCP Clients
- *  it checks for each connected clients if some data are present and add it to the buffer.
+ * @brief Opens a TCP connection, a TLS connection or a UDP link, sharing the links of the server.
+ *  TCP and SSL connections are established from the main loop: the command completes once connected.
  *
+ * @param AT+CIPSTART=[<link ID>,]<"type">,<"remote host">,<remote port>[,<local port>,<mode>]
+ *  <"type">: "TCP", "UDP" or "SSL". The local port and the mode only apply to UDP links.
+ * @return <link ID>,CONNECT
  */
-void process_existing_channels()
+char start_connection(char *value)
 {
-    remove_closed_tcp_clients();
+    START_ARGS args = {};
 
-    for (size_t channelID = 0; channelID < tcpClients.size(); channelID++)
+    // Without <link ID> in single connection mode
+    if (!parse_command_args(value, start_args + !muxMode, AT_ARG_COUNT(start_args) - !muxMode, &args))
     {
-        int available = tcpClients[channelID].available();
+        return AT_ERROR;
+    }
 
-        if (!available)
-        {
-            continue;
-        }
+    int linkID = args.link;
+    const char *type = args.type;
+    int port = args.port;
+    int localPort = args.local_port;
+    int mode = args.mode;
 
-        LogInfo("Reading data on channel %d.", channelID);
+    if (linkID >= maxLinks)
+    {
+        return AT_ERROR;
+    }
 
-        int free = MAX_BUFFER_SIZE - TCP_RX_BYTES[channelID];
+    strcpy(pendingConnect.host, args.host);
 
-        if (free < available)
-        {
-            LogWarn("No sufficient space on buffer for channel %d. Need %d but ony %d free.", channelID, available, free);
-            return;
-        }
+    if (links[linkID].state != LINK_FREE)
+    {
+        response_println("ALREADY CONNECTED");
+        return AT_ERROR;
+    }
 
-        int offset = 0;
+    if (strcmp(type, "UDP") == 0)
+    {
+        return open_udp_link(linkID, pendingConnect.host, port, localPort, mode);
+    }
 
-        while (tcpClients[channelID].available())
-        {
-            char c = tcpClients[channelID].read();
+    bool ssl = strcmp(type, "SSL") == 0;
 
-            TCP_RX_BUFFER[channelID][TCP_RX_BYTES[channelID] + offset++] = c;
+    if (!ssl && strcmp(type, "TCP") != 0)
+    {
+        return AT_ERROR;
+    }
 
-            if (c == '\n')
-            {
-                TCP_RX_BYTES[channelID] += offset;
+    if (ssl && open_ssl_links() >= MAX_SSL_LINKS)
+    {
+        LogWarn("%d SSL links are already open.", MAX_SSL_LINKS);
+        return AT_ERROR;
+    }
 
-                LogTrace("Got %d bytes on channel %d - Now %d bytes are waiting.", offset, channelID, TCP_RX_BYTES[channelID]);
-                LogTrace("%d;%s", channelID, TCP_RX_BUFFER[channelID]);
+    pendingConnect.link = linkID;
+    pendingConnect.port = port;
 
-                Serial.print("+CIPRECVLEN:");
-                Serial.print(channelID);
-                Serial.print(",");
-                Serial.println(TCP_RX_BYTES[channelID]);
-                break;
-            }
-        }
+    if (scheduler_add(connect_link_task, NULL, 0) < 0)
+    {
+        return AT_ERROR;
     }
+
+    net_connect_start(&pendingConnect.connect, pendingConnect.host, port, !ssl, CONNECT_TIMEOUT_MS);
+
+    links[linkID].state = LINK_CONNECTING;
+    links[linkID].type = ssl ? LINK_SSL : LINK_TCP;
+    links[linkID].secure = ssl ? new BearSSL::WiFiClientSecure() : nullptr;
+
+    return AT_PENDING;
 }
 
 /**
- * @brief Realizes the tcp connection processing.
- *  If a client is connected, it registers the client as a channel and read its incoming data.
+ * @brief Closes a link opened by the server or by AT+CIPSTART. In active receive mode, the data
+ *  received before is sent first.
  */
-void process_tcp_server()
+void close_link(int linkID)
 {
-    if (!tcpServerStarted)
+    if (receiveMode == RECV_MODE_ACTIVE)
     {
-        return;
+        deliver_channel_data(linkID, true);
     }
 
-    process_existing_channels();
+    link_client(&links[linkID])->stop();
+    release_link(linkID);
+}
 
-    if (!tcpServer->hasClient())
-    {
-        return;
-    }
+typedef struct _close_args
+{
+    long link;
+} CLOSE_ARGS;
 
-    WiFiClient client = tcpServer->available();
+static const AT_ARG_SPEC close_args[] = {
+    AT_ARG_INT(CLOSE_ARGS, link, AT_ARG_REQUIRED, 0, MAX_LINK_COUNT - 1),
+};
 
-    if (!client)
+/**
+ * @brief Closes a link.
+ *
+ * @param AT+CIPCLOSE=<link ID>
+ * @return <link ID>,CLOSED
+ */
+char close_connection(char *value)
+{
+    CLOSE_ARGS args = {};
+
+    if (!parse_command_args(value, close_args, AT_ARG_COUNT(close_args), &args))
     {
-        LogTrace("TcpServer has client but unable to get the available client.");
-        return;
+        return AT_ERROR;
     }
 
-    if (!client.connected())
+    int linkID = args.link;
+
+    if (!muxMode || links[linkID].state != LINK_OPEN)
     {
-        LogTrace("Client is not connected.");
-        return;
+        return AT_ERROR;
     }
 
-    int channelID = register_client(client);
+    close_link(linkID);
 
-    if (channelID < 0)
+    return AT_OK;
+}
+
+/**
+ * @brief Closes the connection in single connection mode.
+ *
+ * @param AT+CIPCLOSE
+ * @return CLOSED
+ */
+char close_single_connection(char *value)
+{
+    if (muxMode || links[0].state != LINK_OPEN)
     {
-        LogErr("Failed to register the client. Stopping.");
-        client.stop();
+        return AT_ERROR;
     }
+
+    close_link(0);
+
+    return AT_OK;
 }
 
 /**
- * @brief Get the connections status
+ * @brief Gets the connection mode.
  *
- * @param AT+CIPSTATE?
- * @return +CIPSTATE:<link ID>,<remote IP>,<remote port>,<local port>
+ * @param AT+CIPMUX?
+ * @return +CIPMUX:<mode>
  */
-char get_connections_status(char *value)
+char get_mux_mode(char *value)
+{
+    sprintf(value, "+CIPMUX:%d", muxMode);
+
+    return AT_OK;
+}
+
+/**
+ * @brief Sets the connection mode: 0 single connection, 1 multiple connections.
+ *  It can not be changed while links are open, nor switched to single while the server runs.
+ *
+ * @param AT+CIPMUX=<mode>
+ */
+char set_mux_mode(char *value)
 {
-    for (int i = 0; i < MAX_CLIENT_COUNT; i++)
+    MODE_ARGS args = {};
+
+    if (!parse_command_args(value, mode_args, AT_ARG_COUNT(mode_args), &args))
     {
-        if (!tcpClients[i])
-        {
-            LogTrace("TcpClient[%d] is null", i);
-            continue;
-        }
+        return AT_ERROR;
+    }
 
-        LogTrace("TcpClient[%d] is %d", i, tcpClients[i]);
+    int mode = args.mode;
 
-        Serial.print("+CIPSTATE:");
-        Serial.print(i);
-        Serial.print(",");
-        Serial.print(tcpClients[i].remoteIP().toString());
-        Serial.print(",");
-        Serial.print(tcpClients[i].remotePort());
-        Serial.print(",");
-        Serial.println(tcpClients[i].localPort());
+    if (mode != muxMode && (open_links() > 0 || (mode == 0 && tcpServerStarted)))
+    {
+        LogWarn("Links are open or the server runs, the connection mode can not be changed.");
+        return AT_ERROR;
     }
 
+    muxMode = mode;
+
     return AT_OK;
 }
 
 /**
- * @brief Sends the data to the client at specified channel.
+ * @brief Gets the maximum number of links of the server.
  *
- * @param AT+CIPSEND=<link_ID>,<length>
- * @return  OK
- *          >
+ * @param AT+CIPSERVERMAXCONN?
+ * @return +CIPSERVERMAXCONN:<num>,<queue>
  */
-char send_data(char *value)
+char get_server_max_connections(char *value)
+{
+    sprintf(value, "+CIPSERVERMAXCONN:%d,%d", maxLinks, acceptQueueSize);
+
+    return AT_OK;
+}
+
+typedef struct _max_connections_args
 {
-    unsigned long len;
-    unsigned int chan;
+    long count;
+    long queue;
+} MAX_CONNECTIONS_ARGS;
 
-    sscanf(value, "%d,%lu", &chan, &len);
+static const AT_ARG_SPEC max_connections_args[] = {
+    AT_ARG_INT(MAX_CONNECTIONS_ARGS, count, AT_ARG_REQUIRED, 1, MAX_LINK_COUNT),
+    AT_ARG_INT(MAX_CONNECTIONS_ARGS, queue, AT_ARG_OPTIONAL, 0, MAX_ACCEPT_QUEUE),
+};
+
+/**
+ * @brief Sets the maximum number of links of the server, saved in flash.
+ *  The link buffers are split again: no link can be open, and no client waiting in the accept queue.
+ *
+ * @param AT+CIPSERVERMAXCONN=<num>[,<queue>]
+ */
+char set_server_max_connections(char *value)
+{
+    MAX_CONNECTIONS_ARGS args = {0, acceptQueueSize};
 
-    if (len > sizeof(TCP_TX_BUFFER))
+    if (!parse_command_args(value, max_connections_args, AT_ARG_COUNT(max_connections_args), &args))
     {
-        LogErr("Length of the data to send (%d) is greater than the buffer size (%d).", len, TCP_TX_BUFFER);
         return AT_ERROR;
     }
 
-    if (chan >= tcpClients.size())
+    int count = args.count;
+    int queue = args.queue;
+
+    if ((count != maxLinks || queue != acceptQueueSize) && (open_links() > 0 || acceptQueueCount > 0))
     {
-        LogWarn("Specified chan %d is not present (%d chanels currently connected).", chan, tcpClients.size());
+        LogWarn("Links are open, the maximum number of links can not be changed.");
         return AT_ERROR;
     }
 
-    LogTrace("Preparing to send %lu bytes to channel %d", len, chan);
-
-    WiFiClient client = tcpClients[chan];
-
-    if (!client.connected())
+    if (count != maxLinks)
     {
-        LogErr("Client is not connected.");
-        return AT_ERROR;
+        configure_links(count);
     }
 
-    stop_at_processing = true;
+    acceptQueueSize = queue;
 
-    Serial.println("OK");
-    Serial.print("> ");
+    settings.max_links = count;
+    settings.accept_queue = queue;
+    save_settings();
 
-    unsigned long read = 0;
+    return AT_OK;
+}
 
-    while (read < len)
+/**
+ * @brief Gets the TLS settings of the links.
+ *
+ * @param AT+CIPSSLCCONF?
+ * @return +CIPSSLCCONF:<link ID>,<auth_mode>,<mfln> for each link (without <link ID> in single connection mode)
+ */
+char get_ssl_config(char *value)
+{
+    if (!muxMode)
     {
-        if (!Serial.available())
-        {
-            continue;
-        }
+        sprintf(value, "+CIPSSLCCONF:%d,%d", sslConfig[0].auth_mode, sslConfig[0].mfln);
+        return AT_OK;
+    }
 
-        char byte = Serial.read();
-        TCP_TX_BUFFER[read++] = byte;
+    for (int i = 0; i < maxLinks; i++)
+    {
+        response_printf("+CIPSSLCCONF:%d,%d,%d\r\n", i, sslConfig[i].auth_mode, sslConfig[i].mfln);
     }
 
-    LogTrace("Sending %lu bytes to channel %d\n%s", len, chan, TCP_TX_BUFFER);
+    return AT_OK;
+}
+
+typedef struct _ssl_config_args
+{
+    long link;
+    long auth;
+    long mfln;
+    char fingerprint[60];
+} SSL_CONFIG_ARGS;
+
+static const AT_ARG_SPEC ssl_config_args[] = {
+    AT_ARG_INT(SSL_CONFIG_ARGS, link, AT_ARG_REQUIRED, 0, MAX_LINK_COUNT - 1),
+    AT_ARG_INT(SSL_CONFIG_ARGS, auth, AT_ARG_REQUIRED, SSL_AUTH_NONE, SSL_AUTH_SERVER),
+    AT_ARG_INT(SSL_CONFIG_ARGS, mfln, AT_ARG_OPTIONAL, 0, 4096),
+    AT_ARG_STRING(SSL_CONFIG_ARGS, fingerprint, AT_ARG_OPTIONAL),
+};
 
-    unsigned long sent = client.write(TCP_TX_BUFFER, len);
+/**
+ * @brief Sets the TLS settings used by the next AT+CIPSTART of type "SSL" on the link.
+ *
+ * @param AT+CIPSSLCCONF=[<link ID>,]<auth_mode>[,<mfln>[,<"fingerprint">]]
+ *  <auth_mode>: 0 no authentication, 2 the server certificate must match <"fingerprint"> (SHA-1)
+ *  <mfln>: maximum fragment length negotiated with the server (0, 512, 1024, 2048 or 4096)
+ */
+char set_ssl_config(char *value)
+{
+    SSL_CONFIG_ARGS args = {0, -1, -1, ""};
+    SSL_CONFIG config = {};
 
-    if (sent != len)
+    // Without <link ID> in single connection mode
+    if (!parse_command_args(value, ssl_config_args + !muxMode, AT_ARG_COUNT(ssl_config_args) - !muxMode, &args))
     {
-        LogErr("Failed to send %lu bytes to channel %d", len, chan);
-        stop_at_processing = false;
+        return AT_ERROR;
+    }
+
+    int linkID = args.link;
+    int auth = args.auth;
+    int mfln = args.mfln;
 
+    if (linkID >= maxLinks)
+    {
         return AT_ERROR;
     }
 
-    Serial.print("SEND OK");
+    if (mfln < 0)
+    {
+        mfln = sslConfig[linkID].mfln;
+    }
 
-    while (Serial.available())
-        Serial.read();
+    if ((auth != SSL_AUTH_NONE && auth != SSL_AUTH_SERVER) || !ssl_valid_mfln(mfln))
+    {
+        return AT_ERROR;
+    }
 
-    Serial.flush();
+    if (auth == SSL_AUTH_SERVER && !ssl_parse_fingerprint(args.fingerprint, config.fingerprint))
+    {
+        LogWarn("Server authentication requires the SHA-1 fingerprint of its certificate.");
+        return AT_ERROR;
+    }
 
-    stop_at_processing = false;
+    config.auth_mode = auth;
+    config.mfln = mfln;
+    sslConfig[linkID] = config;
 
     return AT_OK;
 }
@@ -428,13 +1937,32 @@ char send_data(char *value)
 /**
  * Registers the TCP/IP commands.
  *
+ * @return false if a command could not be registered.
  */
-void register_tcp_ip_commands()
+bool register_tcp_ip_commands()
 {
-    at_register_command("CIPSERVER", (at_callback)get_server, (at_callback)set_server, 0, 0);
-    at_register_command("CIPSTA", (at_callback)get_sta_ip_info, 0, 0, 0);
-    at_register_command("CIPRECVLEN", (at_callback)get_server_data_len, 0, 0, 0);
-    at_register_command("CIPRECVDATA", 0, (at_callback)get_server_data, 0, 0);
-    at_register_command("CIPSTATE", (at_callback)get_connections_status, 0, 0, 0);
-    at_register_command("CIPSEND", 0, (at_callback)send_data, 0, 0);
+    configure_links(DEFAULT_MAX_LINKS);
+
+    for (int i = 0; i < MAX_LINK_COUNT; i++)
+    {
+        sslConfig[i] = ssl_default_config;
+    }
+
+    bool registered = true;
+
+    registered &= at_register_command("CIPSERVER", (at_callback)get_server, (at_callback)set_server, 0, 0) == AT_OK;
+    registered &= at_register_command("CIPSERVERMAXCONN", (at_callback)get_server_max_connections, (at_callback)set_server_max_connections, 0, 0) == AT_OK;
+    registered &= at_register_command("CIPSTA", (at_callback)get_sta_ip_info, 0, 0, 0) == AT_OK;
+    registered &= at_register_command("CIPSTART", 0, (at_callback)start_connection, 0, 0) == AT_OK;
+    registered &= at_register_command("CIPSSLCCONF", (at_callback)get_ssl_config, (at_callback)set_ssl_config, 0, 0) == AT_OK;
+    registered &= at_register_command("CIPCLOSE", 0, (at_callback)close_connection, 0, (at_callback)close_single_connection) == AT_OK;
+    registered &= at_register_command("CIPMUX", (at_callback)get_mux_mode, (at_callback)set_mux_mode, 0, 0) == AT_OK;
+    registered &= at_register_command("CIPRECVLEN", (at_callback)get_server_data_len, 0, 0, 0) == AT_OK;
+    registered &= at_register_command("CIPRECVDATA", 0, (at_callback)get_server_data, 0, 0) == AT_OK;
+    registered &= at_register_command("CIPSTATE", (at_callback)get_connections_status, 0, 0, 0) == AT_OK;
+    registered &= at_register_command("CIPSEND", 0, (at_callback)send_data, 0, (at_callback)start_passthrough) == AT_OK;
+    registered &= at_register_command("CIPMODE", (at_callback)get_transmission_mode, (at_callback)set_transmission_mode, 0, 0) == AT_OK;
+    registered &= at_register_command("CIPRECVMODE", (at_callback)get_receive_mode, (at_callback)set_receive_mode, 0, 0) == AT_OK;
+
+    return registered;
 }
@@ -7,8 +7,28 @@
 extern "C"{
 #endif
 
+extern int receiveMode;
+extern int muxMode;
+extern int ipdMaxLen;
+extern int ipdMaxLatency;
+
+/**
+ * @brief Starts the TCP server, replacing the running one.
+ */
+void start_tcp_server(uint16_t port);
+
+/**
+ * @brief Port of the TCP server, 0 if it is not started.
+ */
+uint16_t tcp_server_port();
+
+/**
+ * @brief Starts the TCP server saved in flash.
+ */
+void restore_tcp_ip_settings();
+
 void process_tcp_server();
-void register_tcp_ip_commands();
+bool register_tcp_ip_commands();
 
 #ifdef __cplusplus
 } // extern "C"
@@ -4,7 +4,70 @@
 #include "ESP8266WiFiType.h"
 
 #include "at_parser.h"
-#include <logging.h>
+#include "at_command_process.h"
+#include "scheduler.h"
+#include "settings.h"
+#include "response.h"
+#include "at_log.h"
+
+#define JOIN_TIMEOUT_MS 30000
+#define JOIN_POLL_INTERVAL_MS 100
+
+// Time given to a join on the cached AP before falling back to a join with a full scan
+#define FAST_JOIN_TIMEOUT_MS 5000
+#define SCAN_POLL_INTERVAL_MS 50
+
+#define MAX_SCAN_RESULTS 64
+#define CWLAP_LINE_SIZE 96
+
+// Stations accepted by the SoftAP: the SDK supports up to 8
+#define AP_DEFAULT_MAX_CONNECTIONS 4
+#define AP_MAX_CONNECTIONS 8
+
+#define CWLAP_PRINT_ECN 0x01
+#define CWLAP_PRINT_SSID 0x02
+#define CWLAP_PRINT_RSSI 0x04
+#define CWLAP_PRINT_MAC 0x08
+#define CWLAP_PRINT_CHANNEL 0x10
+#define CWLAP_PRINT_ALL 0x1F
+
+#define CWLAP_AUTHMODE_ALL 0xFFFF
+
+/**
+ * @brief Connection to an AP in progress (AT+CWJAP).
+ */
+struct
+{
+  wl_status_t status;
+  unsigned long started;
+  bool fast;
+  bool saved_config;
+  char ssid[33];
+  char pwd[65];
+} joinState;
+
+/**
+ * @brief Options of AT+CWLAP (AT+CWLAPOPT).
+ */
+struct
+{
+  uint8_t sort;
+  uint8_t print_mask;
+  int8_t rssi_filter;
+  uint16_t authmode_mask;
+  uint8_t max_results;
+} scanOptions = {0, CWLAP_PRINT_ALL, -100, CWLAP_AUTHMODE_ALL, 0};
+
+/**
+ * @brief Scan in progress (AT+CWLAP): indexes of the results to print, in order.
+ */
+struct
+{
+  bool complete;
+  uint8_t order[MAX_SCAN_RESULTS];
+  uint8_t count;
+  uint8_t next;
+} scanState;
 
 /**
  * Formats the WiFi Status.
@@ -42,7 +105,7 @@ const char *format_wl_status(wl_status_t status)
  *
  * @param The WiFi encryption type.
  */
-const uint8_t format_enc_type(uint8_t encType)
+uint8_t format_enc_type(uint8_t encType)
 {
   switch (encType)
   {
@@ -74,6 +137,15 @@ char get_wifi_mode(char *value)
   return AT_OK;
 }
 
+typedef struct _mode_args
+{
+  long mode;
+} MODE_ARGS;
+
+static const AT_ARG_SPEC wifi_mode_args[] = {
+  AT_ARG_INT(MODE_ARGS, mode, AT_ARG_REQUIRED, WIFI_OFF, WIFI_AP_STA),
+};
+
 /**
  * Sets the Wifi mode.
  *
@@ -81,12 +153,20 @@ char get_wifi_mode(char *value)
  */
 char set_wifi_mode(char *value)
 {
-  int mode;
+  MODE_ARGS args = {};
+
+  if (!parse_command_args(value, wifi_mode_args, AT_ARG_COUNT(wifi_mode_args), &args))
+  {
+    return AT_ERROR;
+  }
 
-  sscanf(value, "%d", &mode);
+  int mode = args.mode;
 
   if (WiFi.mode((WiFiMode_t)mode))
   {
+    settings.wifi_mode = mode;
+    save_settings();
+
     return AT_OK;
   }
 
@@ -133,39 +213,171 @@ char get_wifi_status(char *value)
 }
 
 /**
- * Prints the current WiFi status.
- * It is used by the AT+CWJAP command.
- *
- * During a maximum of 30 seconds, the module will print the current WiFi status.
- * If the module is not connected to a WiFi network, it will print the error code
- * If the module is connected to a WiFi network, it will print CONNECTED and exit.
+ * Gets the cache of the last join, from the RTC memory, or from flash after a power down.
  *
- * @param The first status.
+ * @return true if the cache is valid for the SSID.
+ */
+bool load_wifi_cache(WIFI_CACHE *cache, const char *ssid)
+{
+  if (!ESP.rtcUserMemoryRead(RTC_WIFI_CACHE_OFFSET, (uint32_t *)cache, sizeof(WIFI_CACHE)) ||
+      cache->crc != crc32((uint8_t *)cache + sizeof(cache->crc), sizeof(WIFI_CACHE) - sizeof(cache->crc)))
+  {
+    *cache = settings.wifi_cache;
+  }
+
+  return cache->crc == crc32((uint8_t *)cache + sizeof(cache->crc), sizeof(WIFI_CACHE) - sizeof(cache->crc)) &&
+         cache->channel != 0 &&
+         strcmp(cache->ssid, ssid) == 0;
+}
+
+/**
+ * Saves the AP and IP configuration of the established connection.
+ * It is always kept in the RTC memory, and written to flash only when it changed.
+ */
+void save_wifi_cache()
+{
+  WIFI_CACHE cache = {};
+
+  strncpy(cache.ssid, WiFi.SSID().c_str(), sizeof(cache.ssid) - 1);
+  memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+  cache.channel = WiFi.channel();
+  cache.ip = WiFi.localIP();
+  cache.gateway = WiFi.gatewayIP();
+  cache.netmask = WiFi.subnetMask();
+  cache.dns = WiFi.dnsIP();
+  cache.crc = crc32((uint8_t *)&cache + sizeof(cache.crc), sizeof(WIFI_CACHE) - sizeof(cache.crc));
+
+  ESP.rtcUserMemoryWrite(RTC_WIFI_CACHE_OFFSET, (uint32_t *)&cache, sizeof(WIFI_CACHE));
+
+  if (memcmp(&cache, &settings.wifi_cache, sizeof(WIFI_CACHE)) != 0)
+  {
+    settings.wifi_cache = cache;
+    save_settings();
+  }
+}
+
+void clear_wifi_cache()
+{
+  WIFI_CACHE cache = {};
+
+  ESP.rtcUserMemoryWrite(RTC_WIFI_CACHE_OFFSET, (uint32_t *)&cache, sizeof(WIFI_CACHE));
+
+  if (settings.wifi_cache.channel != 0)
+  {
+    settings.wifi_cache = cache;
+    save_settings();
+  }
+}
+
+/**
+ * Starts a join with a full scan (and DHCP).
  */
-char print_wl_status(wl_status_t status)
+wl_status_t begin_full_join()
 {
-  Serial.println(format_wl_status(status));
-  long startTime = millis();
+  joinState.fast = false;
 
-  while ((millis() - startTime) < 30000)
+  if (joinState.saved_config)
   {
-    wl_status_t new_status = WiFi.status();
+    return WiFi.begin();
+  }
 
-    if (new_status != status)
-    {
-      status = new_status;
-      Serial.println(format_wl_status(status));
-    }
+  return WiFi.begin(joinState.ssid, joinState.pwd);
+}
+
+/**
+ * Starts a join, on the cached AP channel and BSSID if the fast reconnect is enabled
+ * and the last join was on the same SSID. The cached IP configuration is also used
+ * in the FAST_JOIN_BSSID_AND_IP mode, which skips DHCP.
+ */
+wl_status_t begin_join()
+{
+  WIFI_CACHE cache;
+
+  if (settings.fast_join == FAST_JOIN_DISABLED || !load_wifi_cache(&cache, joinState.ssid))
+  {
+    return begin_full_join();
+  }
+
+  LogInfo("Joining %s on channel %d.", joinState.ssid, cache.channel);
+
+  if (settings.fast_join == FAST_JOIN_BSSID_AND_IP)
+  {
+    WiFi.config(IPAddress(cache.ip), IPAddress(cache.gateway), IPAddress(cache.netmask), IPAddress(cache.dns));
+  }
+
+  joinState.fast = true;
+
+  return WiFi.begin(joinState.ssid, joinState.pwd, cache.channel, cache.bssid);
+}
+
+/**
+ * Prints the WiFi status changes until connected.
+ * It is run by the scheduler for the AT+CWJAP command, which completes once
+ * connected (OK), or after 30 seconds (ERROR).
+ * A failed fast join falls back to a join with a full scan.
+ */
+char wait_station_connection(void *context)
+{
+  wl_status_t status = WiFi.status();
+
+  if (joinState.fast && status != WL_CONNECTED &&
+      (status == WL_NO_SSID_AVAIL || status == WL_CONNECT_FAILED || millis() - joinState.started > FAST_JOIN_TIMEOUT_MS))
+  {
+    LogWarn("Fast join failed, joining with a full scan.");
 
-    if (status == WL_CONNECTED)
+    clear_wifi_cache();
+
+    if (settings.fast_join == FAST_JOIN_BSSID_AND_IP)
     {
-      return AT_OK;
+      // Back to DHCP
+      WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0));
     }
 
-    delay(100);
+    status = begin_full_join();
   }
 
-  return AT_ERROR;
+  if (status != joinState.status)
+  {
+    joinState.status = status;
+    response_println(format_wl_status(status));
+  }
+
+  if (status != WL_CONNECTED && millis() - joinState.started < JOIN_TIMEOUT_MS)
+  {
+    return TASK_CONTINUE;
+  }
+
+  if (status == WL_CONNECTED && settings.fast_join != FAST_JOIN_DISABLED)
+  {
+    save_wifi_cache();
+  }
+
+  stop_at_processing = false;
+  complete_at_command(status == WL_CONNECTED ? AT_OK : AT_ERROR);
+
+  return TASK_DONE;
+}
+
+/**
+ * Starts the join, prints the first WiFi status, and waits for the connection without blocking the loop.
+ */
+char join_station()
+{
+  wl_status_t status = begin_join();
+
+  response_println(format_wl_status(status));
+
+  joinState.status = status;
+  joinState.started = millis();
+
+  if (scheduler_add(wait_station_connection, NULL, JOIN_POLL_INTERVAL_MS) < 0)
+  {
+    return AT_ERROR;
+  }
+
+  stop_at_processing = true;
+
+  return AT_PENDING;
 }
 
 /**
@@ -181,6 +393,17 @@ char get_station_settings(char *value)
   return AT_OK;
 }
 
+typedef struct _station_args
+{
+  char ssid[sizeof(joinState.ssid)];
+  char pwd[sizeof(joinState.pwd)];
+} STATION_ARGS;
+
+static const AT_ARG_SPEC station_args[] = {
+  AT_ARG_STRING(STATION_ARGS, ssid, AT_ARG_OPTIONAL),
+  AT_ARG_STRING(STATION_ARGS, pwd, AT_ARG_OPTIONAL),
+};
+
 /**
  * Sets the Wifi station settings.
  *
@@ -188,16 +411,20 @@ char get_station_settings(char *value)
  */
 char set_station_settings(char *value)
 {
-  char ssid[50];
-  char pwd[128];
+  STATION_ARGS args = {"", ""};
 
-  WiFi.mode(WIFI_STA);
+  if (!parse_command_args(value, station_args, AT_ARG_COUNT(station_args), &args))
+  {
+    return AT_ERROR;
+  }
 
-  sscanf(value, "\"%[^\"]\",\"%[^\"]\"", ssid, pwd);
+  WiFi.mode(WIFI_STA);
 
-  wl_status_t status = WiFi.begin(ssid, pwd);
+  strcpy(joinState.ssid, args.ssid);
+  strcpy(joinState.pwd, args.pwd);
+  joinState.saved_config = false;
 
-  return print_wl_status(status);
+  return join_station();
 }
 
 /**
@@ -207,11 +434,66 @@ char set_station_settings(char *value)
  */
 char connect_station(char *value)
 {
-  wl_status_t status = WiFi.begin();
+  strncpy(joinState.ssid, WiFi.SSID().c_str(), sizeof(joinState.ssid) - 1);
+  joinState.ssid[sizeof(joinState.ssid) - 1] = '\0';
+  strncpy(joinState.pwd, WiFi.psk().c_str(), sizeof(joinState.pwd) - 1);
+  joinState.pwd[sizeof(joinState.pwd) - 1] = '\0';
+  joinState.saved_config = true;
+
+  return join_station();
+}
+
+/**
+ * Gets the fast reconnect mode.
+ *
+ * @param AT+CWFASTJAP?
+ * @return +CWFASTJAP:<mode>,<cached>
+ */
+char get_fast_join(char *value)
+{
+  WIFI_CACHE cache;
+
+  sprintf(value, "+CWFASTJAP:%d,%d", settings.fast_join, load_wifi_cache(&cache, WiFi.SSID().c_str()));
+
+  return AT_OK;
+}
+
+static const AT_ARG_SPEC fast_join_args[] = {
+  AT_ARG_INT(MODE_ARGS, mode, AT_ARG_REQUIRED, FAST_JOIN_DISABLED, FAST_JOIN_BSSID_AND_IP),
+};
+
+/**
+ * Sets the fast reconnect mode, saved in flash.
+ *
+ * @param AT+CWFASTJAP=<mode>
+ */
+char set_fast_join(char *value)
+{
+  MODE_ARGS args = {};
+
+  if (!parse_command_args(value, fast_join_args, AT_ARG_COUNT(fast_join_args), &args))
+  {
+    return AT_ERROR;
+  }
+
+  int mode = args.mode;
+
+  settings.fast_join = mode;
+
+  if (mode == FAST_JOIN_DISABLED)
+  {
+    clear_wifi_cache();
+  }
+
+  save_settings();
 
-  return print_wl_status(status);
+  return AT_OK;
 }
 
+static const AT_ARG_SPEC reconnect_args[] = {
+  AT_ARG_INT(MODE_ARGS, mode, AT_ARG_REQUIRED, 0, 1),
+};
+
 /**
  * Sets the Wifi auto-reconnect.
  *
@@ -219,10 +501,14 @@ char connect_station(char *value)
  */
 char set_reconnect(char *value)
 {
-  int reconncfg;
-  sscanf(value, "%d", &reconncfg);
+  MODE_ARGS args = {};
 
-  WiFi.setAutoReconnect(reconncfg);
+  if (!parse_command_args(value, reconnect_args, AT_ARG_COUNT(reconnect_args), &args))
+  {
+    return AT_ERROR;
+  }
+
+  WiFi.setAutoReconnect(args.mode);
 
   return AT_OK;
 }
@@ -234,47 +520,228 @@ char set_reconnect(char *value)
  */
 char get_reconnect(char *value)
 {
-  int reconncfg;
-  sscanf(value, "%d", &reconncfg);
-
   sprintf(value, "+CWRECONNCFG:%d", WiFi.getAutoReconnect());
 
   return AT_OK;
 }
 
 /**
- * Prints the scan results.
+ * @brief Returns the AT+CWLAP <ecn> of an encryption type as a mask bit (AT+CWLAPOPT <authmode mask>).
+ */
+uint16_t enc_type_mask(uint8_t encType)
+{
+  uint8_t ecn = format_enc_type(encType);
+
+  return ecn < 16 ? 1 << ecn : 0;
+}
+
+/**
+ * Selects the scan results to print according to the AT+CWLAPOPT options:
+ * filtered by RSSI and encryption, sorted by RSSI if enabled, and limited to the maximum count.
  *
  * @param The network scan number.
  */
-void print_scanned_networks(int numNetworks)
+void select_scanned_networks(int numNetworks)
 {
-  for (int i = 0; i < numNetworks; i++)
+  scanState.count = 0;
+  scanState.next = 0;
+
+  for (int i = 0; i < numNetworks && scanState.count < MAX_SCAN_RESULTS; i++)
   {
-    Serial.print("+CWLAP:");
-    Serial.print(format_enc_type(WiFi.encryptionType(i)));
-    Serial.print(",");
-    Serial.print(WiFi.SSID(i));
-    Serial.print(",");
-    Serial.print(WiFi.RSSI(i));
-    Serial.print(",");
-    Serial.print(WiFi.BSSIDstr(i).c_str());
-    Serial.print(",");
-    Serial.println(WiFi.channel(i));
+    if (WiFi.RSSI(i) < scanOptions.rssi_filter || !(enc_type_mask(WiFi.encryptionType(i)) & scanOptions.authmode_mask))
+    {
+      continue;
+    }
+
+    uint8_t position = scanState.count++;
+
+    // Insertion by decreasing RSSI
+    while (scanOptions.sort && position > 0 && WiFi.RSSI(scanState.order[position - 1]) < WiFi.RSSI(i))
+    {
+      scanState.order[position] = scanState.order[position - 1];
+      position--;
+    }
+
+    scanState.order[position] = i;
+  }
+
+  if (scanOptions.max_results > 0 && scanState.count > scanOptions.max_results)
+  {
+    scanState.count = scanOptions.max_results;
+  }
+}
+
+/**
+ * Formats a scan result with the fields of the AT+CWLAPOPT print mask.
+ *
+ * @return the length of the line.
+ */
+int format_scanned_network(char *line, size_t size, uint8_t i)
+{
+  const uint8_t *bssid = WiFi.BSSID(i);
+  int len = snprintf(line, size, "+CWLAP:");
+
+  if (scanOptions.print_mask & CWLAP_PRINT_ECN)
+  {
+    len += snprintf(line + len, size - len, "%d,", format_enc_type(WiFi.encryptionType(i)));
+  }
+
+  if (scanOptions.print_mask & CWLAP_PRINT_SSID)
+  {
+    len += snprintf(line + len, size - len, "%s,", WiFi.SSID(i).c_str());
+  }
+
+  if (scanOptions.print_mask & CWLAP_PRINT_RSSI)
+  {
+    len += snprintf(line + len, size - len, "%d,", WiFi.RSSI(i));
+  }
+
+  if (scanOptions.print_mask & CWLAP_PRINT_MAC)
+  {
+    len += snprintf(line + len, size - len, "%02X:%02X:%02X:%02X:%02X:%02X,",
+                    bssid[0], bssid[1], bssid[2], bssid[3], bssid[4], bssid[5]);
+  }
+
+  if (scanOptions.print_mask & CWLAP_PRINT_CHANNEL)
+  {
+    len += snprintf(line + len, size - len, "%d,", WiFi.channel(i));
+  }
+
+  // Replaces the last separator
+  len--;
+  line[len++] = '\r';
+  line[len++] = '\n';
+
+  return len;
+}
+
+/**
+ * Waits for the end of the scan, then streams its results.
+ * It is run by the scheduler for the AT+CWLAP command: results are written
+ * as long as the response buffer accepts them without blocking, the rest on the next runs.
+ */
+char wait_scan_results(void *context)
+{
+  if (!scanState.complete)
+  {
+    int8_t numNetworks = WiFi.scanComplete();
+
+    if (numNetworks == WIFI_SCAN_RUNNING)
+    {
+      return TASK_CONTINUE;
+    }
+
+    if (numNetworks < 0)
+    {
+      WiFi.scanDelete();
+      stop_at_processing = false;
+      complete_at_command(AT_ERROR);
+
+      return TASK_DONE;
+    }
+
+    select_scanned_networks(numNetworks);
+    scanState.complete = true;
   }
+
+  char line[CWLAP_LINE_SIZE];
+
+  // At least one line per run, so a busy UART only slows the output down
+  do
+  {
+    if (scanState.next == scanState.count)
+    {
+      WiFi.scanDelete();
+      stop_at_processing = false;
+      complete_at_command(AT_OK);
+
+      return TASK_DONE;
+    }
+
+    int len = format_scanned_network(line, sizeof(line), scanState.order[scanState.next++]);
+    response_write((const uint8_t *)line, len);
+  } while (response_room() >= CWLAP_LINE_SIZE);
+
+  return TASK_CONTINUE;
 }
 
 /**
  * Lists the Wifi access points.
+ * The scan runs in the background: the results are printed once it is complete.
  *
  * @param AT+CWLAP
  * @return +CWLAP:<ecn>,<ssid>,<rssi>,<mac>,<channel>
  */
 char execute_get_list_ap(char *value)
 {
-  int numNetworks = WiFi.scanNetworks();
+  if (WiFi.scanNetworks(true) == WIFI_SCAN_FAILED)
+  {
+    return AT_ERROR;
+  }
+
+  scanState.complete = false;
+
+  if (scheduler_add(wait_scan_results, NULL, SCAN_POLL_INTERVAL_MS) < 0)
+  {
+    WiFi.scanDelete();
+    return AT_ERROR;
+  }
+
+  stop_at_processing = true;
+
+  return AT_PENDING;
+}
+
+/**
+ * Gets the options of AT+CWLAP.
+ *
+ * @param AT+CWLAPOPT?
+ * @return +CWLAPOPT:<sort_enable>,<print mask>,<rssi filter>,<authmode mask>,<max>
+ */
+char get_list_ap_options(char *value)
+{
+  sprintf(value, "+CWLAPOPT:%d,%d,%d,%d,%d", scanOptions.sort, scanOptions.print_mask, scanOptions.rssi_filter, scanOptions.authmode_mask, scanOptions.max_results);
+
+  return AT_OK;
+}
+
+typedef struct _list_ap_options_args
+{
+  long sort;
+  long mask;
+  long rssi;
+  long authmode;
+  long max;
+} LIST_AP_OPTIONS_ARGS;
+
+static const AT_ARG_SPEC list_ap_options_args[] = {
+  AT_ARG_INT(LIST_AP_OPTIONS_ARGS, sort, AT_ARG_REQUIRED, 0, 1),
+  AT_ARG_INT(LIST_AP_OPTIONS_ARGS, mask, AT_ARG_REQUIRED, 1, CWLAP_PRINT_ALL),
+  AT_ARG_INT(LIST_AP_OPTIONS_ARGS, rssi, AT_ARG_OPTIONAL, -100, 40),
+  AT_ARG_INT(LIST_AP_OPTIONS_ARGS, authmode, AT_ARG_OPTIONAL, 0, CWLAP_AUTHMODE_ALL),
+  AT_ARG_INT(LIST_AP_OPTIONS_ARGS, max, AT_ARG_OPTIONAL, 0, MAX_SCAN_RESULTS),
+};
+
+/**
+ * Sets the options of AT+CWLAP.
+ *
+ * @param AT+CWLAPOPT=<sort_enable>,<print mask>[,<rssi filter>][,<authmode mask>][,<max>]
+ */
+char set_list_ap_options(char *value)
+{
+  LIST_AP_OPTIONS_ARGS args = {0, 0, -100, CWLAP_AUTHMODE_ALL, 0};
+
+  if (!parse_command_args(value, list_ap_options_args, AT_ARG_COUNT(list_ap_options_args), &args))
+  {
+    return AT_ERROR;
+  }
+
+  scanOptions.sort = args.sort;
+  scanOptions.print_mask = args.mask;
+  scanOptions.rssi_filter = args.rssi;
+  scanOptions.authmode_mask = args.authmode;
+  scanOptions.max_results = args.max;
 
-  print_scanned_networks(numNetworks);
   return AT_OK;
 }
 
@@ -313,23 +780,10 @@ char get_access_point_settings(char *value)
 }
 
 /**
- * Sets the Wifi Access Point settings.
- *
- * @param AT+CWSAP=<ssid>,<pwd>,<chl>,<ecn>,<ssid hidden>
+ * Starts the SoftAP with the given configuration.
  */
-char set_access_point_settings(char *value)
+bool start_access_point(const AP_CONFIG *ap)
 {
-  char ssid[50];
-  char pwd[128];
-  int channel;
-  int ecn;
-  int hidden;
-  int max_connection;
-
-  bool result = false;
-
-  sscanf(value, "\"%[^\"]\",\"%[^\"]\",%d,%d,%d,%d", ssid, pwd, &channel, &ecn, &max_connection,&hidden);
-
   IPAddress local_IP(192,168,4,1);
   IPAddress gateway(192,168,4,1);
   IPAddress subnet(255,255,255,0);
@@ -339,34 +793,85 @@ char set_access_point_settings(char *value)
   WiFi.softAPConfig(local_IP, gateway, subnet);
 
   LogDebug("Configuring softAP...");
-  LogDebug("ssid: %s", ssid);
-  LogDebug("pwd: %s", pwd);
-  LogDebug("channel: %d", channel);
-  LogDebug("ecn: %d", ecn);
-  LogDebug("max_connection: %d", max_connection);
-  LogDebug("hidden: %d", hidden);
-
-  LogDebug("Setting softAP...");
-  WiFi.mode(WIFI_AP);
-
-  if (ecn == 0)
+  LogDebug("ssid: %s", ap->ssid);
+  LogDebug("pwd: %s", ap->pwd);
+  LogDebug("channel: %d", ap->channel);
+  LogDebug("ecn: %d", ap->ecn);
+  LogDebug("max_connection: %d", ap->max_connection);
+  LogDebug("hidden: %d", ap->hidden);
+
+  if (ap->ecn == 0)
   {
     LogDebug("Encryption: Open");
-    result = WiFi.softAP(ssid, NULL, channel, hidden, max_connection);
+    return WiFi.softAP(ap->ssid, NULL, ap->channel, ap->hidden, ap->max_connection);
   }
-  else if (ecn == 1)
+  else if (ap->ecn == 1)
   {
     LogDebug("Encryption: WEP");
     WiFi.enableInsecureWEP(true);
-    result = WiFi.softAP(ssid, pwd, channel, hidden, max_connection);
+    return WiFi.softAP(ap->ssid, ap->pwd, ap->channel, ap->hidden, ap->max_connection);
   }
   else
   {
     LogDebug("Encryption: WPA2");
-    result = WiFi.softAP(ssid, pwd, channel, hidden, max_connection);
+    return WiFi.softAP(ap->ssid, ap->pwd, ap->channel, ap->hidden, ap->max_connection);
   }
+}
+
+typedef struct _access_point_args
+{
+  char ssid[sizeof(((AP_CONFIG *)0)->ssid)];
+  char pwd[sizeof(((AP_CONFIG *)0)->pwd)];
+  long channel;
+  long ecn;
+  long max_connection;
+  long hidden;
+} ACCESS_POINT_ARGS;
+
+static const AT_ARG_SPEC access_point_args[] = {
+  AT_ARG_STRING(ACCESS_POINT_ARGS, ssid, AT_ARG_REQUIRED),
+  AT_ARG_STRING(ACCESS_POINT_ARGS, pwd, AT_ARG_REQUIRED),
+  AT_ARG_INT(ACCESS_POINT_ARGS, channel, AT_ARG_REQUIRED, 1, 14),
+  AT_ARG_INT(ACCESS_POINT_ARGS, ecn, AT_ARG_REQUIRED, 0, 4),
+  AT_ARG_INT(ACCESS_POINT_ARGS, max_connection, AT_ARG_OPTIONAL, 1, AP_MAX_CONNECTIONS),
+  AT_ARG_INT(ACCESS_POINT_ARGS, hidden, AT_ARG_OPTIONAL, 0, 1),
+};
+
+/**
+ * Sets the Wifi Access Point settings, saved in flash.
+ *
+ * @param AT+CWSAP=<ssid>,<pwd>,<chl>,<ecn>[,<max conn>][,<ssid hidden>]
+ */
+char set_access_point_settings(char *value)
+{
+  ACCESS_POINT_ARGS args = {"", "", 0, 0, AP_DEFAULT_MAX_CONNECTIONS, 0};
+  AP_CONFIG ap = {};
 
-  return result ? AT_OK : AT_ERROR;
+  if (!parse_command_args(value, access_point_args, AT_ARG_COUNT(access_point_args), &args))
+  {
+    return AT_ERROR;
+  }
+
+  strcpy(ap.ssid, args.ssid);
+  strcpy(ap.pwd, args.pwd);
+  ap.channel = args.channel;
+  ap.ecn = args.ecn;
+  ap.max_connection = args.max_connection;
+  ap.hidden = args.hidden;
+
+  LogDebug("Setting softAP...");
+  WiFi.mode(WIFI_AP);
+
+  if (!start_access_point(&ap))
+  {
+    return AT_ERROR;
+  }
+
+  settings.wifi_mode = WIFI_AP;
+  settings.ap = ap;
+  save_settings();
+
+  return AT_OK;
 }
 
 /**
@@ -391,11 +896,7 @@ char execute_get_connected_station(char *value)
   {
     sprintf(mac, "%02X:%02X:%02X:%02X:%02X:%02X", station->bssid[0], station->bssid[1], station->bssid[2], station->bssid[3], station->bssid[4], station->bssid[5]);
 
-    Serial.print("+CWLIF:");
-    Serial.print(IPAddress(station->ip).toString().c_str());
-    Serial.print(",");
-    Serial.print(String(mac).c_str());
-    Serial.println();
+    response_printf("+CWLIF:%s,%s\r\n", IPAddress(station->ip).toString().c_str(), mac);
 
     station = STAILQ_NEXT(station, next);
   } while (station != NULL);
@@ -443,6 +944,17 @@ char get_dhcp_setting(char *value)
   return AT_OK;
 }
 
+typedef struct _dhcp_args
+{
+  long operate;
+  long mode;
+} DHCP_ARGS;
+
+static const AT_ARG_SPEC dhcp_args[] = {
+  AT_ARG_INT(DHCP_ARGS, operate, AT_ARG_REQUIRED, 0, 1),
+  AT_ARG_INT(DHCP_ARGS, mode, AT_ARG_REQUIRED, 0, 1),
+};
+
 /**
  * Enable/Disable DHCP
  *
@@ -450,10 +962,15 @@ char get_dhcp_setting(char *value)
  */
 char set_dhcp_setting(char *value)
 {
-  int operate;
-  int mode;
+  DHCP_ARGS args = {};
 
-  sscanf(value, "%d,%d", &operate, &mode);
+  if (!parse_command_args(value, dhcp_args, AT_ARG_COUNT(dhcp_args), &args))
+  {
+    return AT_ERROR;
+  }
+
+  int operate = args.operate;
+  int mode = args.mode;
 
   switch (mode)
   {
@@ -462,19 +979,23 @@ char set_dhcp_setting(char *value)
       wifi_station_dhcpc_start();
     else
       wifi_station_dhcpc_stop();
-    return AT_OK;
+    break;
   case 1 /* AP mode */:
     if (operate == 1)
       wifi_softap_dhcps_start();
     else
       wifi_softap_dhcps_stop();
-    return AT_OK;
+    break;
 
   default:
     return AT_ERROR;
   }
 
-  return AT_ERROR;
+  uint8_t flag = mode == 0 ? SETTINGS_DHCP_STA : SETTINGS_DHCP_AP;
+  settings.dhcp = operate == 1 ? settings.dhcp | flag : settings.dhcp & ~flag;
+  save_settings();
+
+  return AT_OK;
 }
 
 /**
@@ -484,8 +1005,11 @@ char set_dhcp_setting(char *value)
  */
 char set_sta_hostname(char *value)
 {
-  if(WiFi.setHostname(value))
+  if(strlen(value) < sizeof(settings.hostname) && WiFi.setHostname(value))
   {
+    snprintf(settings.hostname, sizeof(settings.hostname), "%s", value);
+    save_settings();
+
     return AT_OK;
   }
   else
@@ -505,21 +1029,61 @@ char get_sta_hostname(char *value)
   return AT_OK;
 }
 
+void restore_wifi_settings()
+{
+  // Applied without the SDK writing its own copy of the configuration to flash
+  WiFi.persistent(false);
+
+  if (settings.wifi_mode != SETTINGS_UNSET)
+  {
+    WiFi.mode((WiFiMode_t)settings.wifi_mode);
+  }
+
+  if (settings.hostname[0] != '\0')
+  {
+    WiFi.setHostname(settings.hostname);
+  }
+
+  if (settings.ap.ssid[0] != '\0' && (WiFi.getMode() & WIFI_AP))
+  {
+    start_access_point(&settings.ap);
+  }
+
+  if (!(settings.dhcp & SETTINGS_DHCP_STA))
+  {
+    wifi_station_dhcpc_stop();
+  }
+
+  if (!(settings.dhcp & SETTINGS_DHCP_AP))
+  {
+    wifi_softap_dhcps_stop();
+  }
+
+  WiFi.persistent(true);
+}
+
 /**
  * Registers the Wifi station AT commands.
  *
+ * @return false if a command could not be registered.
  */
-void register_wifi_commands()
-{
-  at_register_command("CWMODE", (at_callback)get_wifi_mode, (at_callback)set_wifi_mode, 0, 0);
-  at_register_command("CWSTATE", (at_callback)get_wifi_status, 0, 0, 0);
-  at_register_command("CWJAP", (at_callback)get_station_settings, (at_callback)set_station_settings, 0, (at_callback)connect_station);
-  at_register_command("CWRECONNCFG", (at_callback)get_reconnect, (at_callback)set_reconnect, 0, 0);
-  at_register_command("CWLAP", 0, 0, 0, (at_callback)execute_get_list_ap);
-  at_register_command("CWQAP", 0, 0, 0, (at_callback)execute_disconnect_ap);
-  at_register_command("CWSAP", (at_callback)get_access_point_settings, (at_callback)set_access_point_settings, 0, 0);
-  at_register_command("CWLIF", 0, 0, 0, (at_callback)execute_get_connected_station);
-  at_register_command("CWQIF", 0, 0, 0, (at_callback)execute_disconnect_station);
-  at_register_command("CWDHCP", (at_callback)get_dhcp_setting, (at_callback)set_dhcp_setting, 0, 0);
-  at_register_command("CWHOSTNAME", (at_callback)get_sta_hostname, (at_callback)set_sta_hostname, 0, 0);
+bool register_wifi_commands()
+{
+  bool registered = true;
+
+  registered &= at_register_command("CWMODE", (at_callback)get_wifi_mode, (at_callback)set_wifi_mode, 0, 0) == AT_OK;
+  registered &= at_register_command("CWSTATE", (at_callback)get_wifi_status, 0, 0, 0) == AT_OK;
+  registered &= at_register_command("CWJAP", (at_callback)get_station_settings, (at_callback)set_station_settings, 0, (at_callback)connect_station) == AT_OK;
+  registered &= at_register_command("CWFASTJAP", (at_callback)get_fast_join, (at_callback)set_fast_join, 0, 0) == AT_OK;
+  registered &= at_register_command("CWRECONNCFG", (at_callback)get_reconnect, (at_callback)set_reconnect, 0, 0) == AT_OK;
+  registered &= at_register_command("CWLAP", 0, 0, 0, (at_callback)execute_get_list_ap) == AT_OK;
+  registered &= at_register_command("CWLAPOPT", (at_callback)get_list_ap_options, (at_callback)set_list_ap_options, 0, 0) == AT_OK;
+  registered &= at_register_command("CWQAP", 0, 0, 0, (at_callback)execute_disconnect_ap) == AT_OK;
+  registered &= at_register_command("CWSAP", (at_callback)get_access_point_settings, (at_callback)set_access_point_settings, 0, 0) == AT_OK;
+  registered &= at_register_command("CWLIF", 0, 0, 0, (at_callback)execute_get_connected_station) == AT_OK;
+  registered &= at_register_command("CWQIF", 0, 0, 0, (at_callback)execute_disconnect_station) == AT_OK;
+  registered &= at_register_command("CWDHCP", (at_callback)get_dhcp_setting, (at_callback)set_dhcp_setting, 0, 0) == AT_OK;
+  registered &= at_register_command("CWHOSTNAME", (at_callback)get_sta_hostname, (at_callback)set_sta_hostname, 0, 0) == AT_OK;
+
+  return registered;
 }
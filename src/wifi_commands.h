@@ -7,7 +7,12 @@
 extern "C"{
 #endif
 
-void register_wifi_commands();
+/**
+ * @brief Applies the Wi-Fi settings saved in flash (mode, SoftAP, host name, DHCP).
+ */
+void restore_wifi_settings();
+
+bool register_wifi_commands();
 
 #ifdef __cplusplus
 } // extern "C"
@@ -0,0 +1,156 @@
+#!/usr/bin/env python3
+"""
+Loopback throughput benchmark of the UART data path.
+
+The host is connected to the module UART and to the same network as the module.
+For each baud rate, the module is switched with AT+UART_CUR, then a payload
+is looped through the module:
+
+  * uart->tcp: AT+CIPSEND on the UART, received on a TCP socket of the host.
+  * tcp->uart: sent on the TCP socket, received in +IPD frames on the UART
+    (active receive mode).
+
+The effective payload throughput (framing and AT overhead excluded) is reported
+for each direction, and the payload is checked.
+
+Usage:
+    pip install pyserial
+    python tools/uart_bench.py --port /dev/ttyUSB0 --ip 192.168.1.42 \
+        --rates 115200,460800,921600,2000000 --size 65536 [--rtscts]
+
+The module must be connected to the Wi-Fi network (AT+CWJAP) beforehand.
+"""
+
+import argparse
+import os
+import re
+import socket
+import sys
+import time
+
+import serial
+
+SERVER_PORT = 3333
+TIMEOUT_S = 30
+
+
+class Module:
+    def __init__(self, port, baud, rtscts):
+        self.uart = serial.Serial(port, baud, timeout=0.1, rtscts=rtscts)
+        self.rx = b""
+
+    def read_until(self, token, timeout=TIMEOUT_S):
+        deadline = time.monotonic() + timeout
+
+        while token not in self.rx:
+            if time.monotonic() > deadline:
+                raise TimeoutError("waiting for %r, got %r" % (token, self.rx[-200:]))
+
+            self.rx += self.uart.read(max(1, self.uart.in_waiting))
+
+        head, _, self.rx = self.rx.partition(token)
+        return head
+
+    def command(self, line, expect=b"OK\r\n"):
+        self.rx = b""
+        self.uart.write(line.encode() + b"\r\n")
+        response = self.read_until(expect)
+
+        if b"ERROR" in response:
+            raise RuntimeError("%s failed: %r" % (line, response))
+
+        return response
+
+    def set_baud(self, baud, rtscts):
+        # OK is sent at the previous rate, the module switches right after
+        self.command("AT+UART_CUR=%d,8,1,0,%d" % (baud, 3 if rtscts else 0))
+        self.uart.flush()
+        time.sleep(0.05)
+        self.uart.baudrate = baud
+        self.uart.rtscts = rtscts
+        self.uart.reset_input_buffer()
+        self.command("AT")
+
+
+def bench_uart_to_tcp(module, sock, payload):
+    module.command("AT+CIPSEND=0,%d" % len(payload), expect=b"> ")
+
+    start = time.monotonic()
+    module.uart.write(payload)
+
+    received = b""
+    while len(received) < len(payload):
+        received += sock.recv(65536)
+
+    elapsed = time.monotonic() - start
+    module.read_until(b"SEND OK")
+
+    return elapsed, received == payload
+
+
+def bench_tcp_to_uart(module, sock, payload):
+    module.rx = b""
+
+    start = time.monotonic()
+    sock.sendall(payload)
+
+    received = b""
+    while len(received) < len(payload):
+        module.read_until(b"+IPD,")
+        header = module.read_until(b":")
+        length = int(re.match(rb"\d+,(\d+)", header).group(1))
+
+        while len(module.rx) < length:
+            module.rx += module.uart.read(max(1, module.uart.in_waiting))
+
+        received += module.rx[:length]
+        module.rx = module.rx[length:]
+
+    elapsed = time.monotonic() - start
+
+    return elapsed, received == payload
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--port", required=True, help="serial port of the module")
+    parser.add_argument("--ip", required=True, help="IP address of the module")
+    parser.add_argument("--baud", type=int, default=115200, help="current baud rate of the module")
+    parser.add_argument("--rates", default="115200,230400,460800,921600", help="baud rates to measure")
+    parser.add_argument("--size", type=int, default=32768, help="payload size (bytes)")
+    parser.add_argument("--rtscts", action="store_true", help="enable RTS/CTS flow control")
+    args = parser.parse_args()
+
+    module = Module(args.port, args.baud, False)
+    module.command("AT")
+    module.command("AT+CIPRECVMODE=0")
+    module.command("AT+CIPSERVER=1,%d" % SERVER_PORT)
+
+    sock = socket.create_connection((args.ip, SERVER_PORT), timeout=TIMEOUT_S)
+    sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    time.sleep(0.5)
+
+    payload = os.urandom(args.size)
+
+    print("%10s %14s %14s %14s" % ("baud", "uart->tcp B/s", "tcp->uart B/s", "line rate B/s"))
+
+    try:
+        for rate in [int(r) for r in args.rates.split(",")]:
+            module.set_baud(rate, args.rtscts)
+
+            up, up_ok = bench_uart_to_tcp(module, sock, payload)
+            down, down_ok = bench_tcp_to_uart(module, sock, payload)
+
+            print("%10d %14.0f %14.0f %14.0f%s" % (
+                rate, len(payload) / up, len(payload) / down, rate / 10,
+                "" if up_ok and down_ok else "  (payload mismatch)"))
+    finally:
+        module.set_baud(args.baud, False)
+        sock.close()
+        module.command("AT+CIPSERVER=0")
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())